@@ -7,6 +7,11 @@
  */
 
 #include "common.h"
+#include "capture.h"
+#include "endpointCache.h"
+#include "processIndex.h"
+#include "rtMemory.h"
+#include "sessionRegistry.h"
 
 #include <atlcomcli.h>
 #include <audioclient.h>
@@ -16,9 +21,11 @@
 #include <windowsx.h>
 
 #include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <optional>
 #include <vector>
 
-#include "circular_buffer.h"
 #include "clap/helpers/plugin.hxx"
 
 #include "resource.h"
@@ -57,31 +64,131 @@ class ActivateCompletionHandler : public IActivateAudioInterfaceCompletionHandle
 	AutoHandle _event;
 };
 
-struct Process {
-	FILETIME creationTime;
-	DWORD pid;
-	std::wstring exe;
-	std::wstring desc;
+// Notifies us when a process exits. This uses a thread pool wait, so it doesn't
+// poll or tie up a thread of its own.
+class ProcessExitWatcher {
+	public:
+	~ProcessExitWatcher() {
+		this->stop();
+	}
+
+	// Start watching pid, replacing any process we were already watching. onExit
+	// is called from a thread pool thread. Returns false if the process can't be
+	// watched.
+	bool watch(DWORD pid, std::function<void()> onExit) {
+		this->stop();
+		this->_process = OpenProcess(SYNCHRONIZE, false, pid);
+		if (!this->_process) {
+			return false;
+		}
+		this->_onExit = std::move(onExit);
+		return RegisterWaitForSingleObject(&this->_wait, this->_process,
+			ProcessExitWatcher::_callback, this, INFINITE,
+			WT_EXECUTEONLYONCE);
+	}
+
+	// Stop watching. This waits for a callback which is already running to
+	// finish, so it must not be called from onExit.
+	void stop() {
+		if (this->_wait) {
+			UnregisterWaitEx(this->_wait, INVALID_HANDLE_VALUE);
+			this->_wait = nullptr;
+		}
+		this->_process = nullptr;
+	}
 
-	Process(const PROCESSENTRY32& entry):
-	pid(entry.th32ProcessID), exe(entry.szExeFile) {
-		FILETIME exitTime, kernelTime, userTime;
-		AutoHandle process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION , false,
-			this->pid);
-		GetProcessTimes(process, &this->creationTime, &exitTime, &kernelTime,
-			&userTime);
-		std::wostringstream s;
-		s << this->exe << " " << this->pid;
-		this->desc = s.str();
+	private:
+	static void CALLBACK _callback(void* context, BOOLEAN timedOut) {
+		static_cast<ProcessExitWatcher*>(context)->_onExit();
 	}
 
-	bool operator<(const Process& other) {
-		// Order by creation time.
-		return CompareFileTime(&this->creationTime, &other.creationTime) == -1;
+	AutoHandle _process;
+	HANDLE _wait = nullptr;
+	std::function<void()> _onExit;
+};
+
+// Get the creation time of a process, or 0 if it can't be retrieved.
+static uint64_t getProcessCreationTime(uint32_t pid) {
+	AutoHandle process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false,
+		pid);
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if (!process || !GetProcessTimes(process, &creationTime, &exitTime,
+			&kernelTime, &userTime)) {
+		return 0;
 	}
+	return ((uint64_t)creationTime.dwHighDateTime << 32) |
+		creationTime.dwLowDateTime;
+}
+
+// How to get the running processes when building the process list.
+enum class ProcessRefresh {
+	// Use the processes found last time.
+	None,
+	// Take a new snapshot unless one was taken moments ago, perhaps by another
+	// instance.
+	Recent,
+	// Always take a new snapshot.
+	Always,
 };
 
-const uint32_t STATE_VERSION = 2;
+// The running processes, shared by all instances. When a host restores a
+// project, every instance capturing the first matching process looks for it in
+// activate() on the main thread. Taking a snapshot of all processes is slow, so
+// instances activating together share one. This must only be used on the main
+// thread.
+class RunningProcesses {
+	public:
+	// How long a snapshot is reused for ProcessRefresh::Recent.
+	static constexpr auto REUSE_FOR = std::chrono::seconds(1);
+
+	static RunningProcesses& get() {
+		static RunningProcesses processes;
+		return processes;
+	}
+
+	void refresh(ProcessRefresh refresh) {
+		const auto now = std::chrono::steady_clock::now();
+		if (refresh == ProcessRefresh::None ||
+				(refresh == ProcessRefresh::Recent && this->_refreshed &&
+				now - *this->_refreshed < REUSE_FOR)) {
+			return;
+		}
+		PROCESSENTRY32 entry;
+		entry.dwSize = sizeof(PROCESSENTRY32);
+		AutoHandle snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+		if (!Process32First(snapshot, &entry)) {
+			return;
+		}
+		std::vector<ProcessEntry> entries;
+		do {
+			if (entry.th32ProcessID == IDLE_PID ||
+					entry.th32ProcessID == SYSTEM_PID) {
+				continue;
+			}
+			entries.push_back({
+				.pid = entry.th32ProcessID,
+				.parentPid = entry.th32ParentProcessID,
+				.threadCount = entry.cntThreads,
+				.exe = entry.szExeFile,
+			});
+		} while (Process32Next(snapshot, &entry));
+		// Only processes which are new or might have been replaced since the last
+		// refresh are opened.
+		this->_index.update(entries, getProcessCreationTime);
+		this->_refreshed = now;
+	}
+
+	const ProcessIndex& index() const {
+		return this->_index;
+	}
+
+	private:
+	ProcessIndex _index;
+	// When the last snapshot was taken, if ever.
+	std::optional<std::chrono::steady_clock::time_point> _refreshed;
+};
+
+const uint32_t STATE_VERSION = 6;
 
 class App2Clap : public BasePlugin {
 	public:
@@ -112,63 +219,182 @@ class App2Clap : public BasePlugin {
 		if (!this->_capturing) {
 			return false;
 		}
-		if (!this->startCapture(sampleRate, maxFrameCount)) {
-			// Don't leave the Capture button pressed when we aren't capturing.
-			this->_capturing = false;
-			if (this->_dialog) {
-				CheckDlgButton(this->_dialog, ID_CAPTURE, BST_UNCHECKED);
+		this->_sampleRate = sampleRate;
+		this->_maxFrameCount = maxFrameCount;
+		this->_switcher.activate(sampleRate, maxFrameCount);
+		this->_meter.configure(sampleRate);
+		this->_switcher.history().configure(
+			(size_t)(this->_history.minutes * 60 * sampleRate),
+			this->_history.pack16);
+		// Finding the first matching process uses the GUI, so this must happen on
+		// the main thread. Other instances activating at the same time share the
+		// snapshot of running processes this takes.
+		if (!this->choosePid(ProcessRefresh::Recent)) {
+			if (this->canAwaitTarget()) {
+				// The process isn't running yet. Start capturing when it starts.
+				this->awaitTarget();
+			} else {
+				this->onCaptureFailed();
 			}
-			this->updateControls();
-			this->_capture = nullptr;
-			this->_client = nullptr;
+			return true;
 		}
+		this->watchTarget();
+		// Opening the stream can take a while, so do it in the background. We
+		// output silence until it's ready.
+		this->_opener.start(this->_host.host(),
+			[this, pid = this->_pid, include = this->_include] {
+				return this->startCapture(this->_switcher.active(), pid, include);
+			}
+		);
 		return true;
 	}
 
 	void deactivate() noexcept  override {
-		if (!this->_client) {
-			return;
-		}
-		this->_client->Stop();
-		this->_client = nullptr;
-		if (this->_captureEvent) {
-			// Signal the capture thread to exit.
-			SetEvent(this->_captureEvent);
-			this->_captureThread.join();
-			this->_captureEvent = nullptr;
-		}
-		this->_capture = nullptr;
-		// Discard audio we captured but never pushed, so we don't push it when we
-		// start capturing again.
-		this->_buffer.clear();
+		this->_exitWatcher.stop();
+		this->stopAwaitingTarget();
+		this->_opener.stop();
+		this->_switcher.stop();
 	}
 
 	clap_process_status process(const clap_process *process) noexcept override {
-		if (!this->_capture) {
-			return CLAP_PROCESS_SLEEP;
+		RtScope rtScope;
+		MeterScope meterScope(this->_meter, process, false);
+		bool checkedTransport = false;
+		if (this->_offline.isOffline()) {
+			// The transport doesn't change while we wait, so check it once rather
+			// than every time we poll. If the stream isn't open yet, we check it
+			// below once it is.
+			if (this->_opener.isReady()) {
+				if (!this->_switcher.checkTransport(this->_host.host(), process,
+						this->_transport)) {
+					outputSilence(process);
+					return CLAP_PROCESS_CONTINUE;
+				}
+				checkedTransport = true;
+			}
+			if (!this->_offline.waitUntil(this->_host.host(),
+				"App2Clap: the captured audio didn't arrive in time for the offline render, so silence was rendered instead.",
+				[this, process] {
+					return this->_opener.isReady() &&
+						!this->_targetExited.load(std::memory_order_relaxed) &&
+						this->_switcher.active().hasAudio(process->frames_count);
+				}
+			)) {
+				outputSilence(process);
+				return CLAP_PROCESS_CONTINUE;
+			}
 		}
-		if (!this->_captureEvent) {
-			// We aren't using a background thread to capture audio, so capture here.
-			// There might be multiple packets ready to capture.
-			while (this->_buffer.size() < process->frames_count && this->_doCapture()) {}
+		if (!this->_opener.isReady() ||
+				this->_targetExited.load(std::memory_order_relaxed)) {
+			outputSilence(process);
+			return CLAP_PROCESS_SLEEP;
 		}
-		dbg(
-			"process: frames_count " << process->frames_count <<
-			" buffer size " << this->_buffer.size()
-		);
-		if (this->_buffer.size() < process->frames_count) {
+		if (!checkedTransport && !this->_switcher.checkTransport(
+				this->_host.host(), process, this->_transport)) {
+			outputSilence(process);
+			// Don't sleep, since we need to be called to find out when the transport
+			// starts.
 			return CLAP_PROCESS_CONTINUE;
 		}
-		for (uint32_t f = 0; f < process->frames_count; ++f) {
-			std::tie(
-				process->audio_outputs[0].data32[0][f],
-				process->audio_outputs[0].data32[1][f]
-			) = this->_buffer.front();
-			this->_buffer.pop_front();
+		this->_switcher.read(process);
+		// The switcher measured the level while it delivered the audio.
+		meterScope.measured(this->_meter.add(this->_switcher.levels(),
+			process->frames_count));
+		if (this->_switcher.active().isLost() && this->_opener.abandon()) {
+			// Recovering needs to happen on the main thread.
+			this->_host.host()->request_callback(this->_host.host());
 		}
 		return CLAP_PROCESS_CONTINUE;
 	}
 
+	bool implementsParams() const noexcept override { return true; }
+
+	uint32_t paramsCount() const noexcept override {
+		return LEVEL_PARAMS_COUNT;
+	}
+
+	bool paramsInfo(uint32_t paramIndex, clap_param_info* info) const noexcept override {
+		return levelParamInfo(paramIndex, info);
+	}
+
+	bool paramsValue(clap_id paramId, double* value) noexcept override {
+		return levelParamValue(this->_meter.read(), paramId, value);
+	}
+
+	bool paramsValueToText(clap_id paramId, double value, char* display, uint32_t size) noexcept override {
+		return levelParamToText(paramId, value, display, size);
+	}
+
+	void paramsFlush(const clap_input_events* in, const clap_output_events* out) noexcept override {
+		// Our parameters are read-only, so there's nothing to apply.
+	}
+
+	bool implementsRender() const noexcept override { return true; }
+
+	bool renderHasHardRealtimeRequirement() noexcept override {
+		// We can only capture audio in real time.
+		return true;
+	}
+
+	bool renderSetMode(clap_plugin_render_mode mode) noexcept override {
+		// The host might render offline anyway. We handle that in process().
+		this->_offline.setMode(mode);
+		return true;
+	}
+
+	void onMainThread() noexcept override {
+		if (this->_opener.checkFailed()) {
+			this->onCaptureFailed();
+		} else if (this->_opener.checkLost()) {
+			// The audio engine lost the stream; e.g. because it was restarted. Keep
+			// trying to open it again in the background. We output silence until
+			// we succeed.
+			++this->_recoveries;
+			this->_opener.start(this->_host.host(),
+				[this, pid = this->_pid, include = this->_include] {
+					CaptureStream& stream = this->_switcher.active();
+					stream.stop();
+					return this->startCapture(stream, pid, include);
+				},
+				true
+			);
+		}
+		// This also finishes a switch, so it must be called even if the active
+		// stream failed or was lost.
+		if (this->_switcher.checkFailed()) {
+			// We couldn't switch to the new process. Restart so that activate() tries
+			// again and reports the failure if it still can't.
+			this->_host.host()->request_restart(this->_host.host());
+		}
+		if (this->_opener.isReady()) {
+			// The transport might have stopped or started.
+			this->_switcher.applyTransport();
+		}
+		if (this->_targetExited && !this->_awaitingTarget) {
+			// The process we were capturing exited. process() is already outputting
+			// silence.
+			this->_exitWatcher.stop();
+			if (this->canAwaitTarget()) {
+				this->_pid = 0;
+				this->awaitTarget();
+			}
+		}
+		if (this->_awaitingTarget && this->mightHaveTarget()) {
+			// A matching process might have started. choosePid() looks for it among
+			// all running processes.
+			if (this->choosePid(ProcessRefresh::Always)) {
+				this->stopAwaitingTarget();
+				this->applySource();
+			}
+		}
+	}
+
+	// The number of times we've recovered from losing the stream since we were
+	// created.
+	uint64_t recoveryCount() const {
+		return this->_recoveries;
+	}
+
 	bool implementsGui() const noexcept override { return true; }
 
 	bool guiIsApiSupported(const char* api, bool isFloating) noexcept override {
@@ -187,6 +413,7 @@ class App2Clap : public BasePlugin {
 	}
 
 	void guiDestroy() noexcept override {
+		SessionRegistry::get().removeListener(this->_dialog);
 		DestroyWindow(this->_dialog);
 		this->_dialog = this->_processCombo = nullptr;
 	}
@@ -207,7 +434,10 @@ class App2Clap : public BasePlugin {
 			App2Clap::dialogProc);
 		SetWindowLongPtr(this->_dialog, GWLP_USERDATA, (LONG_PTR)this);
 		this->_processCombo = GetDlgItem(this->_dialog, ID_PROCESS);
-		this->buildProcessList();
+		CheckDlgButton(this->_dialog, ID_SESSIONS_ONLY,
+			this->_sessionsOnly ? BST_CHECKED : BST_UNCHECKED);
+		this->buildProcessList(ProcessRefresh::Recent);
+		SessionRegistry::get().addListener(this->_dialog);
 		if (this->_pid == SYSTEM_PID) {
 			CheckDlgButton(this->_dialog, ID_EVERYTHING, BST_CHECKED);
 		} else {
@@ -223,7 +453,22 @@ class App2Clap : public BasePlugin {
 		// The GUI can be closed and reopened while we're capturing.
 		CheckDlgButton(this->_dialog, ID_CAPTURE,
 			this->_capturing ? BST_CHECKED : BST_UNCHECKED);
+		CheckDlgButton(this->_dialog, ID_RECORD,
+			this->_switcher.recorder().isRecording() ? BST_CHECKED : BST_UNCHECKED);
 		this->updateControls();
+		showHistorySettings(this->_dialog, this->_history);
+		showSpillMode(this->_dialog, this->_spillMode);
+		CheckDlgButton(this->_dialog, ID_OFFLINE_WAIT,
+			this->_offline.shouldWait() ? BST_CHECKED : BST_UNCHECKED);
+		CheckDlgButton(this->_dialog, ID_TRANSPORT_STOP,
+			this->_transport.isEnabled() ? BST_CHECKED : BST_UNCHECKED);
+		// Another instance might have been chosen while the GUI was closed.
+		CheckDlgButton(this->_dialog, ID_LATENCY_RECORDER,
+			this->_switcher.measuresLatency() ? BST_CHECKED : BST_UNCHECKED);
+		showCaptureStatus(this->_dialog, this->_capturing, this->_opener,
+			this->_switcher, this->_offline, this->recoveryCount());
+		showLevels(this->_dialog, this->_meter, this->_capturing);
+		SetTimer(this->_dialog, STATUS_TIMER, 250, nullptr);
 		return true;
 	}
 
@@ -239,13 +484,24 @@ class App2Clap : public BasePlugin {
 		const wchar_t* filter = this->_filter.c_str();
 		stream->write(stream, filter, nBytes);
 		stream->write(stream, &this->_captureFirstMatching, sizeof(bool));
+		stream->write(stream, &this->_history.minutes, sizeof(uint32_t));
+		stream->write(stream, &this->_history.pack16, sizeof(bool));
+		const SpillMode spill = this->_spillMode;
+		stream->write(stream, &spill, sizeof(SpillMode));
+		const bool offlineWait = this->_offline.shouldWait();
+		stream->write(stream, &offlineWait, sizeof(bool));
+		const bool transportStop = this->_transport.isEnabled();
+		stream->write(stream, &transportStop, sizeof(bool));
 		return true;
 	}
 
 	bool stateLoad(const clap_istream* stream) noexcept override {
 		uint32_t version = 0;
 		stream->read(stream, &version, sizeof(uint32_t));
-		if (version != STATE_VERSION) {
+		// Version 3 added the history settings, version 4 added the spill mode,
+		// version 5 added the offline setting and version 6 added the transport
+		// setting.
+		if (version < 2 || version > STATE_VERSION) {
 			return false;
 		}
 		stream->read(stream, &this->_include, sizeof(bool));
@@ -263,13 +519,31 @@ class App2Clap : public BasePlugin {
 			this->_filter = std::wstring(filter.get(), nChars);
 		}
 		stream->read(stream, &this->_captureFirstMatching, sizeof(bool));
+		if (version >= 3) {
+			stream->read(stream, &this->_history.minutes, sizeof(uint32_t));
+			stream->read(stream, &this->_history.pack16, sizeof(bool));
+		}
+		if (version >= 4) {
+			SpillMode spill = SpillMode::Off;
+			stream->read(stream, &spill, sizeof(SpillMode));
+			this->_spillMode = std::min(spill, SpillMode::CatchUp);
+		}
+		if (version >= 5) {
+			bool offlineWait = true;
+			stream->read(stream, &offlineWait, sizeof(bool));
+			this->_offline.setWait(offlineWait);
+		}
+		if (version >= 6) {
+			bool transportStop = false;
+			stream->read(stream, &transportStop, sizeof(bool));
+			this->_transport.setEnabled(transportStop);
+		}
 		// We don't save whether we were capturing, since we don't save the process id
 		// and thus can't resume capturing a specific process. However, we do know what
 		// to capture when capturing everything or the first matching process, so behave
 		// as if the user pressed Capture in those cases.
 		this->_capturing = everything || this->_captureFirstMatching;
-		// Restart the plugin. We will set up the send in activate().
-		this->_host.host()->request_restart(this->_host.host());
+		this->applySource();
 		return true;
 	}
 
@@ -279,10 +553,33 @@ class App2Clap : public BasePlugin {
 			return TRUE;
 		}
 		auto* plugin = (App2Clap*)GetWindowLongPtr(dialogHwnd, GWLP_USERDATA);
+		if (msg == WM_TIMER && wParam == STATUS_TIMER) {
+			showCaptureStatus(dialogHwnd, plugin->_capturing, plugin->_opener,
+				plugin->_switcher, plugin->_offline, plugin->recoveryCount());
+			showLevels(dialogHwnd, plugin->_meter, plugin->_capturing);
+			plugin->updateSessionLevels();
+			return TRUE;
+		}
+		if (msg == WM_SESSIONS_CHANGED) {
+			if (plugin->_sessionsOnly) {
+				// The new session might belong to a process we haven't seen yet.
+				plugin->buildProcessList(ProcessRefresh::Always);
+			}
+			return TRUE;
+		}
 		if (msg == WM_COMMAND) {
 			const WORD cid = LOWORD(wParam);
 			if (cid == ID_PROCESS_INCLUDE || cid == ID_PROCESS_EXCLUDE || cid == ID_EVERYTHING) {
 				plugin->updateControls();
+				if (plugin->_capturing) {
+					plugin->switchSource();
+				}
+				return TRUE;
+			}
+			if (cid == ID_PROCESS && HIWORD(wParam) == CBN_SELCHANGE) {
+				if (plugin->_capturing) {
+					plugin->switchSource();
+				}
 				return TRUE;
 			}
 			if (cid == ID_FIRST) {
@@ -293,32 +590,70 @@ class App2Clap : public BasePlugin {
 			if (cid == ID_FILTER && HIWORD(wParam) == EN_KILLFOCUS) {
 				wchar_t rawFilter[100];
 				GetDlgItemText(dialogHwnd, ID_FILTER, rawFilter, _countof(rawFilter));
-				plugin->_filter = rawFilter;
 				// We want to match case insensitively, so convert to lower case.
-				std::transform(plugin->_filter.begin(), plugin->_filter.end(),
-					plugin->_filter.begin(), std::tolower);
-				plugin->buildProcessList();
+				plugin->_filter = foldCase(rawFilter);
+				// Filtering doesn't need a new snapshot of the running processes.
+				plugin->buildProcessList(ProcessRefresh::None);
+				return TRUE;
+			}
+			if (cid == ID_SESSIONS_ONLY) {
+				plugin->_sessionsOnly = IsDlgButtonChecked(dialogHwnd,
+					ID_SESSIONS_ONLY);
+				plugin->buildProcessList(ProcessRefresh::None);
+				return TRUE;
+			}
+			if (cid == ID_RESET_COUNTERS) {
+				plugin->_switcher.post(CaptureCommand::ResetCounters);
+				return TRUE;
+			}
+			if (cid == ID_RECORD) {
+				toggleRecording(dialogHwnd, plugin->_switcher);
+				return TRUE;
+			}
+			if (cid == ID_OFFLINE_WAIT) {
+				plugin->_offline.setWait(IsDlgButtonChecked(dialogHwnd,
+					ID_OFFLINE_WAIT));
+				return TRUE;
+			}
+			if (cid == ID_LATENCY_RECORDER) {
+				plugin->_switcher.setMeasuresLatency(IsDlgButtonChecked(dialogHwnd,
+					ID_LATENCY_RECORDER));
+				return TRUE;
+			}
+			if (cid == ID_TRANSPORT_STOP) {
+				plugin->_transport.setEnabled(IsDlgButtonChecked(dialogHwnd,
+					ID_TRANSPORT_STOP));
+				return TRUE;
+			}
+			if (cid == ID_SPILL && HIWORD(wParam) == CBN_SELCHANGE) {
+				plugin->_spillMode = readSpillMode(dialogHwnd);
+				// This only applies to streams we open from now on.
+				if (plugin->_capturing) {
+					plugin->_host.host()->request_restart(plugin->_host.host());
+				}
+				return TRUE;
+			}
+			if (cid == ID_SAVE_HISTORY) {
+				saveHistory(dialogHwnd, plugin->_switcher.history(),
+					plugin->_sampleRate);
+				return TRUE;
+			}
+			if (readHistorySettings(dialogHwnd, cid, HIWORD(wParam),
+					plugin->_history)) {
+				// The history is allocated in activate().
+				if (plugin->_capturing) {
+					plugin->_host.host()->request_restart(plugin->_host.host());
+				}
 				return TRUE;
 			}
 			if (cid == ID_REFRESH) {
-				plugin->buildProcessList();
+				plugin->buildProcessList(ProcessRefresh::Always);
 				return TRUE;
 			}
 			if (cid == ID_CAPTURE) {
 				plugin->_capturing = IsDlgButtonChecked(dialogHwnd, ID_CAPTURE);
 				if (plugin->_capturing) {
-					if (IsDlgButtonChecked(dialogHwnd, ID_EVERYTHING)) {
-						plugin->_pid = SYSTEM_PID;
-						plugin->_include = false;
-					} else {
-						const int choice = ComboBox_GetCurSel(plugin->_processCombo);
-						if (choice == CB_ERR) {
-							plugin->_pid = 0;
-						} else {
-							plugin->_pid = plugin->_processes[choice].pid;
-						}
-						plugin->_include = IsDlgButtonChecked(dialogHwnd, ID_PROCESS_INCLUDE);
-					}
+					plugin->readSource();
 				}
 				plugin->updateControls();
 				// Restart the plugin. We will start or stop the capture in activate().
@@ -329,26 +664,185 @@ class App2Clap : public BasePlugin {
 		return FALSE;
 	}
 
-	bool startCapture(double sampleRate, uint32_t maxFrameCount) {
-		if (!this->_pid) {
-			if (!this->_captureFirstMatching || this->_filter.empty()) {
-				// Nothing to capture yet.
-				return false;
+	// Set the process to capture from the choices in the dialog.
+	void readSource() {
+		if (IsDlgButtonChecked(this->_dialog, ID_EVERYTHING)) {
+			this->_pid = SYSTEM_PID;
+			this->_include = false;
+		} else {
+			const int choice = ComboBox_GetCurSel(this->_processCombo);
+			if (choice == CB_ERR) {
+				this->_pid = 0;
+			} else {
+				this->_pid = this->_processes[choice]->pid;
 			}
-			// We're capturing the first matching process.
-			this->buildProcessList();
-			if (this->_processes.empty()) {
-				// No matching processes.
-				return false;
+			this->_include = IsDlgButtonChecked(this->_dialog, ID_PROCESS_INCLUDE);
+		}
+	}
+
+	// Called when the user changes the choices in the dialog while capturing.
+	void switchSource() {
+		const DWORD oldPid = this->_pid;
+		const bool oldInclude = this->_include;
+		this->readSource();
+		if (this->_pid == 0) {
+			// The user hasn't chosen a process yet. Keep capturing the old one.
+			this->_pid = oldPid;
+			this->_include = oldInclude;
+			return;
+		}
+		if (this->_pid == oldPid && this->_include == oldInclude) {
+			return;
+		}
+		this->applySource();
+	}
+
+	// Start capturing with the current settings. If we're already capturing, we
+	// switch to the new source without interrupting the audio. Otherwise, we
+	// restart the plug-in and the capture is started in activate().
+	void applySource() {
+		// Whatever we were waiting for, the user or the watcher has now chosen
+		// something else.
+		this->_targetExited = false;
+		this->stopAwaitingTarget();
+		if (this->_capturing && this->_opener.isReady() &&
+				this->choosePid(ProcessRefresh::Recent)) {
+			this->watchTarget();
+			this->_switcher.switchTo(this->_host.host(),
+				[this, pid = this->_pid, include = this->_include]
+				(CaptureStream& stream) {
+					return this->startCapture(stream, pid, include);
+				}
+			);
+			return;
+		}
+		this->_host.host()->request_restart(this->_host.host());
+	}
+
+	// Watch for the process we're capturing to exit so we can stop delivering
+	// its (silent) audio and, if we're capturing the first matching process,
+	// capture the next one which starts.
+	void watchTarget() {
+		this->_targetExited = false;
+		if (!this->_include || this->_pid == SYSTEM_PID) {
+			// If we're excluding a process, we still capture everything else after it
+			// exits.
+			this->_exitWatcher.stop();
+			return;
+		}
+		this->_exitWatcher.watch(this->_pid, [this] {
+			this->_targetExited = true;
+			this->_host.host()->request_callback(this->_host.host());
+		});
+	}
+
+	// Whether we can wait for a process matching the filter to start.
+	bool canAwaitTarget() const {
+		return this->_captureFirstMatching && !this->_filter.empty() &&
+			this->_pid != SYSTEM_PID;
+	}
+
+	// Wait for a process matching the filter to start. Processes which play
+	// audio create an audio session, so rather than polling for new processes,
+	// we check whenever a session is created.
+	void awaitTarget() {
+		this->_awaitingTarget = true;
+		{
+			std::lock_guard lock(this->_sessionPidsMutex);
+			this->_sessionPids.clear();
+			// Check now in case the process started before we registered.
+			this->_sessionPids.push_back(0);
+		}
+		SessionRegistry::get().addCallback(this, [this] (DWORD pid) {
+			{
+				std::lock_guard lock(this->_sessionPidsMutex);
+				this->_sessionPids.push_back(pid);
 			}
-			this->_pid = this->_processes[0].pid;
+			this->_host.host()->request_callback(this->_host.host());
+		});
+		this->_host.host()->request_callback(this->_host.host());
+	}
+
+	// Whether a process which created a session since we last checked might be
+	// one we're waiting for. Taking a snapshot of all processes is expensive and
+	// sessions are created often, so we only do that if a session belongs to a
+	// process we don't know about or one which matches the filter.
+	bool mightHaveTarget() {
+		std::vector<DWORD> pids;
+		{
+			std::lock_guard lock(this->_sessionPidsMutex);
+			pids.swap(this->_sessionPids);
+		}
+		for (DWORD pid : pids) {
+			if (pid == 0) {
+				// We don't know which process this is.
+				return true;
+			}
+			auto info = RunningProcesses::get().index().find(pid);
+			if (!info || info->creationTime != getProcessCreationTime(pid)) {
+				// This is a new process, or its pid was reused.
+				return true;
+			}
+			if (info->key.find(this->_filter) != std::wstring::npos) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void stopAwaitingTarget() {
+		if (this->_awaitingTarget) {
+			SessionRegistry::get().removeCallback(this);
+			this->_awaitingTarget = false;
+		}
+	}
+
+	// Ensure we have a pid to capture, refreshing the running processes as
+	// specified if we need to find one. Returns false if there is nothing to
+	// capture.
+	bool choosePid(ProcessRefresh refresh) {
+		if (this->_pid) {
+			return true;
+		}
+		if (!this->_captureFirstMatching || this->_filter.empty()) {
+			// Nothing to capture yet.
+			return false;
+		}
+		// We're capturing the first matching process.
+		this->buildProcessList(refresh);
+		if (this->_processes.empty()) {
+			// No matching processes.
+			return false;
 		}
+		this->_pid = this->_processes[0]->pid;
+		return true;
+	}
+
+	void onCaptureFailed() {
+		// Don't leave the Capture button pressed when we aren't capturing.
+		this->_capturing = false;
+		if (this->_dialog) {
+			CheckDlgButton(this->_dialog, ID_CAPTURE, BST_UNCHECKED);
+		}
+		this->updateControls();
+		this->_exitWatcher.stop();
+		this->stopAwaitingTarget();
+		this->_switcher.stop();
+	}
+
+	// Called in a background thread by StreamOpener to start capturing pid on
+	// stream. The settings are passed in rather than read from members because
+	// the user can change those while we're opening.
+	bool startCapture(CaptureStream& stream, DWORD pid, bool include) {
+		const double sampleRate = this->_sampleRate;
+		const uint32_t maxFrameCount = this->_maxFrameCount;
+		const SpillMode spill = this->_spillMode;
 		AUDIOCLIENT_ACTIVATION_PARAMS params = {
 			.ActivationType = AUDIOCLIENT_ACTIVATION_TYPE_PROCESS_LOOPBACK,
 		};
-		params.ProcessLoopbackParams.TargetProcessId = this->_pid;
+		params.ProcessLoopbackParams.TargetProcessId = pid;
 		params.ProcessLoopbackParams.ProcessLoopbackMode =
-			this->_include ?
+			include ?
 			PROCESS_LOOPBACK_MODE_INCLUDE_TARGET_PROCESS_TREE :
 			PROCESS_LOOPBACK_MODE_EXCLUDE_TARGET_PROCESS_TREE;
 		PROPVARIANT propvar = { .vt = VT_BLOB };
@@ -376,8 +870,8 @@ class App2Clap : public BasePlugin {
 			}
 			return CComQIPtr<IAudioClient>(activated);
 		};
-		this->_client = getClient();
-		if (!this->_client) {
+		CComPtr<IAudioClient> client = getClient();
+		if (!client) {
 			return false;
 		}
 		WAVEFORMATEX format = {
@@ -393,41 +887,52 @@ class App2Clap : public BasePlugin {
 		// it can't be relied upon.
 		const REFERENCE_TIME bufferDuration = (REFERENCE_TIME)maxFrameCount *
 			REFTIMES_PER_SEC / sampleRate;
-		HRESULT hr = this->_client->Initialize(
-			AUDCLNT_SHAREMODE_SHARED,
-			AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
-			AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
-			bufferDuration, 0, &format, nullptr
-		);
-		if (FAILED(hr)) {
-			return false;
-		}
-		UINT32 bufferSize = 0;
-		this->_client->GetBufferSize(&bufferSize);
-		if (FAILED(hr)) {
-			return false;
-		}
-		AutoHandle event;
-		if (bufferSize * 3 < maxFrameCount) {
-			// Windows will only buffer 3 packets at a time. If the host max frame
-			// count is larger than that, capture audio in a background thread to
-			// avoid continual buffer underruns. Note that the thread is less optimal
-			// (and results in glitches) when the host max frame count is lower.
-			this->_client = getClient();
-			if (!this->_client) {
+		constexpr DWORD flags = AUDCLNT_STREAMFLAGS_LOOPBACK |
+			AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+		HRESULT hr;
+		EndpointCaps caps;
+		EndpointCache::Probe probe;
+		const std::wstring endpoint = EndpointCache::processLoopback(pid, include,
+			bufferDuration);
+		const bool cached = EndpointCache::get().find(endpoint,
+			format.nSamplesPerSec, caps, probe);
+		if (!cached) {
+			// We need to know the buffer size to decide how to initialise the stream,
+			// but we can only get it by initialising a client. This only happens the
+			// first time we capture this process this way at this sample rate and
+			// host block size.
+			hr = client->Initialize(AUDCLNT_SHAREMODE_SHARED, flags, bufferDuration,
+				0, &format, nullptr);
+			if (FAILED(hr)) {
 				return false;
 			}
-			hr = this->_client->Initialize(
-				AUDCLNT_SHAREMODE_SHARED,
-				AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
-				AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
-				bufferDuration, 0, &format, nullptr
-			);
+			hr = client->GetBufferSize(&caps.bufferFrames);
 			if (FAILED(hr)) {
 				return false;
 			}
-			event = CreateEvent(nullptr, false, false, nullptr);
-			hr = this->_client->SetEventHandle(event);
+			EndpointCache::get().add(endpoint, format.nSamplesPerSec, caps);
+		}
+		// Windows will only buffer 3 packets at a time. If the host max frame
+		// count is larger than that, capture audio in a background thread to
+		// avoid continual buffer underruns. Note that the thread is less optimal
+		// (and results in glitches) when the host max frame count is lower.
+		// Spilling also needs the thread, since it must keep capturing while the
+		// host isn't calling us.
+		const bool threaded = caps.bufferFrames * 3 < maxFrameCount ||
+			spill != SpillMode::Off;
+		if (cached || threaded) {
+			if (!cached) {
+				// The client we used to probe was initialised without events.
+				client = getClient();
+				if (!client) {
+					return false;
+				}
+			}
+			hr = client->Initialize(
+				AUDCLNT_SHAREMODE_SHARED,
+				flags | (threaded ? AUDCLNT_STREAMFLAGS_EVENTCALLBACK : 0),
+				bufferDuration, 0, &format, nullptr
+			);
 			if (FAILED(hr)) {
 				return false;
 			}
@@ -436,107 +941,88 @@ class App2Clap : public BasePlugin {
 			"activate: maxFrameCount " << maxFrameCount <<
 			" sampleRate " << sampleRate <<
 			" requested bufferDuration " << bufferDuration <<
-			" received bufferSize " << bufferSize <<
-			" threaded " << (bool)event
+			" bufferSize " << caps.bufferFrames <<
+			" cached " << cached <<
+			" threaded " << threaded
 		);
-		hr = this->_client->GetService(__uuidof(IAudioCaptureClient), (void**)&this->_capture);
-		if (FAILED(hr)) {
-			return false;
-		}
-		if (event) {
-			this->_captureEvent =std::move(event);
-			this->_captureThread = std::thread([this] {
-				this->_captureThreadFunc();
-			});
-		}
-		this->_client->Start();
-		return true;
+		// Windows sometimes returns a much smaller buffer size than the size of the
+		// packets it subsequently returns. Since we can't trust that, just use a
+		// large constant buffer size.
+		return stream.start(client, sampleRate, 24576, threaded, spill);
 	}
 
-	void buildProcessList() {
-		PROCESSENTRY32 entry;
-		entry.dwSize = sizeof(PROCESSENTRY32);
-		AutoHandle snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-		if (!Process32First(snapshot, &entry)) {
-			return;
-		}
+	// Build the list of processes matching the filter, refreshing the running
+	// processes first as specified.
+	void buildProcessList(ProcessRefresh refresh) {
+		RunningProcesses::get().refresh(refresh);
 		DWORD chosenPid = this->_pid;
 		if (this->_processCombo) {
 			const int choice = ComboBox_GetCurSel(this->_processCombo);
 			if (choice != CB_ERR) {
-				chosenPid = this->_processes[choice].pid;
+				chosenPid = this->_processes[choice]->pid;
 			}
-			ComboBox_ResetContent(this->_processCombo);
 		}
-		this->_processes.clear();
-		do {
-			if (entry.th32ProcessID == IDLE_PID || entry.th32ProcessID == SYSTEM_PID) {
-				continue;
-			}
-			Process process(entry);
-			if (!this->_filter.empty()) {
-				// Convert to lower case for match.
-				std::wstring lower = process.desc;
-				std::transform(lower.begin(), lower.end(), lower.begin(), std::tolower);
-				if (lower.find(this->_filter) == std::string::npos) {
-					continue;
-				}
-			}
-			this->_processes.push_back(std::move(process));
-		} while (Process32Next(snapshot, &entry));
-		// Sort processes by creation time so parent processes always appear first.
-		std::sort(this->_processes.begin(), this->_processes.end());
+		this->_processes = RunningProcesses::get().index().query(this->_filter);
+		if (this->_sessionsOnly) {
+			this->_sessions = SessionRegistry::get().snapshot(
+				refresh == ProcessRefresh::Always);
+			std::erase_if(this->_processes, [this](const auto& process) {
+				return !this->_sessions->contains(process->pid);
+			});
+		}
 		if (!this->_processCombo) {
 			return;
 		}
+		// Avoid redrawing for every process we add.
+		SendMessage(this->_processCombo, WM_SETREDRAW, false, 0);
+		ComboBox_ResetContent(this->_processCombo);
 		for (const auto& process: this->_processes) {
-			ComboBox_AddString(this->_processCombo, process.desc.c_str());
-			if (process.pid == chosenPid) {
+			const int index = ComboBox_AddString(this->_processCombo,
+				this->describeProcess(*process).c_str());
+			if (process->pid == chosenPid) {
 				// Select the previously chosen process.
-				ComboBox_SetCurSel(this->_processCombo,
-					ComboBox_GetCount(this->_processCombo) - 1);
+				ComboBox_SetCurSel(this->_processCombo, index);
 			}
 		}
+		SendMessage(this->_processCombo, WM_SETREDRAW, true, 0);
+		InvalidateRect(this->_processCombo, nullptr, true);
 	}
 
-	bool _doCapture() {
-		UINT32 numFrames; // The number of captured frames.
-		// GetNextPacketSize and GetBuffer should return the same number of frames.
-		// The documentation doesn't say that GetNextPacketSize is required.
-		// However, if you don't call it first and there is no packet to retrieve,
-		// GetBuffer succeeds even though it returns a packet with bogus data.
-		HRESULT hr = this->_capture->GetNextPacketSize(&numFrames);
-		if (FAILED(hr)) {
-			return false;
-		}
-		if (numFrames == 0) {
-			return false;
+	// The text to show for process in the list. When we're only showing
+	// processes with audio sessions, this includes the current peak level.
+	std::wstring describeProcess(const ProcessInfo& process) {
+		if (!this->_sessionsOnly) {
+			return process.desc;
 		}
-		DWORD flags;
-		BYTE* data;
-		hr = this->_capture->GetBuffer(&data, &numFrames, &flags, nullptr, nullptr);
-		if (FAILED(hr) || numFrames == 0) {
-			return false;
-		}
-		dbg("_doCapture: captured " << numFrames << " frames");
-		for (UINT32 f = 0; f < numFrames; ++f) {
-			std::pair<float, float> frame;
-			memcpy(&frame, data, BYTES_PER_FRAME);
-			this->_buffer.push_back(frame);
-			data += BYTES_PER_FRAME;
-		}
-		this->_capture->ReleaseBuffer(numFrames);
-		return true;
+		// Round to 10% so the text doesn't change constantly.
+		const int peak = (int)(this->_sessions->peak(process.pid) * 10 + 0.5f) * 10;
+		return process.desc + L" (peak " + std::to_wstring(peak) + L"%)";
 	}
 
-	void _captureThreadFunc() {
-		for (; ;) {
-			WaitForSingleObject(this->_captureEvent, INFINITE);
-			if (!this->_client) {
-				return;
+	// Update the peak levels shown in the process list. This is called
+	// periodically while the dialog is open.
+	void updateSessionLevels() {
+		if (!this->_sessionsOnly ||
+				ComboBox_GetDroppedState(this->_processCombo)) {
+			// Replacing items while the list is open would disrupt the user.
+			return;
+		}
+		const int choice = ComboBox_GetCurSel(this->_processCombo);
+		bool changed = false;
+		for (int i = 0; i < (int)this->_processes.size(); ++i) {
+			const std::wstring text = this->describeProcess(*this->_processes[i]);
+			std::wstring current(ComboBox_GetLBTextLen(this->_processCombo, i),
+				L'\0');
+			ComboBox_GetLBText(this->_processCombo, i, current.data());
+			if (text == current) {
+				continue;
 			}
-			this->_doCapture();
-			dbg("thread: size after capture " << this->_buffer.size());
+			ComboBox_DeleteString(this->_processCombo, i);
+			ComboBox_InsertString(this->_processCombo, i, text.c_str());
+			changed = true;
+		}
+		if (changed) {
+			ComboBox_SetCurSel(this->_processCombo, choice);
 		}
 	}
 
@@ -546,36 +1032,47 @@ class App2Clap : public BasePlugin {
 		EnableWindow(GetDlgItem(this->_dialog, ID_REFRESH), enable);
 	}
 
-	// Update which controls are enabled. The settings can only be changed when we
-	// aren't capturing. The process can only be chosen when we aren't capturing
-	// everything.
+	// Update which controls are enabled. The process can only be chosen when we
+	// aren't capturing everything. The settings can be changed while capturing,
+	// in which case we switch to the new source.
 	void updateControls() {
 		if (!this->_dialog) {
 			return;
 		}
-		const bool enable = !this->_capturing;
 		this->enableProcessChoice(
-			enable && !IsDlgButtonChecked(this->_dialog, ID_EVERYTHING));
-		EnableWindow(GetDlgItem(this->_dialog, ID_PROCESS_INCLUDE), enable);
-		EnableWindow(GetDlgItem(this->_dialog, ID_PROCESS_EXCLUDE), enable);
-		EnableWindow(GetDlgItem(this->_dialog, ID_EVERYTHING), enable);
-		EnableWindow(GetDlgItem(this->_dialog, ID_FIRST), enable);
-	}
-
-	CComPtr<IAudioClient> _client;
-	CComPtr<IAudioCaptureClient> _capture;
-	// A buffer to store audio we've captured but not yet sent to the host.
-	using Buffer = CircularBuffer<std::pair<float, float>>;
-	// Windows sometimes returns a much smaller buffer size than the size of the
-	// packets it subsequently returns. Since we can't trust that, just use a
-	// large constant buffer size.
-	Buffer _buffer{24576};
+			!IsDlgButtonChecked(this->_dialog, ID_EVERYTHING));
+	}
+
+	StreamOpener _opener;
+	CaptureSwitcher _switcher;
+	double _sampleRate = 0;
+	uint32_t _maxFrameCount = 0;
+	uint64_t _recoveries = 0;
+	HistorySettings _history;
+	// This is read by the threads which open streams.
+	std::atomic<SpillMode> _spillMode = SpillMode::Off;
+	OfflineRender _offline;
+	LevelMeter _meter;
+	TransportIdle _transport;
 	HWND _dialog = nullptr;
 	HWND _processCombo = nullptr;
 	// The string by which to filter processes.
 	std::wstring _filter;
-	// The processes we have found.
-	std::vector<Process> _processes;
+	// The processes matching the filter, in the order they appear in the list.
+	std::vector<std::shared_ptr<const ProcessInfo>> _processes;
+	ProcessExitWatcher _exitWatcher;
+	// Set from a thread pool thread when the process we're capturing exits.
+	std::atomic<bool> _targetExited = false;
+	// Whether we're waiting for a process matching the filter to start.
+	bool _awaitingTarget = false;
+	// The pids of processes which created sessions while we were waiting, added
+	// from Windows threads. 0 means we need to check all processes.
+	std::mutex _sessionPidsMutex;
+	std::vector<DWORD> _sessionPids;
+	// Whether to only list processes with audio sessions.
+	bool _sessionsOnly = false;
+	// The sessions we found when we last built the list.
+	std::shared_ptr<const SessionList> _sessions;
 	// The chosen pid.
 	DWORD _pid = 0;
 	// Whether to include audio from this pid or exclude audio from this pid.
@@ -584,8 +1081,6 @@ class App2Clap : public BasePlugin {
 	bool _captureFirstMatching = false;
 	// Whether the user has pressed Capture; i.e. whether we should be capturing.
 	bool _capturing = false;
-	std::thread _captureThread;
-	AutoHandle _captureEvent;
 };
 
 extern const clap_plugin_descriptor app2ClapDescriptor = {
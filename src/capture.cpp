@@ -0,0 +1,1095 @@
+/*
+ * App2Clap
+ * Code shared by the capture plug-ins
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2025-2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "capture.h"
+
+#include <commdlg.h>
+#include <windowsx.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "latency.h"
+#include "resource.h"
+#include "rtMemory.h"
+#include "wavFile.h"
+
+// How long to fade in when a stream starts, in seconds.
+constexpr double FADE_IN_SECS = 0.01;
+// How long to crossfade when switching sources, in seconds.
+constexpr double CROSSFADE_SECS = 0.05;
+// How much audio we can spill while the host isn't asking for audio, in
+// seconds.
+constexpr double SPILL_SECS = 60;
+// The CPU core to pin capture threads to, or -1 to let the OS choose.
+#ifdef CAPTURE_THREAD_CORE
+constexpr int CAPTURE_CORE = CAPTURE_THREAD_CORE;
+#else
+constexpr int CAPTURE_CORE = -1;
+#endif
+// How much faster we play while catching up after a spill. This is small enough
+// that the change in pitch is barely noticeable.
+constexpr double CATCH_UP_SPEED = 0.02;
+// How many device periods the capture thread waits for the device to signal
+// before checking for audio anyway.
+constexpr int WATCHDOG_PERIODS = 4;
+// How many of those waits can pass without the capture thread waking before
+// the audio thread decides it is stalled and captures for it.
+constexpr int STALE_WAITS = 3;
+// How far behind the shared epoch a stream can fall, in seconds, before it
+// skips ahead. This is on top of two host blocks, which is normal jitter.
+constexpr double LATENCY_CEILING_SECS = 0.05;
+// How long to crossfade when skipping ahead, in seconds.
+constexpr double SKIP_FADE_SECS = 0.005;
+
+// All capture streams in this process share an epoch which maps the time at
+// which audio was captured to the time at which it is delivered to the host.
+// It is established by the first stream to deliver audio and lasts until all
+// streams have stopped. This keeps multiple instances phase coherent, even
+// though they are started at different times.
+constexpr int64_t NO_EPOCH = INT64_MIN;
+static std::atomic<int64_t> epochOffset = NO_EPOCH;
+static std::atomic<int> startedStreams = 0;
+
+// Get the current QPC time in 100 ns units, as returned by
+// IAudioCaptureClient::GetBuffer.
+static int64_t qpcNow() {
+	static const LONGLONG frequency = [] {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		return frequency.QuadPart;
+	}();
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	// Split the conversion to avoid overflow.
+	return counter.QuadPart / frequency * REFTIMES_PER_SEC +
+		counter.QuadPart % frequency * REFTIMES_PER_SEC / frequency;
+}
+
+bool CaptureStream::start(CComPtr<IAudioClient> client, double sampleRate,
+	size_t bufferFrames, bool threaded, SpillMode spill
+) {
+	AutoHandle event;
+	if (threaded) {
+		event = CreateEvent(nullptr, false, false, nullptr);
+		HRESULT hr = client->SetEventHandle(event);
+		if (FAILED(hr)) {
+			return false;
+		}
+		REFERENCE_TIME period;
+		if (FAILED(client->GetDevicePeriod(&period, nullptr))) {
+			// This is the usual period for shared mode.
+			period = REFTIMES_PER_SEC / 100;
+		}
+		const REFERENCE_TIME timeout = period * WATCHDOG_PERIODS;
+		this->_watchdogTimeout = std::max<DWORD>(
+			(DWORD)(timeout * 1000 / REFTIMES_PER_SEC), 1);
+		this->_staleAfter = timeout * STALE_WAITS;
+	}
+	HRESULT hr = client->GetService(__uuidof(IAudioCaptureClient), (void**)&this->_capture);
+	if (FAILED(hr)) {
+		return false;
+	}
+	// Only reallocate if we need more space, so that we aren't allocating and
+	// faulting in new pages every time we start. The pages are faulted in now so
+	// that the capture thread doesn't take a fault the first time it fills the
+	// buffer.
+	if (bufferFrames > this->_buffer.capacity()) {
+		this->_buffer.allocate(bufferFrames, true);
+	} else {
+		this->_buffer.clear();
+	}
+	this->_bufferFrames = bufferFrames;
+	this->_spill.allocate(spill == SpillMode::Off ? 0 :
+		(size_t)(SPILL_SECS * sampleRate));
+	this->_spillMode = spill;
+	this->_sampleRate = sampleRate;
+	this->_latencyCeiling = (size_t)(LATENCY_CEILING_SECS * sampleRate);
+	this->_catchUpFrames = spill == SpillMode::CatchUp ? bufferFrames : 0;
+	this->_skipFrames = (size_t)(SKIP_FADE_SECS * sampleRate);
+	this->_arena.reserve(DspArena::footprint(this->_catchUpFrames) * 2 +
+		DspArena::footprint(this->_skipFrames) * 2);
+	this->_catchUpLeft = this->_arena.allocate(this->_catchUpFrames);
+	this->_catchUpRight = this->_arena.allocate(this->_catchUpFrames);
+	this->_skipLeft = this->_arena.allocate(this->_skipFrames);
+	this->_skipRight = this->_arena.allocate(this->_skipFrames);
+	this->_glitches = 0;
+	this->_missedFrames = 0;
+	this->_discardedFrames = 0;
+	this->_watchdogCount = 0;
+	this->_lost = false;
+	this->_threadPriority = ThreadPriority::Normal;
+	this->_wakeLatency.reset();
+	this->_deliver.stage<1>().bind(this->_fadeIn);
+	this->_fade.stage<1>().bind(this->_fadeIn);
+	this->_resetCapture();
+	++startedStreams;
+	this->_client = client;
+	if (event) {
+		this->_captureEvent = std::move(event);
+		this->_startCaptureThread();
+	}
+	this->_client->Start();
+	return true;
+}
+
+void CaptureStream::_resetCapture() {
+	this->_nextPosition = NO_POSITION;
+	this->_endTime = 0;
+	this->_overflowed = false;
+	this->_aligned = false;
+	this->_alignSilence = 0;
+	this->_catchingUp = false;
+	// This might be a stream we're recovering or resuming, in which case the
+	// audio jumps, so fade in rather than clicking.
+	this->_fadeIn.start((uint32_t)(this->_sampleRate * FADE_IN_SECS));
+}
+
+void CaptureStream::_startCaptureThread() {
+	this->_exitThread = false;
+	// The thread hasn't woken yet, but it isn't stalled either.
+	this->_heartbeat = qpcNow();
+	this->_tookOver = false;
+	this->_captureThread = std::thread([this] {
+		this->_captureThreadFunc();
+	});
+}
+
+void CaptureStream::_stopCaptureThread() {
+	if (!this->_captureThread.joinable()) {
+		return;
+	}
+	this->_exitThread = true;
+	SetEvent(this->_captureEvent);
+	this->_captureThread.join();
+}
+
+void CaptureStream::stop() {
+	if (!this->_client) {
+		this->_capture = nullptr;
+		return;
+	}
+	this->_client->Stop();
+	this->_stopCaptureThread();
+	this->_client = nullptr;
+	this->_captureEvent = nullptr;
+	this->_capture = nullptr;
+	// Discard audio we captured but never pushed, so we don't push it when we
+	// start capturing again.
+	this->_buffer.clear();
+	this->_spill.clear();
+	if (--startedStreams == 0) {
+		// Nothing is capturing anymore, so the next stream to start can establish a
+		// new epoch.
+		epochOffset = NO_EPOCH;
+	}
+}
+
+void CaptureStream::pause() {
+	if (!this->_client) {
+		return;
+	}
+	this->_client->Stop();
+	// The capture thread won't be woken while the device is stopped, but it
+	// might still be capturing the last packet, so wait for it. Stopping the
+	// thread also lets us touch the buffer safely when we resume.
+	this->_stopCaptureThread();
+	// We don't count as stopped for the purposes of the epoch. Keeping the epoch
+	// means we resume with the same alignment as before.
+}
+
+void CaptureStream::resume() {
+	if (!this->_client) {
+		return;
+	}
+	// Throw away anything the device captured before it stopped, as well as
+	// anything we hadn't delivered yet. None of it belongs after the transport
+	// starts.
+	this->_client->Reset();
+	this->_buffer.clear();
+	this->_spill.clear();
+	this->_resetCapture();
+	if (this->_captureEvent) {
+		this->_startCaptureThread();
+	}
+	this->_checkLost(this->_client->Start());
+}
+
+bool CaptureStream::read(float* left, float* right, uint32_t frames,
+	LevelSums* levels
+) {
+	if (!this->_captureEvent) {
+		// We aren't using a background thread to capture audio, so capture here.
+		// There might be multiple packets ready to capture.
+		while (this->_available() < frames && this->_doCapture()) {}
+	} else if (this->_available() < frames &&
+			!this->_takeOverIfStalled(frames)) {
+		// If the device was lost, the capture thread might not find out until its
+		// wait times out, so check here. This doesn't touch the buffer, so it is
+		// safe to do while the capture thread runs.
+		UINT32 numFrames;
+		this->_checkLost(this->_capture->GetNextPacketSize(&numFrames));
+	}
+	dbg(
+		"read: frames " << frames <<
+		" buffer size " << this->_buffer.size() <<
+		" spilled " << this->_spill.size()
+	);
+	this->_recoverFromOverflow();
+	if (!this->_aligned && !this->_align(frames)) {
+		return false;
+	}
+	const uint32_t silentFrames = (uint32_t)std::min<uint64_t>(
+		this->_alignSilence, frames);
+	const uint32_t outFrames = frames - silentFrames;
+	const size_t available = this->_available();
+	if (available < outFrames) {
+		return false;
+	}
+	this->_alignSilence -= silentFrames;
+	std::fill_n(left, silentFrames, 0.0f);
+	std::fill_n(right, silentFrames, 0.0f);
+	uint32_t inFrames = outFrames;
+	if (this->_spillMode == SpillMode::CatchUp) {
+		if (this->_spill.size() > 0) {
+			this->_catchingUp = true;
+		} else if (available <= (size_t)frames * 2) {
+			// We're back to normal.
+			this->_catchingUp = false;
+		}
+		if (this->_catchingUp && outFrames > 1) {
+			const uint32_t extra = std::max<uint32_t>(
+				(uint32_t)(outFrames * CATCH_UP_SPEED), 1);
+			if (outFrames + extra <= this->_catchUpFrames &&
+					outFrames + extra <= available) {
+				inFrames += extra;
+			}
+		}
+	}
+	if (inFrames == outFrames && this->_spill.size() == 0) {
+		// If the user hasn't asked us to keep audio the host didn't take, don't
+		// let it hold us back either.
+		uint32_t skipFade = 0;
+		if (this->_spillMode == SpillMode::Off && silentFrames == 0) {
+			skipFade = this->_skipExcessLatency(outFrames);
+		}
+		// Everything is in the buffer, so deinterleave it and fade it in a single
+		// pass. Only we remove spilled audio, so if there's none now, the buffer
+		// already had enough when we checked above. The audio might wrap around
+		// the end of the buffer, in which case this takes two passes.
+		this->_deliver.stage<2>().bind(levels);
+		for (uint32_t done = 0; done < outFrames;) {
+			size_t count = outFrames - done;
+			this->_deliver.stage<0>().bind(this->_buffer.peek(count));
+			this->_deliver.stage<3>().bind(left + silentFrames + done,
+				right + silentFrames + done);
+			this->_deliver.process((uint32_t)count);
+			this->_buffer.discard(count);
+			done += (uint32_t)count;
+		}
+		if (skipFade > 0) {
+			// The few frames this touches were measured before the crossfade, which
+			// is close enough for a meter.
+			this->_crossfadeSkip(left, right, skipFade);
+		}
+		return true;
+	}
+	if (inFrames == outFrames) {
+		this->_take(left + silentFrames, right + silentFrames, outFrames);
+	} else {
+		// Squeeze inFrames into outFrames by linear interpolation. The first and
+		// last frames line up exactly, so consecutive blocks join up smoothly.
+		float* inLeft = this->_catchUpLeft;
+		float* inRight = this->_catchUpRight;
+		this->_take(inLeft, inRight, inFrames);
+		const double step = (double)(inFrames - 1) / (outFrames - 1);
+		for (uint32_t f = 0; f < outFrames; ++f) {
+			const double pos = f * step;
+			const uint32_t i = std::min((uint32_t)pos, inFrames - 2);
+			const float frac = (float)(pos - i);
+			left[silentFrames + f] = inLeft[i] + (inLeft[i + 1] - inLeft[i]) * frac;
+			right[silentFrames + f] = inRight[i] +
+				(inRight[i + 1] - inRight[i]) * frac;
+		}
+	}
+	this->_fade.stage<0>().bind(left + silentFrames, right + silentFrames);
+	this->_fade.stage<2>().bind(levels);
+	this->_fade.stage<3>().bind(left + silentFrames, right + silentFrames);
+	this->_fade.process(outFrames);
+	return true;
+}
+
+bool CaptureStream::hasAudio(uint32_t frames) {
+	if (!this->_captureEvent) {
+		while (this->_available() < frames && this->_doCapture()) {}
+	} else if (this->_available() < frames) {
+		this->_takeOverIfStalled(frames);
+	}
+	return this->_available() >= frames;
+}
+
+bool CaptureStream::_takeOverIfStalled(uint32_t frames) {
+	const int64_t sinceHeartbeat = qpcNow() -
+		this->_heartbeat.load(std::memory_order_relaxed);
+	if (sinceHeartbeat < this->_staleAfter) {
+		this->_tookOver = false;
+		return false;
+	}
+	if (this->_producing.exchange(true, std::memory_order_acquire)) {
+		// The capture thread is capturing right now, so it isn't stalled after
+		// all.
+		return false;
+	}
+	if (!this->_tookOver) {
+		dbg("_takeOverIfStalled: capture thread stalled for " << sinceHeartbeat);
+		this->_tookOver = true;
+		++this->_watchdogCount;
+	}
+	while (this->_available() < frames && this->_doCapture()) {}
+	this->_producing.store(false, std::memory_order_release);
+	return true;
+}
+
+int64_t CaptureStream::frontTime() const {
+	const int64_t end = this->_endTime;
+	if (end == 0) {
+		return 0;
+	}
+	return end - this->_framesToTime(this->_available());
+}
+
+void CaptureStream::_take(float* left, float* right, uint32_t frames) {
+	uint32_t f = 0;
+	while (f < frames) {
+		// Older audio is in the buffer, so drain that first.
+		f += (uint32_t)this->_buffer.pop(left + f, right + f, frames - f);
+		f += (uint32_t)this->_spill.pop(left + f, right + f, frames - f);
+	}
+}
+
+uint32_t CaptureStream::_skipExcessLatency(uint32_t frames) {
+	const int64_t offset = epochOffset.load(std::memory_order_relaxed);
+	const int64_t front = this->frontTime();
+	if (offset == NO_EPOCH || front == 0) {
+		return 0;
+	}
+	// This is how _align() works out where we should be. After a stall, we fall
+	// behind by however much the buffer filled up while the host wasn't asking.
+	const int64_t behind = (int64_t)((qpcNow() - offset - front) *
+		this->_sampleRate / REFTIMES_PER_SEC);
+	const size_t available = this->_buffer.size();
+	if (behind <= (int64_t)(this->_latencyCeiling + (size_t)frames * 2) ||
+			available <= frames) {
+		return 0;
+	}
+	// Skip all the way back to the epoch, but keep enough for this block.
+	const size_t skip = std::min<size_t>(behind, available - frames);
+	// Keep the start of what we're skipping to fade it out.
+	const uint32_t fade = (uint32_t)std::min<size_t>(
+		{skip, frames, this->_skipFrames});
+	this->_take(this->_skipLeft, this->_skipRight, fade);
+	this->_buffer.discard(skip - fade);
+	dbg("_skipExcessLatency: behind " << behind << " skipped " << skip);
+	this->_discardedFrames += skip;
+	return fade;
+}
+
+void CaptureStream::_crossfadeSkip(float* left, float* right,
+	uint32_t fade
+) {
+	const float* oldLeft = this->_skipLeft;
+	const float* oldRight = this->_skipRight;
+	// The audio either side of the skip is unrelated, so use an equal power
+	// crossfade to avoid a dip in level.
+	for (uint32_t f = 0; f < fade; ++f) {
+		const float position = (float)(f + 1) / (fade + 1);
+		const float oldGain = std::sqrt(1.0f - position);
+		const float newGain = std::sqrt(position);
+		left[f] = left[f] * newGain + oldLeft[f] * oldGain;
+		right[f] = right[f] * newGain + oldRight[f] * oldGain;
+	}
+}
+
+int64_t CaptureStream::_framesToTime(uint64_t frames) const {
+	return (int64_t)(frames * REFTIMES_PER_SEC / this->_sampleRate);
+}
+
+bool CaptureStream::_align(uint32_t frames) {
+	if (this->_buffer.size() < frames) {
+		// We aren't primed yet.
+		return false;
+	}
+	const int64_t front = this->frontTime();
+	if (front == 0) {
+		return false;
+	}
+	const int64_t now = qpcNow();
+	int64_t offset = NO_EPOCH;
+	if (epochOffset.compare_exchange_strong(offset, now - front)) {
+		// We're the first stream to deliver audio, so we've just established the
+		// epoch and are already aligned with it.
+		dbg("_align: established epoch offset " << now - front);
+		this->_aligned = true;
+		return true;
+	}
+	// The audio we deliver now should have been captured at target.
+	const int64_t target = now - offset;
+	const int64_t skip = (int64_t)((target - front) * this->_sampleRate /
+		REFTIMES_PER_SEC);
+	dbg("_align: epoch offset " << offset << " skip " << skip);
+	if (skip > 0) {
+		// Our audio is older than the other streams'. Drop the difference. If we
+		// lag the epoch by more than we have buffered, we can only get as close as
+		// possible.
+		this->_buffer.discard(std::min<size_t>(skip,
+			this->_buffer.size() - frames));
+	} else {
+		// Our audio is newer than the other streams'. Delay it with silence, but
+		// never by more than a second, which would indicate a bogus timestamp.
+		this->_alignSilence = std::min<uint64_t>(-skip, (uint64_t)this->_sampleRate);
+	}
+	this->_aligned = true;
+	return true;
+}
+
+void CaptureStream::_recoverFromOverflow() {
+	if (!this->_overflowed.exchange(false, std::memory_order_acquire)) {
+		return;
+	}
+	// Everything in the buffer now is from before the gap or just after it.
+	// Dropping a little audio from after the gap is harmless, since we're
+	// dropping anyway.
+	const size_t dropped = this->_buffer.discard(this->_buffer.size());
+	dbg("_recoverFromOverflow: dropped " << dropped);
+	this->_discardedFrames += dropped;
+	// The audio we get next is newer than the epoch expects, so realign and fade
+	// in rather than jumping.
+	this->_aligned = false;
+	this->_alignSilence = 0;
+	this->_fadeIn.start((uint32_t)(this->_sampleRate * FADE_IN_SECS));
+}
+
+void CaptureStream::_checkLost(HRESULT hr) {
+	if (isStreamLost(hr)) {
+		dbg("_checkLost: stream lost " << hr);
+		this->_lost = true;
+	}
+}
+
+void CaptureStream::_push(const BYTE* data, UINT64 numFrames) {
+	if (this->_spill.capacity() == 0) {
+		// The audio thread owns the front of the buffer, so if it is full, we can
+		// only drop the newest audio. Tell the audio thread so it can drop the
+		// older audio too rather than delivering across the gap.
+		const size_t pushed = this->_buffer.push((const float*)data, numFrames);
+		if (pushed < numFrames) {
+			this->_discardedFrames += numFrames - pushed;
+			this->_overflowed.store(true, std::memory_order_release);
+		}
+		return;
+	}
+	// Once we start spilling, we keep spilling until the host has taken all of
+	// the spilled audio. Otherwise, newer audio would be delivered before it.
+	// Only we add to the spill ring, so if it is empty now, it stays that way
+	// until we spill. The buffer can only have more space than we see here.
+	const size_t used = this->_buffer.size();
+	const UINT64 toBuffer = this->_spill.size() > 0 ||
+		used >= this->_bufferFrames ? 0 :
+		std::min<UINT64>(numFrames, this->_bufferFrames - used);
+	this->_buffer.push((const float*)data, toBuffer);
+	if (toBuffer < numFrames) {
+		// If the spill ring is full too, the newest audio is lost.
+		const size_t pushed = this->_spill.push(
+			data ? (const float*)(data + toBuffer * BYTES_PER_FRAME) : nullptr,
+			numFrames - toBuffer);
+		this->_discardedFrames += numFrames - toBuffer - pushed;
+	}
+}
+
+void CaptureStream::_pushSilence(UINT64 numFrames) {
+	// Anything beyond what we can hold would just overwrite the silence we
+	// already pushed.
+	numFrames = std::min<UINT64>(numFrames,
+		this->_bufferFrames + this->_spill.capacity());
+	this->_push(nullptr, numFrames);
+}
+
+bool CaptureStream::_doCapture(int64_t wokeAt) {
+	UINT32 numFrames; // The number of captured frames.
+	// GetNextPacketSize and GetBuffer should return the same number of frames.
+	// The documentation doesn't say that GetNextPacketSize is required.
+	// However, if you don't call it first and there is no packet to retrieve,
+	// GetBuffer succeeds even though it returns a packet with bogus data.
+	HRESULT hr = this->_capture->GetNextPacketSize(&numFrames);
+	if (FAILED(hr)) {
+		this->_checkLost(hr);
+		return false;
+	}
+	if (numFrames == 0) {
+		return false;
+	}
+	DWORD flags;
+	BYTE* data;
+	UINT64 position;
+	UINT64 time;
+	hr = this->_capture->GetBuffer(&data, &numFrames, &flags, &position, &time);
+	if (FAILED(hr)) {
+		this->_checkLost(hr);
+		return false;
+	}
+	if (numFrames == 0) {
+		return false;
+	}
+	dbg("_doCapture: captured " << numFrames << " frames at " << position);
+	// If there was a timestamp error, the position and time can't be trusted.
+	const bool positionValid = !(flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR);
+	UINT64 missed = 0;
+	if (this->_nextPosition != NO_POSITION) {
+		// The device position is in frames, so any difference between where this
+		// packet starts and where the last packet ended is audio which the device
+		// dropped. If the position isn't valid, we can only count the glitch.
+		if (positionValid && position > this->_nextPosition) {
+			missed = position - this->_nextPosition;
+			++this->_glitches;
+			this->_missedFrames += missed;
+			dbg("_doCapture: missed " << missed << " frames");
+			// Fill the gap so everything after it stays in sync.
+			this->_pushSilence(missed);
+		} else if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+			++this->_glitches;
+		}
+	}
+	this->_nextPosition = position + numFrames;
+	// If the data is silent, it should be treated as silence regardless of what
+	// it contains.
+	this->_push(flags & AUDCLNT_BUFFERFLAGS_SILENT ? nullptr : data, numFrames);
+	this->_capture->ReleaseBuffer(numFrames);
+	if (positionValid) {
+		this->_endTime = time + this->_framesToTime(numFrames);
+		if (wokeAt) {
+			this->_wakeLatency.record(wokeAt - this->_endTime);
+		}
+	} else if (this->_endTime != 0) {
+		// Estimate based on the previous packet.
+		this->_endTime += this->_framesToTime(missed + numFrames);
+	}
+	return true;
+}
+
+void CaptureStream::_captureThreadFunc() {
+	RealtimeThreadScope realtime(CAPTURE_CORE);
+	this->_threadPriority = realtime.priority();
+	dbg("thread: priority " << (int)realtime.priority());
+	for (; ;) {
+		const DWORD result = WaitForSingleObject(this->_captureEvent,
+			this->_watchdogTimeout);
+		const int64_t wokeAt = qpcNow();
+		this->_heartbeat.store(wokeAt, std::memory_order_relaxed);
+		if (this->_exitThread) {
+			return;
+		}
+		if (this->_producing.exchange(true, std::memory_order_acquire)) {
+			// The audio thread thought we were stalled and is capturing for us.
+			continue;
+		}
+		{
+			RtScope rtScope;
+			if (result == WAIT_TIMEOUT) {
+				// Loopback streams don't signal while nothing is playing, so this is
+				// usually harmless. If there is audio waiting, though, we missed a
+				// signal, so drain it. If the device was lost, this finds out.
+				if (this->_doCapture()) {
+					dbg("thread: watchdog found audio");
+					++this->_watchdogCount;
+					while (this->_doCapture()) {}
+				}
+			} else {
+				this->_doCapture(wokeAt);
+			}
+		}
+		this->_producing.store(false, std::memory_order_release);
+		dbg("thread: size after capture " << this->_buffer.size());
+	}
+}
+
+CaptureSwitcher::~CaptureSwitcher() {
+	LatencyMeasurement::get().forgetRecorder(this);
+}
+
+void CaptureSwitcher::setMeasuresLatency(bool measures) {
+	if (measures) {
+		LatencyMeasurement::get().chooseRecorder(this);
+	} else {
+		LatencyMeasurement::get().forgetRecorder(this);
+	}
+}
+
+bool CaptureSwitcher::measuresLatency() const {
+	return LatencyMeasurement::get().chosenRecorder() == this;
+}
+
+void CaptureSwitcher::activate(double sampleRate, uint32_t maxFrameCount) {
+	this->_sampleRate = sampleRate;
+	if (this->_recorder.isRecording() &&
+			this->_recorder.sampleRate() != (uint32_t)sampleRate) {
+		// A WAV file can't change sample rate part way through.
+		this->_recording = false;
+		this->_recorder.stop();
+	}
+	this->_arena.reserve(DspArena::footprint(maxFrameCount) * 2);
+	this->_nextLeft = this->_arena.allocate(maxFrameCount);
+	this->_nextRight = this->_arena.allocate(maxFrameCount);
+	this->_nextFrames = maxFrameCount;
+	this->_fadeFrames = std::max<uint32_t>(
+		(uint32_t)(sampleRate * CROSSFADE_SECS), 1);
+}
+
+void CaptureSwitcher::switchTo(const clap_host* host,
+	std::function<bool(CaptureStream&)> open
+) {
+	if (this->_state != State::Idle) {
+		// Only the most recent request matters.
+		this->_pending = std::move(open);
+		return;
+	}
+	this->_host = host;
+	this->_fadePosition = 0;
+	this->_state = State::Switching;
+	CaptureStream* spare = &this->_spare();
+	this->_opener.start(host, [spare, open = std::move(open)] {
+		return open(*spare);
+	});
+}
+
+bool CaptureSwitcher::read(const clap_process* process) {
+	this->_applyCommands();
+	const uint32_t frames = process->frames_count;
+	float* left = process->audio_outputs[0].data32[0];
+	float* right = process->audio_outputs[0].data32[1];
+	// If there's no output, this reports silence rather than whatever was left in
+	// the host's buffers.
+	this->_levels = {};
+	const bool haveOld = this->active().read(left, right, frames,
+		&this->_levels);
+	if (!haveOld) {
+		++this->_underruns;
+	}
+	bool haveOutput = haveOld;
+	if (this->_state.load(std::memory_order_acquire) == State::Switching &&
+			this->_opener.isReady()) {
+		haveOutput = this->_crossfade(left, right, frames, haveOld);
+	}
+	if (haveOutput && this->_transportStartFrame > 0) {
+		// The transport was idle until part way through this block. The stream
+		// was still running, so the audio is in time with the host, but what came
+		// before the transport started mustn't be heard. This only happens for
+		// one block, so measuring again is cheap enough.
+		std::fill_n(left, this->_transportStartFrame, 0.0f);
+		std::fill_n(right, this->_transportStartFrame, 0.0f);
+		this->_levels = {};
+		measureSamples(left, frames, this->_levels.peak[0],
+			this->_levels.sumSquares[0]);
+		measureSamples(right, frames, this->_levels.peak[1],
+			this->_levels.sumSquares[1]);
+	}
+	this->_transportStartFrame = 0;
+	// If we have no output, the host's buffers hold whatever was left in them.
+	LatencyMeasurement::get().record(this, haveOutput ? left : nullptr,
+		haveOutput ? right : nullptr, frames);
+	if (haveOutput) {
+		this->_history.write(left, right, frames);
+	} else {
+		// Keep the history in time with the host.
+		this->_history.writeSilence(frames);
+	}
+	if (this->_recording) {
+		this->_recorder.write(haveOutput ? left : nullptr,
+			haveOutput ? right : nullptr, frames);
+	}
+	this->_publishStatus();
+	return haveOld;
+}
+
+bool CaptureSwitcher::checkTransport(const clap_host* host,
+	const clap_process* process, const TransportIdle& transport
+) {
+	// A recording the user starts while we're stopped needs the stream.
+	this->_applyCommands();
+	const bool idle = transport.isIdle(process) && !this->_recording &&
+		this->_history.capacity() == 0 &&
+		this->_state.load(std::memory_order_acquire) == State::Idle &&
+		!LatencyMeasurement::get().isActive();
+	this->_transportStartFrame = 0;
+	TransportState state = this->_transportState.load(std::memory_order_acquire);
+	if (state == TransportState::Running) {
+		if (!idle) {
+			return true;
+		}
+		this->_transportState.store(TransportState::Stopping,
+			std::memory_order_release);
+		host->request_callback(host);
+		return false;
+	}
+	if (idle) {
+		return false;
+	}
+	if (state == TransportState::Stopping) {
+		// The main thread hasn't stopped the stream yet, so we can keep using it.
+		if (!this->_transportState.compare_exchange_strong(state,
+				TransportState::Running, std::memory_order_acq_rel)) {
+			return false;
+		}
+		// If the transport started part way through this block, deliver from the
+		// frame at which it started. If something else needs the stream while the
+		// transport is still idle, deliver the whole block.
+		if (transport.isEnabled()) {
+			const uint32_t start = TransportIdle::firstActiveFrame(process);
+			if (start < process->frames_count) {
+				this->_transportStartFrame = start;
+			}
+		}
+		return true;
+	}
+	if (state == TransportState::Stopped) {
+		this->_transportState.store(TransportState::Starting,
+			std::memory_order_release);
+		host->request_callback(host);
+	}
+	return false;
+}
+
+void CaptureSwitcher::applyTransport() {
+	TransportState state = TransportState::Stopping;
+	if (this->_transportState.compare_exchange_strong(state,
+			TransportState::Stopped, std::memory_order_acq_rel)) {
+		// The audio thread won't touch the stream until we restart it.
+		this->active().pause();
+	} else if (state == TransportState::Starting) {
+		this->active().resume();
+		this->_transportState.store(TransportState::Running,
+			std::memory_order_release);
+	}
+}
+
+void CaptureSwitcher::_applyCommands() {
+	CaptureCommand command;
+	while (this->_commands.pop(command)) {
+		if (command == CaptureCommand::ResetCounters) {
+			CaptureStream& stream = this->active();
+			this->_underruns = 0;
+			this->_glitchBase = stream.glitchCount();
+			this->_missedFrameBase = stream.missedFrameCount();
+			this->_watchdogBase = stream.watchdogCount();
+			this->_discardedFrameBase = stream.discardedFrameCount();
+			stream.wakeLatency().reset();
+		} else if (command == CaptureCommand::StartRecording) {
+			this->_recording = true;
+		} else if (command == CaptureCommand::StopRecording &&
+				this->_recording) {
+			this->_recording = false;
+			this->_recorder.finish();
+		}
+	}
+}
+
+bool CaptureSwitcher::startRecording(const std::filesystem::path& path) {
+	if (this->_sampleRate == 0 || this->_recorder.isRecording()) {
+		return false;
+	}
+	if (!this->_recorder.start(path, (uint32_t)this->_sampleRate,
+			WavSampleFormat::Float32)) {
+		return false;
+	}
+	if (!this->post(CaptureCommand::StartRecording)) {
+		this->_recorder.stop();
+		return false;
+	}
+	return true;
+}
+
+void CaptureSwitcher::_publishStatus() {
+	CaptureStream& stream = this->active();
+	const uint64_t glitches = stream.glitchCount();
+	const uint64_t missedFrames = stream.missedFrameCount();
+	const uint64_t watchdog = stream.watchdogCount();
+	const uint64_t discardedFrames = stream.discardedFrameCount();
+	if (glitches < this->_glitchBase || missedFrames < this->_missedFrameBase ||
+			watchdog < this->_watchdogBase ||
+			discardedFrames < this->_discardedFrameBase) {
+		// The stream was restarted, which resets its counters.
+		this->_glitchBase = this->_missedFrameBase = this->_watchdogBase =
+			this->_discardedFrameBase = 0;
+	}
+	this->_status.publish({
+		.underruns = this->_underruns,
+		.glitches = glitches - this->_glitchBase,
+		.missedFrames = missedFrames - this->_missedFrameBase,
+		.watchdog = watchdog - this->_watchdogBase,
+		.discardedFrames = discardedFrames - this->_discardedFrameBase,
+	});
+}
+
+bool CaptureSwitcher::_crossfade(float* left, float* right, uint32_t frames,
+	bool haveOld
+) {
+	CaptureStream& next = this->_spare();
+	if (next.isLost()) {
+		this->_state.store(State::Failed, std::memory_order_release);
+		this->_host->request_callback(this->_host);
+		return haveOld;
+	}
+	float* nextLeft = this->_nextLeft;
+	float* nextRight = this->_nextRight;
+	frames = std::min(frames, this->_nextFrames);
+	if (!next.read(nextLeft, nextRight, frames)) {
+		if (this->_fadePosition == 0) {
+			// The new stream hasn't primed yet, so keep playing the old one.
+			return haveOld;
+		}
+		std::fill_n(nextLeft, frames, 0.0f);
+		std::fill_n(nextRight, frames, 0.0f);
+	}
+	if (!haveOld) {
+		std::fill_n(left, frames, 0.0f);
+		std::fill_n(right, frames, 0.0f);
+	}
+	// The sources are unrelated, so use an equal power crossfade to avoid a dip
+	// in level. What the old stream measured no longer matches the output, so
+	// measure the mix instead.
+	for (uint32_t f = 0; f < frames; ++f) {
+		const float position = std::min(
+			(float)this->_fadePosition / this->_fadeFrames, 1.0f);
+		const float oldGain = std::sqrt(1.0f - position);
+		const float newGain = std::sqrt(position);
+		left[f] = left[f] * oldGain + nextLeft[f] * newGain;
+		right[f] = right[f] * oldGain + nextRight[f] * newGain;
+		if (this->_fadePosition < this->_fadeFrames) {
+			++this->_fadePosition;
+		}
+	}
+	// A crossfade only lasts a few blocks, so measuring in a separate pass is
+	// cheap enough.
+	this->_levels = {};
+	measureSamples(left, frames, this->_levels.peak[0],
+		this->_levels.sumSquares[0]);
+	measureSamples(right, frames, this->_levels.peak[1],
+		this->_levels.sumSquares[1]);
+	if (this->_fadePosition == this->_fadeFrames) {
+		this->_active.store(1 - this->_active, std::memory_order_release);
+		// The new stream counts from 0.
+		this->_glitchBase = this->_missedFrameBase = this->_watchdogBase =
+			this->_discardedFrameBase = 0;
+		this->_state.store(State::Retiring, std::memory_order_release);
+		this->_host->request_callback(this->_host);
+	}
+	return true;
+}
+
+bool CaptureSwitcher::checkFailed() {
+	State state = this->_state.load(std::memory_order_acquire);
+	bool failed = false;
+	if (state == State::Retiring) {
+		// The audio thread has moved on to the new stream, so the old one is now
+		// the spare.
+		this->_opener.stop();
+		this->_spare().stop();
+	} else if (state == State::Failed ||
+			(state == State::Switching && this->_opener.checkFailed())) {
+		// The audio thread won't touch the new stream now.
+		this->_opener.stop();
+		this->_spare().stop();
+		this->_pending = nullptr;
+		failed = true;
+	} else {
+		return false;
+	}
+	this->_state = State::Idle;
+	if (this->_pending) {
+		auto pending = std::move(this->_pending);
+		this->_pending = nullptr;
+		this->switchTo(this->_host, std::move(pending));
+	}
+	return failed;
+}
+
+void CaptureSwitcher::stop() {
+	// The audio thread isn't running, so apply any commands it didn't get to.
+	// Otherwise, a recording the user stopped would carry on.
+	this->_applyCommands();
+	this->_opener.stop();
+	this->_state = State::Idle;
+	this->_pending = nullptr;
+	this->_streams[0].stop();
+	this->_streams[1].stop();
+	// The next stream we open starts running.
+	this->_transportState = TransportState::Running;
+}
+
+void showCaptureStatus(HWND dialog, bool capturing, const StreamOpener& opener,
+	CaptureSwitcher& switcher, const OfflineRender& offline,
+	uint64_t recoveries
+) {
+	std::wostringstream s;
+	if (!capturing) {
+		s << L"Not capturing.";
+	} else if (!opener.isReady()) {
+		s << L"Starting capture.";
+	} else if (switcher.isStoppedForTransport()) {
+		s << L"Stopped while the transport is stopped.";
+	} else {
+		const CaptureStatus& status = switcher.status();
+		s << L"Underruns: " << status.underruns <<
+			L", glitches: " << status.glitches <<
+			L", missed frames: " << status.missedFrames <<
+			L", discarded frames: " << status.discardedFrames;
+		CaptureStream& stream = switcher.active();
+		if (stream.isThreaded()) {
+			const WakeLatency& wake = stream.wakeLatency();
+			// The latency is in 100 ns units.
+			s << L"\r\nCapture thread: " <<
+				describeThreadPriority(stream.threadPriority()) <<
+				L" priority, latency " << std::fixed << std::setprecision(1) <<
+				wake.mean() / 10000.0 << L" ms average, " <<
+				wake.max() / 10000.0 << L" ms max, watchdog: " << status.watchdog;
+		}
+	}
+	if (recoveries > 0) {
+		s << L"\r\nReopened after the stream was lost: " << recoveries <<
+			L" times.";
+	}
+	if (offline.failures() > 0) {
+		s << L"\r\nOffline render: " << offline.failures() <<
+			L" blocks were silent.";
+	}
+	const DiskRecorder& recorder = switcher.recorder();
+	if (recorder.failed()) {
+		s << L"\r\nRecording failed. The disk might be full.";
+	} else if (recorder.isRecording()) {
+		s << L"\r\nRecorded " <<
+			recorder.framesWritten() / recorder.sampleRate() <<
+			L" s, dropped frames: " << recorder.droppedFrames();
+	} else {
+		// The recording might have been stopped by a sample rate change.
+		CheckDlgButton(dialog, ID_RECORD, BST_UNCHECKED);
+	}
+	SetDlgItemText(dialog, ID_STATUS, s.str().c_str());
+}
+
+void showSpillMode(HWND dialog, SpillMode mode) {
+	HWND combo = GetDlgItem(dialog, ID_SPILL);
+	ComboBox_ResetContent(combo);
+	// These must be in the same order as SpillMode.
+	ComboBox_AddString(combo, L"Drop audio");
+	ComboBox_AddString(combo, L"Keep audio");
+	ComboBox_AddString(combo, L"Keep audio and catch up");
+	ComboBox_SetCurSel(combo, (int)mode);
+}
+
+SpillMode readSpillMode(HWND dialog) {
+	const int choice = ComboBox_GetCurSel(GetDlgItem(dialog, ID_SPILL));
+	if (choice == CB_ERR) {
+		return SpillMode::Off;
+	}
+	return (SpillMode)choice;
+}
+
+void showHistorySettings(HWND dialog, const HistorySettings& settings) {
+	SetDlgItemInt(dialog, ID_HISTORY_MINUTES, settings.minutes, false);
+	CheckDlgButton(dialog, ID_HISTORY_16BIT,
+		settings.pack16 ? BST_CHECKED : BST_UNCHECKED);
+}
+
+bool readHistorySettings(HWND dialog, WORD cid, WORD code,
+	HistorySettings& settings
+) {
+	if (cid == ID_HISTORY_MINUTES && code == EN_KILLFOCUS) {
+		const uint32_t minutes = std::min(
+			GetDlgItemInt(dialog, ID_HISTORY_MINUTES, nullptr, false),
+			HistorySettings::MAX_MINUTES);
+		// Show the clamped value.
+		SetDlgItemInt(dialog, ID_HISTORY_MINUTES, minutes, false);
+		if (minutes == settings.minutes) {
+			return false;
+		}
+		settings.minutes = minutes;
+		return true;
+	}
+	if (cid == ID_HISTORY_16BIT) {
+		settings.pack16 = IsDlgButtonChecked(dialog, ID_HISTORY_16BIT);
+		return settings.minutes > 0;
+	}
+	return false;
+}
+
+// Ask the user for a WAV file to write. Returns an empty path if they cancel.
+static std::wstring askForWavFile(HWND dialog) {
+	wchar_t path[MAX_PATH] = L"";
+	OPENFILENAME ofn = {
+		.lStructSize = sizeof(OPENFILENAME),
+		.hwndOwner = dialog,
+		.lpstrFilter = L"WAV files\0*.wav\0",
+		.lpstrFile = path,
+		.nMaxFile = MAX_PATH,
+		.Flags = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST,
+		.lpstrDefExt = L"wav",
+	};
+	if (!GetSaveFileName(&ofn)) {
+		return {};
+	}
+	return path;
+}
+
+void saveHistory(HWND dialog, const HistoryRing& history, double sampleRate) {
+	std::vector<float> audio;
+	const size_t frames = history.read(audio);
+	if (frames == 0) {
+		MessageBox(dialog,
+			L"There is no history to save. Set the history length and capture first.",
+			L"Save history", MB_OK | MB_ICONINFORMATION);
+		return;
+	}
+	const std::wstring path = askForWavFile(dialog);
+	if (path.empty()) {
+		return;
+	}
+	WavWriter writer;
+	// There's no point in writing more precision than we kept.
+	const bool ok = writer.open(path, (uint32_t)sampleRate, NUM_CHANNELS,
+			history.isPacked() ? WavSampleFormat::Int16 : WavSampleFormat::Float32) &&
+		writer.write(audio.data(), frames) && writer.finalize();
+	if (!ok) {
+		MessageBox(dialog, L"The history couldn't be saved.", L"Save history",
+			MB_OK | MB_ICONERROR);
+	}
+}
+
+void toggleRecording(HWND dialog, CaptureSwitcher& switcher) {
+	if (!IsDlgButtonChecked(dialog, ID_RECORD)) {
+		switcher.stopRecording();
+		return;
+	}
+	// Leave the button unpressed unless the recording starts.
+	CheckDlgButton(dialog, ID_RECORD, BST_UNCHECKED);
+	if (switcher.recorder().isRecording()) {
+		// The previous recording is still being written to disk.
+		return;
+	}
+	const std::wstring path = askForWavFile(dialog);
+	if (path.empty()) {
+		return;
+	}
+	if (!switcher.startRecording(path)) {
+		MessageBox(dialog,
+			L"Couldn't start recording. Make sure you are capturing and that the file can be written.",
+			L"Record", MB_OK | MB_ICONERROR);
+		return;
+	}
+	CheckDlgButton(dialog, ID_RECORD, BST_CHECKED);
+}
@@ -0,0 +1,501 @@
+/*
+ * App2Clap
+ * Header for code shared by the capture plug-ins
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2025-2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include "common.h"
+
+#include <atlcomcli.h>
+#include <audioclient.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "diskRecorder.h"
+#include "dspPipeline.h"
+#include "historyRing.h"
+#include "lockfree.h"
+#include "stereoRing.h"
+#include "threadPolicy.h"
+
+// The timer the capture plug-in dialogs use to refresh the capture status.
+constexpr UINT_PTR STATUS_TIMER = 1;
+
+// What a capture stream does with audio which doesn't fit in its buffer because
+// the host stopped asking for audio for a while.
+enum class SpillMode : uint8_t {
+	// Discard it, skipping ahead to current audio once the host asks again.
+	Off,
+	// Keep it and deliver all of it afterwards. Nothing is lost, but the latency
+	// stays higher.
+	Keep,
+	// Keep it and then play slightly faster until the latency is back to normal.
+	CatchUp,
+};
+
+// Captures audio from an initialised IAudioClient and buffers it until the host
+// asks for it. This is shared by App2Clap and In2Clap.
+class CaptureStream {
+	public:
+	// Start capturing from client, which must already be initialised with the
+	// given sample rate. bufferFrames is the number of frames we can hold which
+	// have been captured but not yet sent to the host. If threaded is true, client
+	// must have been initialised with AUDCLNT_STREAMFLAGS_EVENTCALLBACK and audio
+	// will be captured in a background thread. Spilling only helps when threaded,
+	// since otherwise nothing is captured while the host isn't calling us.
+	bool start(CComPtr<IAudioClient> client, double sampleRate,
+		size_t bufferFrames, bool threaded, SpillMode spill = SpillMode::Off);
+	void stop();
+
+	bool isStarted() const {
+		return this->_capture;
+	}
+
+	// Stop the device without closing the stream, so that it can be resumed
+	// quickly. This must be called from the main thread while the audio thread
+	// isn't reading.
+	void pause();
+	// Restart a paused stream, discarding anything captured before the pause.
+	// Audio is realigned to the shared epoch, so it is delivered with the same
+	// offset from the time it was captured as it was before the pause. This must
+	// be called from the main thread while the audio thread isn't reading.
+	void resume();
+
+	// Write frames of captured audio to left and right. Returns false if there
+	// isn't enough captured audio to fill them, in which case nothing is written.
+	// The first audio we deliver is aligned to the epoch shared by all capture
+	// streams in this process, so that audio captured at the same instant by
+	// different instances is delivered to the host at the same time. If levels
+	// isn't null, the level of the audio is measured while it is delivered and
+	// added to levels.
+	bool read(float* left, float* right, uint32_t frames,
+		LevelSums* levels = nullptr);
+
+	// Whether read() could deliver frames now. If we aren't capturing in a
+	// background thread, this captures whatever is waiting. This must be called
+	// from the audio thread.
+	bool hasAudio(uint32_t frames);
+
+	// The QPC time (in 100 ns units) at which the oldest frame we haven't yet sent
+	// to the host was captured, or 0 if nothing has been captured yet. Because we
+	// fill gaps reported by the device, each subsequent frame was captured
+	// 1 / sampleRate seconds after the one before it.
+	int64_t frontTime() const;
+
+	// The number of discontinuities (glitches) reported by the device since the
+	// stream was started.
+	uint64_t glitchCount() const {
+		return this->_glitches;
+	}
+
+	// The number of frames the device dropped since the stream was started. We
+	// replace these with silence so that the audio after a glitch stays in sync.
+	uint64_t missedFrameCount() const {
+		return this->_missedFrames;
+	}
+
+	// Whether the stream stopped working because the device was removed, disabled
+	// or changed format. The stream must be stopped and started again with a new
+	// client.
+	bool isLost() const {
+		return this->_lost;
+	}
+
+	// The number of frames we threw away since the stream was started, either
+	// because the buffer overflowed or because we skipped ahead to keep the
+	// latency down.
+	uint64_t discardedFrameCount() const {
+		return this->_discardedFrames;
+	}
+
+	// The number of times the watchdog had to capture audio because the device
+	// didn't signal the capture thread or the capture thread stalled. See
+	// _captureThreadFunc() and _takeOverIfStalled().
+	uint64_t watchdogCount() const {
+		return this->_watchdogCount;
+	}
+
+	// Whether audio is captured in a background thread rather than by read().
+	bool isThreaded() const {
+		return (bool)this->_captureEvent;
+	}
+
+	// The scheduling the capture thread got. This is only meaningful if
+	// isThreaded() returns true.
+	ThreadPriority threadPriority() const {
+		return this->_threadPriority;
+	}
+
+	// How long the capture thread takes to get audio after the device captures
+	// it. This is measured from when the end of each packet was captured, so it
+	// includes the audio engine's processing as well as the time the thread
+	// took to wake once the engine signalled it.
+	WakeLatency& wakeLatency() {
+		return this->_wakeLatency;
+	}
+
+	private:
+	// wokeAt is the QPC time at which the capture thread woke to capture, or 0
+	// if we're capturing on the audio thread.
+	bool _doCapture(int64_t wokeAt = 0);
+	void _captureThreadFunc();
+	// Called by the audio thread when a threaded stream doesn't have frames. If
+	// the capture thread hasn't woken for a while, capture on its behalf until it
+	// recovers. Returns true if we captured.
+	bool _takeOverIfStalled(uint32_t frames);
+	void _startCaptureThread();
+	void _stopCaptureThread();
+	// Reset the state which tracks captured audio, ready to start capturing.
+	void _resetCapture();
+	// Append captured audio to the buffer, or to the spill ring if the buffer is
+	// full. If data is null, silence is appended. This is called by whichever
+	// thread is capturing.
+	void _push(const BYTE* data, UINT64 numFrames);
+	void _pushSilence(UINT64 numFrames);
+	// The number of frames in the buffer and the spill ring.
+	size_t _available() const {
+		return this->_buffer.size() + this->_spill.size();
+	}
+	// Remove frames of audio from the buffer and then the spill ring. There must
+	// be at least that many available.
+	void _take(float* left, float* right, uint32_t frames);
+	void _checkLost(HRESULT hr);
+	// If we have fallen too far behind the shared epoch, e.g. because the buffer
+	// filled while the host stalled, drop the excess so the latency returns to
+	// normal. This leaves at least frames in the buffer. Returns the number of
+	// frames to crossfade with _crossfadeSkip() once the block has been read.
+	uint32_t _skipExcessLatency(uint32_t frames);
+	// Crossfade from the audio we skipped to the start of the block.
+	void _crossfadeSkip(float* left, float* right, uint32_t fade);
+	int64_t _framesToTime(uint64_t frames) const;
+	bool _align(uint32_t frames);
+	// If the capture thread dropped audio because the buffer was full, drop the
+	// audio before the gap too, so what remains is continuous, and realign to
+	// the shared epoch. Only streams which don't spill overflow.
+	void _recoverFromOverflow();
+
+	CComPtr<IAudioClient> _client;
+	CComPtr<IAudioCaptureClient> _capture;
+	// Audio we've captured but not yet sent to the host. The capture thread
+	// pushes and the audio thread takes.
+	StereoRing _buffer;
+	// The number of frames we hold before spilling, which can be less than the
+	// capacity of _buffer.
+	size_t _bufferFrames = 0;
+	// Set by the capture thread when _buffer was full and it had to drop the
+	// newest audio, which leaves a gap. The audio thread then drops the audio
+	// before the gap and realigns. See _recoverFromOverflow().
+	std::atomic<bool> _overflowed = false;
+	// Audio which didn't fit in _buffer. Everything in _buffer is older than
+	// anything in here. This is shared with the capture thread and can hold a
+	// minute of audio, so it has its own storage rather than using _arena.
+	StereoRing _spill;
+	SpillMode _spillMode = SpillMode::Off;
+	// Whether we're playing faster to get rid of spilled audio.
+	bool _catchingUp = false;
+	// Scratch buffers for the audio thread.
+	DspArena _arena;
+	// Audio read while catching up, before it is compressed, allocated from
+	// _arena.
+	float* _catchUpLeft = nullptr;
+	float* _catchUpRight = nullptr;
+	size_t _catchUpFrames = 0;
+	// How far behind the epoch we can fall, in frames, on top of two host blocks.
+	size_t _latencyCeiling = 0;
+	// The start of the audio we skipped, which we fade out, allocated from
+	// _arena.
+	float* _skipLeft = nullptr;
+	float* _skipRight = nullptr;
+	size_t _skipFrames = 0;
+	double _sampleRate = 0;
+	std::thread _captureThread;
+	AutoHandle _captureEvent;
+	// Tells the capture thread to exit when _captureEvent is signalled.
+	std::atomic<bool> _exitThread = false;
+	// How long the capture thread waits for _captureEvent in ms before checking
+	// for audio anyway, and how long in 100 ns units it can go without waking
+	// before the audio thread takes over.
+	DWORD _watchdogTimeout = INFINITE;
+	int64_t _staleAfter = 0;
+	// The QPC time at which the capture thread last woke.
+	std::atomic<int64_t> _heartbeat = 0;
+	// Held by whichever thread is capturing from the device, since the audio
+	// thread captures while the capture thread is stalled.
+	std::atomic<bool> _producing = false;
+	std::atomic<uint64_t> _watchdogCount = 0;
+	// Whether the audio thread has taken over from the capture thread. This is
+	// only touched by the audio thread.
+	bool _tookOver = false;
+	// The device position we expect the next packet to start at, or
+	// NO_POSITION if we haven't received a packet yet.
+	static constexpr UINT64 NO_POSITION = UINT64_MAX;
+	UINT64 _nextPosition = NO_POSITION;
+	std::atomic<uint64_t> _glitches = 0;
+	std::atomic<uint64_t> _missedFrames = 0;
+	std::atomic<uint64_t> _discardedFrames = 0;
+	// The QPC time at which the newest frame in the buffer ends.
+	std::atomic<int64_t> _endTime = 0;
+	// Whether we've aligned our output to the shared epoch yet.
+	bool _aligned = false;
+	// The number of frames of silence we must deliver before captured audio in
+	// order to align with the shared epoch.
+	uint64_t _alignSilence = 0;
+	std::atomic<bool> _lost = false;
+	std::atomic<ThreadPriority> _threadPriority = ThreadPriority::Normal;
+	WakeLatency _wakeLatency;
+	FadeIn _fadeIn;
+	// Deliver audio to the host, fading in after a start or resume and
+	// measuring the level. _deliver reads it straight from the buffer. _fade
+	// works in place on audio which has already been taken from the spill ring or
+	// compressed while catching up.
+	FusedStages<InterleavedSource, GainRampStage<FadeIn>, MeterStage,
+		PlanarSink> _deliver;
+	FusedStages<PlanarSource, GainRampStage<FadeIn>, MeterStage, PlanarSink>
+		_fade;
+};
+
+// How much captured audio a plug-in keeps so the user can save it later.
+struct HistorySettings {
+	static constexpr uint32_t MAX_MINUTES = 60;
+	// 0 disables the history.
+	uint32_t minutes = 0;
+	// Whether to store 16 bit samples instead of 32 bit floats, which halves the
+	// memory used.
+	bool pack16 = false;
+};
+
+// Statistics about a capture, published by the audio thread for the GUI.
+struct CaptureStatus {
+	// The number of blocks for which we didn't have enough audio for the host.
+	uint64_t underruns = 0;
+	// The glitches and missed frames reported by the device. See CaptureStream.
+	uint64_t glitches = 0;
+	uint64_t missedFrames = 0;
+	// See CaptureStream::watchdogCount().
+	uint64_t watchdog = 0;
+	// See CaptureStream::discardedFrameCount().
+	uint64_t discardedFrames = 0;
+};
+
+// Commands the GUI sends to the audio thread.
+enum class CaptureCommand {
+	ResetCounters,
+	// Begin or end writing to the switcher's DiskRecorder.
+	StartRecording,
+	StopRecording,
+};
+
+// Owns the capture streams for a plug-in and lets it switch to a different
+// source while capturing without a gap. The new stream is opened in the
+// background while the old one keeps delivering audio. Once the new stream has
+// primed, the audio thread crossfades to it and the main thread then stops the
+// old one.
+class CaptureSwitcher {
+	public:
+	~CaptureSwitcher();
+
+	// Prepare for audio to be delivered. This must be called from activate().
+	void activate(double sampleRate, uint32_t maxFrameCount);
+
+	// The stream currently delivering audio. The main thread may only open or
+	// stop this when the audio thread isn't reading it; e.g. when its
+	// StreamOpener isn't ready.
+	CaptureStream& active() {
+		return this->_streams[this->_active.load(std::memory_order_acquire)];
+	}
+
+	// Switch to a new source. open is called in a background thread to start the
+	// new source on the stream it is passed. If a switch is already in progress,
+	// this one happens once it is done. This must be called from the main thread
+	// while the active stream is delivering audio.
+	void switchTo(const clap_host* host,
+		std::function<bool(CaptureStream&)> open);
+
+	// Write captured audio to the host's output buffers, crossfading to the new
+	// source if a switch is in progress. Returns false if there isn't enough
+	// captured audio from the active stream.
+	// Commands posted by the GUI are applied before reading and the status is
+	// published afterwards, so the audio thread never waits for the GUI.
+	bool read(const clap_process* process);
+
+	// Called from process() before read(). Returns false if the active stream is
+	// stopped because the host's transport is idle, in which case process() must
+	// output silence instead of calling read(). The stream keeps running while
+	// anything else needs its audio, such as the history or a recording. When
+	// the stream needs to be stopped or restarted, host is asked to call
+	// onMainThread(), which must call applyTransport(). If the transport starts
+	// part way through the block while the stream is still running, read()
+	// outputs silence before the frame at which it started.
+	bool checkTransport(const clap_host* host, const clap_process* process,
+		const TransportIdle& transport);
+
+	// Whether the active stream is stopped because the transport is idle.
+	bool isStoppedForTransport() const {
+		return this->_transportState.load(std::memory_order_relaxed) ==
+			TransportState::Stopped;
+	}
+
+	// Stop or restart the active stream as requested by checkTransport(). This
+	// must be called from onMainThread() while the active stream's StreamOpener
+	// is ready.
+	void applyTransport();
+
+	// Send a command to the audio thread. This must be called from the main
+	// thread. It returns false if the audio thread hasn't kept up with earlier
+	// commands, which should only happen if it isn't running.
+	bool post(CaptureCommand command) {
+		return this->_commands.push(command);
+	}
+
+	// The status most recently published by the audio thread. This must be
+	// called from the main thread.
+	const CaptureStatus& status() {
+		return this->_status.read();
+	}
+
+	// The level of the audio read() most recently delivered to the host. If it
+	// had nothing to deliver, this is silence. This must only be used by the
+	// audio thread.
+	const LevelSums& levels() const {
+		return this->_levels;
+	}
+
+	// The audio most recently delivered to the host. This is written by read().
+	HistoryRing& history() {
+		return this->_history;
+	}
+
+	// Start streaming the audio delivered to the host to a file. This must be
+	// called from the main thread after activate(). Returns false if the file
+	// couldn't be created or a recording is still being finished.
+	bool startRecording(const std::filesystem::path& path);
+
+	// Stop streaming to the file. The file is closed once the audio thread and
+	// the writer have caught up. This must be called from the main thread.
+	void stopRecording() {
+		this->post(CaptureCommand::StopRecording);
+	}
+
+	const DiskRecorder& recorder() const {
+		return this->_recorder;
+	}
+
+	// Whether latency measurements record the return path from this switcher
+	// rather than from whichever capture instance hears the test signal first.
+	// Only one switcher in the process can do this, so choosing this one
+	// unchooses any other. These must be called from the main thread.
+	void setMeasuresLatency(bool measures);
+	bool measuresLatency() const;
+
+	// Finish or continue a switch. This must be called from onMainThread().
+	// Returns true if a switch failed. This only returns true once for each
+	// failure.
+	bool checkFailed();
+
+	// Cancel any switch and stop all streams. The audio thread must not be
+	// reading. A recording carries on after the next activate() unless the sample
+	// rate changes.
+	void stop();
+
+	private:
+	enum class State {
+		Idle,
+		// The new stream is being opened or is priming.
+		Switching,
+		// The audio thread has finished crossfading and the old stream can be
+		// stopped.
+		Retiring,
+		// The new stream was lost before we switched to it.
+		Failed,
+	};
+
+	// Whether the active stream is running, as far as the transport is
+	// concerned. Only the audio thread moves out of Running and Stopped and only
+	// the main thread moves out of Stopping and Starting, except that the audio
+	// thread can cancel a stop the main thread hasn't got to yet.
+	enum class TransportState {
+		Running,
+		Stopping,
+		Stopped,
+		Starting,
+	};
+
+	CaptureStream& _spare() {
+		return this->_streams[1 - this->_active.load(std::memory_order_acquire)];
+	}
+
+	bool _crossfade(float* left, float* right, uint32_t frames, bool haveOld);
+	void _applyCommands();
+	void _publishStatus();
+
+	CaptureStream _streams[2];
+	std::atomic<int> _active = 0;
+	std::atomic<State> _state = State::Idle;
+	std::atomic<TransportState> _transportState = TransportState::Running;
+	// The frame at which the transport started in the block being processed, if
+	// the stream was still running when it did. read() outputs silence before
+	// it. This is only used by the audio thread.
+	uint32_t _transportStartFrame = 0;
+	StreamOpener _opener;
+	const clap_host* _host = nullptr;
+	// A switch requested while another was in progress.
+	std::function<bool(CaptureStream&)> _pending;
+	// Scratch buffers for the audio thread.
+	DspArena _arena;
+	// Audio read from the new stream while crossfading, allocated from _arena.
+	float* _nextLeft = nullptr;
+	float* _nextRight = nullptr;
+	uint32_t _nextFrames = 0;
+	uint32_t _fadeFrames = 0;
+	LevelSums _levels;
+	uint32_t _fadePosition = 0;
+	HistoryRing _history;
+	DiskRecorder _recorder;
+	double _sampleRate = 0;
+	SpscQueue<CaptureCommand, 16> _commands;
+	Snapshot<CaptureStatus> _status;
+	// These are only touched by the audio thread.
+	uint64_t _underruns = 0;
+	bool _recording = false;
+	// The stream counters when they were last reset.
+	uint64_t _glitchBase = 0;
+	uint64_t _missedFrameBase = 0;
+	uint64_t _watchdogBase = 0;
+	uint64_t _discardedFrameBase = 0;
+};
+
+// Show the status of a capture in dialog. recoveries is the number of times
+// the plug-in has reopened a lost stream. This is called periodically from the
+// main thread while the dialog is open.
+void showCaptureStatus(HWND dialog, bool capturing, const StreamOpener& opener,
+	CaptureSwitcher& switcher, const OfflineRender& offline,
+	uint64_t recoveries);
+
+// Show history settings in dialog.
+void showHistorySettings(HWND dialog, const HistorySettings& settings);
+
+// Update settings from dialog in response to a WM_COMMAND for control cid with
+// notification code. Returns true if the settings changed, in which case the
+// plug-in must be restarted so the history can be reallocated.
+bool readHistorySettings(HWND dialog, WORD cid, WORD code,
+	HistorySettings& settings);
+
+// Show the spill mode in dialog.
+void showSpillMode(HWND dialog, SpillMode mode);
+
+// Get the spill mode chosen in dialog.
+SpillMode readSpillMode(HWND dialog);
+
+// Ask the user for a file and save history to it.
+void saveHistory(HWND dialog, const HistoryRing& history, double sampleRate);
+
+// Start or stop recording to a file in response to the user pressing the Record
+// button in dialog.
+void toggleRecording(HWND dialog, CaptureSwitcher& switcher);
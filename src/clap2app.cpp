@@ -10,19 +10,34 @@
 
 #include <atlcomcli.h>
 #include <audioclient.h>
-#include <functiondiscoverykeys.h>
-#include <Functiondiscoverykeys_devpkey.h>
 #include <mmdeviceapi.h>
 #include <windowsx.h>
 
 #include <algorithm>
+#include <sstream>
 #include <vector>
 
 #include "clap/helpers/plugin.hxx"
 
+#include "deviceRegistry.h"
+#include "dspPipeline.h"
+#include "endpointCache.h"
+#include "enginePeriod.h"
+#include "latency.h"
 #include "resource.h"
+#include "rtMemory.h"
 
-const uint32_t STATE_VERSION = 1;
+const uint32_t STATE_VERSION = 5;
+
+constexpr UINT_PTR MEASURE_TIMER = 1;
+// The timer the dialog uses to refresh the levels.
+constexpr UINT_PTR LEVEL_TIMER = 2;
+constexpr int64_t NO_LATENCY = -1;
+// Reported instead of a period when low latency mode was requested but the
+// device couldn't provide it.
+constexpr uint32_t LOW_LATENCY_UNAVAILABLE = UINT32_MAX;
+// How long to fade in when a send starts, in seconds.
+constexpr double FADE_IN_SECS = 0.01;
 
 class Clap2App : public BasePlugin {
 	public:
@@ -50,42 +65,86 @@ class Clap2App : public BasePlugin {
 	}
 
 	bool activate(double sampleRate, uint32_t minFrameCount, uint32_t maxFrameCount) noexcept override {
+		this->_sampleRate = sampleRate;
+		this->_maxFrameCount = maxFrameCount;
+		this->_transportStopped = false;
+		this->_meter.configure(sampleRate);
+		this->_send.stage<1>().bind(&this->_sendLevels);
+		this->_send.stage<2>().bind(this->_fadeIn);
 		if (!this->_sending) {
 			return false;
 		}
-		if (!this->startSend(sampleRate, maxFrameCount)) {
-			// Don't leave the Send button pressed when we aren't sending.
-			this->_sending = false;
-			if (this->_dialog) {
-				CheckDlgButton(this->_dialog, ID_SEND, BST_UNCHECKED);
-			}
-			this->updateControls();
-			this->_render = nullptr;
-			this->_client = nullptr;
-		}
+		// Opening the stream can take a while, so do it in the background. We
+		// drop audio until it's ready.
+		this->_opener.start(this->_host.host(), [this, sampleRate, maxFrameCount] {
+			return this->startSend(sampleRate, maxFrameCount);
+		});
 		return true;
 	}
 
 	void deactivate() noexcept  override {
+		this->_opener.stop();
 		if (!this->_client) {
 			return;
 		}
-		this->reset();
+		this->stopPlayback();
 		this->_render = nullptr;
 		this->_client = nullptr;
 	}
 
 	clap_process_status process(const clap_process *process) noexcept override {
-		if (!this->_render) {
+		RtScope rtScope;
+		// We show the level of what we're sending.
+		MeterScope meterScope(this->_meter, process, true);
+		if (!this->_opener.isReady()) {
 			return CLAP_PROCESS_SLEEP;
 		}
+		// The frame at which to start sending. This is only non-zero when the
+		// transport starts part way through this block.
+		uint32_t startFrame = 0;
+		if (this->_transport.isEnabled() && !LatencyMeasurement::get().isActive()) {
+			startFrame = TransportIdle::firstActiveFrame(process);
+			if (startFrame == process->frames_count) {
+				if (!this->_transportStopped) {
+					// Stop the device and drop what it hasn't played, so that when the
+					// transport starts, the first frame the device plays is the frame at
+					// which it started.
+					this->stopPlayback();
+					this->_transportStopped = true;
+				}
+				// Don't sleep, since we need to be called to find out when the transport
+				// starts.
+				return CLAP_PROCESS_CONTINUE;
+			}
+			if (!this->_transportStopped) {
+				startFrame = 0;
+			}
+			this->_transportStopped = false;
+		}
+		if (this->_offline.isOffline()) {
+			// The device plays in real time, so wait until it has room for this block.
+			// If we give up, we send what fits and drop the rest, as we would in real
+			// time.
+			this->_offline.waitUntil(this->_host.host(),
+				"Clap2App: the output device couldn't keep up with the offline render, so some audio was dropped.",
+				[this, process] {
+					UINT32 padding;
+					if (FAILED(this->_client->GetCurrentPadding(&padding))) {
+						// We'll deal with this below.
+						return true;
+					}
+					return this->_renderBufferFrames - padding >= process->frames_count;
+				}
+			);
+		}
 		UINT32 paddingFrames;
 		HRESULT hr = this->_client->GetCurrentPadding(&paddingFrames);
 		if (FAILED(hr)) {
+			this->checkLost(hr);
 			return CLAP_PROCESS_SLEEP;
 		}
 		const UINT32 sendFrames = std::min(
-			process->frames_count,
+			process->frames_count - startFrame,
 			this->_renderBufferFrames - paddingFrames
 		);
 		dbg(
@@ -96,21 +155,21 @@ class Clap2App : public BasePlugin {
 		BYTE* data;
 		hr = this->_render->GetBuffer(sendFrames, &data);
 		if (FAILED(hr)) {
+			this->checkLost(hr);
 			return CLAP_PROCESS_SLEEP;
 		}
-		for (uint32_t f = 0; f < sendFrames; ++f) {
-			memcpy(
-				data,
-				&process->audio_inputs[0].data32[0][f],
-				sizeof(float)
-			);
-			data += sizeof(float);
-			memcpy(
-				data,
-				&process->audio_inputs[0].data32[1][f],
-				sizeof(float)
-			);
-			data += sizeof(float);
+		if (!LatencyMeasurement::get().play(this, (float*)data, NUM_CHANNELS,
+				sendFrames)) {
+			const float* left = process->audio_inputs[0].data32[0] + startFrame;
+			const float* right = process->audio_inputs[0].data32[1] + startFrame;
+			// Measure what we send in the same pass rather than having meterScope
+			// read the block again. Frames we drop aren't sent, so they aren't
+			// measured.
+			this->_sendLevels = {};
+			this->_send.stage<0>().bind(left, right);
+			this->_send.stage<3>().bind((float*)data);
+			this->_send.process(sendFrames);
+			meterScope.measured(this->_meter.add(this->_sendLevels, sendFrames));
 		}
 		this->_render->ReleaseBuffer(sendFrames, 0);
 		if (paddingFrames + sendFrames >= this->_renderMinFrames) {
@@ -122,12 +181,76 @@ class Clap2App : public BasePlugin {
 	}
 
 	void reset() noexcept override {
-		if (!this->_client) {
+		if (!this->_opener.isReady()) {
 			return;
 		}
-		dbg("reset");
-		this->_client->Stop();
-		this->_client->Reset();
+		this->stopPlayback();
+	}
+
+	bool implementsParams() const noexcept override { return true; }
+
+	uint32_t paramsCount() const noexcept override {
+		return LEVEL_PARAMS_COUNT;
+	}
+
+	bool paramsInfo(uint32_t paramIndex, clap_param_info* info) const noexcept override {
+		return levelParamInfo(paramIndex, info);
+	}
+
+	bool paramsValue(clap_id paramId, double* value) noexcept override {
+		return levelParamValue(this->_meter.read(), paramId, value);
+	}
+
+	bool paramsValueToText(clap_id paramId, double value, char* display, uint32_t size) noexcept override {
+		return levelParamToText(paramId, value, display, size);
+	}
+
+	void paramsFlush(const clap_input_events* in, const clap_output_events* out) noexcept override {
+		// Our parameters are read-only, so there's nothing to apply.
+	}
+
+	bool implementsRender() const noexcept override { return true; }
+
+	bool renderHasHardRealtimeRequirement() noexcept override {
+		// The device plays in real time.
+		return true;
+	}
+
+	bool renderSetMode(clap_plugin_render_mode mode) noexcept override {
+		// The host might render offline anyway. We handle that in process().
+		this->_offline.setMode(mode);
+		return true;
+	}
+
+	void onMainThread() noexcept override {
+		if (this->_opener.checkFailed()) {
+			// Don't leave the Send button pressed when we aren't sending.
+			this->_sending = false;
+			if (this->_dialog) {
+				CheckDlgButton(this->_dialog, ID_SEND, BST_UNCHECKED);
+			}
+			this->updateControls();
+			this->_render = nullptr;
+			this->_client = nullptr;
+		} else if (this->_opener.checkLost()) {
+			// The device was unplugged, disabled or changed format. Keep trying to
+			// open it again in the background until it comes back. We drop audio
+			// until then.
+			++this->_recoveries;
+			this->_opener.start(this->_host.host(), [this] {
+				this->_render = nullptr;
+				this->_client = nullptr;
+				// The device might come back with a different buffer size.
+				EndpointCache::get().remove(this->_device);
+				return this->startSend(this->_sampleRate, this->_maxFrameCount);
+			}, true);
+		}
+	}
+
+	// The number of times we've recovered from losing the stream since we were
+	// created.
+	uint64_t recoveryCount() const {
+		return this->_recoveries;
 	}
 
 	bool implementsGui() const noexcept override { return true; }
@@ -148,6 +271,7 @@ class Clap2App : public BasePlugin {
 	}
 
 	void guiDestroy() noexcept override {
+		DeviceRegistry::get().removeListener(this->_dialog);
 		DestroyWindow(this->_dialog);
 		this->_dialog = this->_deviceCombo = nullptr;
 	}
@@ -169,10 +293,25 @@ class Clap2App : public BasePlugin {
 		SetWindowLongPtr(this->_dialog, GWLP_USERDATA, (LONG_PTR)this);
 		this->_deviceCombo = GetDlgItem(this->_dialog, ID_DEVICE);
 		this->buildDeviceList();
+		DeviceRegistry::get().addListener(this->_dialog);
 		// The GUI can be closed and reopened while we're sending.
 		CheckDlgButton(this->_dialog, ID_SEND,
 			this->_sending ? BST_CHECKED : BST_UNCHECKED);
 		this->updateControls();
+		this->updateLatency();
+		CheckDlgButton(this->_dialog, ID_OFFLINE_WAIT,
+			this->_offline.shouldWait() ? BST_CHECKED : BST_UNCHECKED);
+		CheckDlgButton(this->_dialog, ID_TRANSPORT_STOP,
+			this->_transport.isEnabled() ? BST_CHECKED : BST_UNCHECKED);
+		CheckDlgButton(this->_dialog, ID_LOW_LATENCY,
+			this->_lowLatency ? BST_CHECKED : BST_UNCHECKED);
+		showLevels(this->_dialog, this->_meter, this->_sending);
+		this->updateStatus();
+		SetTimer(this->_dialog, LEVEL_TIMER, 250, nullptr);
+		if (this->_measuring) {
+			// The GUI was closed and reopened during a measurement.
+			SetTimer(this->_dialog, MEASURE_TIMER, 100, nullptr);
+		}
 		return true;
 	}
 
@@ -184,24 +323,56 @@ class Clap2App : public BasePlugin {
 		stream->write(stream, &nBytes, sizeof(size_t));
 		const wchar_t* device = this->_device.c_str();
 		stream->write(stream, device, nBytes);
+		stream->write(stream, &this->_latency, sizeof(int64_t));
+		const bool offlineWait = this->_offline.shouldWait();
+		stream->write(stream, &offlineWait, sizeof(bool));
+		const bool transportStop = this->_transport.isEnabled();
+		stream->write(stream, &transportStop, sizeof(bool));
+		const bool lowLatency = this->_lowLatency;
+		stream->write(stream, &lowLatency, sizeof(bool));
 		return true;
 	}
 
 	bool stateLoad(const clap_istream* stream) noexcept override {
 		uint32_t version = 0;
 		stream->read(stream, &version, sizeof(uint32_t));
-		if (version != STATE_VERSION) {
+		if (version < 1 || version > STATE_VERSION) {
 			return false;
 		}
 		size_t nBytes = 0;
 		stream->read(stream, &nBytes, sizeof(size_t));
+		if (nBytes > 0) {
+			const size_t nChars = nBytes / sizeof(wchar_t);
+			auto device = std::make_unique<wchar_t[]>(nChars);
+			stream->read(stream, device.get(), nBytes);
+			this->_device = std::wstring(device.get(), nChars);
+		}
+		// Version 1 didn't save the measured latency.
+		this->_latency = NO_LATENCY;
+		if (version >= 2) {
+			stream->read(stream, &this->_latency, sizeof(int64_t));
+		}
+		// Version 3 added the offline setting, version 4 added the transport
+		// setting and version 5 added low latency mode.
+		if (version >= 3) {
+			bool offlineWait = true;
+			stream->read(stream, &offlineWait, sizeof(bool));
+			this->_offline.setWait(offlineWait);
+		}
+		if (version >= 4) {
+			bool transportStop = false;
+			stream->read(stream, &transportStop, sizeof(bool));
+			this->_transport.setEnabled(transportStop);
+		}
+		if (version >= 5) {
+			bool lowLatency = false;
+			stream->read(stream, &lowLatency, sizeof(bool));
+			this->_lowLatency = lowLatency;
+		}
+		this->updateLatency();
 		if (nBytes == 0) {
 			return true;
 		}
-		const size_t nChars = nBytes / sizeof(wchar_t);
-		auto device = std::make_unique<wchar_t[]>(nChars);
-		stream->read(stream, device.get(), nBytes);
-		this->_device = std::wstring(device.get(), nChars);
 		// We only save a device once the user has pressed Send, so behave as if they
 		// pressed it.
 		this->_sending = true;
@@ -216,6 +387,10 @@ class Clap2App : public BasePlugin {
 			return TRUE;
 		}
 		auto* plugin = (Clap2App*)GetWindowLongPtr(dialogHwnd, GWLP_USERDATA);
+		if (msg == WM_DEVICES_CHANGED) {
+			plugin->buildDeviceList();
+			return TRUE;
+		}
 		if (msg == WM_COMMAND) {
 			const WORD cid = LOWORD(wParam);
 			if (cid == ID_SEND) {
@@ -228,17 +403,142 @@ class Clap2App : public BasePlugin {
 						CheckDlgButton(dialogHwnd, ID_SEND, BST_UNCHECKED);
 						return TRUE;
 					}
-					plugin->_device = plugin->_devices[choice];
+					plugin->_device = (*plugin->_devices)[choice].id;
 				}
 				plugin->updateControls();
 				// Restart the plugin. We will start or stop the send in activate().
 				plugin->_host.host()->request_restart(plugin->_host.host());
 				return TRUE;
 			}
+			if (cid == ID_OFFLINE_WAIT) {
+				plugin->_offline.setWait(IsDlgButtonChecked(dialogHwnd,
+					ID_OFFLINE_WAIT));
+				return TRUE;
+			}
+			if (cid == ID_TRANSPORT_STOP) {
+				plugin->_transport.setEnabled(IsDlgButtonChecked(dialogHwnd,
+					ID_TRANSPORT_STOP));
+				return TRUE;
+			}
+			if (cid == ID_LOW_LATENCY) {
+				plugin->_lowLatency = IsDlgButtonChecked(dialogHwnd, ID_LOW_LATENCY);
+				// This only applies to streams we open from now on.
+				if (plugin->_sending) {
+					plugin->_host.host()->request_restart(plugin->_host.host());
+				}
+				return TRUE;
+			}
+			if (cid == ID_MEASURE) {
+				plugin->measureLatency();
+				return TRUE;
+			}
+		} else if (msg == WM_TIMER && wParam == MEASURE_TIMER) {
+			plugin->pollLatency();
+			return TRUE;
+		} else if (msg == WM_TIMER && wParam == LEVEL_TIMER) {
+			showLevels(dialogHwnd, plugin->_meter, plugin->_sending);
+			plugin->updateStatus();
+			return TRUE;
 		}
 		return FALSE;
 	}
 
+	// Called from the audio thread when a WASAPI call fails. If the stream can
+	// never work again, ask the main thread to reopen it.
+	void checkLost(HRESULT hr) {
+		if (isStreamLost(hr) && this->_opener.abandon()) {
+			dbg("checkLost: stream lost " << hr);
+			this->_host.host()->request_callback(this->_host.host());
+		}
+	}
+
+	void stopPlayback() {
+		dbg("stopPlayback");
+		this->_client->Stop();
+		this->_client->Reset();
+	}
+
+	void measureLatency() {
+		if (!this->_opener.isReady()) {
+			SetDlgItemText(this->_dialog, ID_LATENCY,
+				L"Press Send before measuring latency.");
+			return;
+		}
+		if (!LatencyMeasurement::get().start(this, this->_sampleRate)) {
+			// Another measurement is in progress.
+			return;
+		}
+		SetDlgItemText(this->_dialog, ID_LATENCY,
+			L"Measuring. Make sure App2Clap or In2Clap is capturing the output.");
+		this->_measuring = true;
+		SetTimer(this->_dialog, MEASURE_TIMER, 100, nullptr);
+	}
+
+	void pollLatency() {
+		const auto state = LatencyMeasurement::get().poll();
+		if (state == LatencyMeasurement::State::Playing ||
+				state == LatencyMeasurement::State::Recorded) {
+			return;
+		}
+		KillTimer(this->_dialog, MEASURE_TIMER);
+		this->_measuring = false;
+		if (state == LatencyMeasurement::State::Failed) {
+			SetDlgItemText(this->_dialog, ID_LATENCY,
+				L"Measurement failed: the test signal wasn't captured.");
+			return;
+		}
+		this->_latency = LatencyMeasurement::get().result();
+		// The latency is saved in our state.
+		if (this->_host.canUseState()) {
+			this->_host.stateMarkDirty();
+		}
+		this->updateLatency();
+	}
+
+	void updateLatency() {
+		if (!this->_dialog) {
+			return;
+		}
+		std::wostringstream s;
+		s << L"Round trip latency: ";
+		if (this->_latency == NO_LATENCY) {
+			s << L"not measured";
+		} else {
+			s << this->_latency << L" samples";
+			if (this->_sampleRate > 0) {
+				s << L" (" << this->_latency * 1000 / this->_sampleRate << L" ms)";
+			}
+		}
+		SetDlgItemText(this->_dialog, ID_LATENCY, s.str().c_str());
+	}
+
+	// Show the period low latency mode got and how many times we've reopened
+	// the device after losing it. This is called periodically while the dialog
+	// is open.
+	void updateStatus() {
+		std::wostringstream s;
+		const uint32_t period = this->_lowLatencyPeriod;
+		if (this->_sending && this->_opener.isReady() && period != 0) {
+			if (period == LOW_LATENCY_UNAVAILABLE) {
+				s << L"Low latency mode is unavailable for this device.";
+			} else {
+				s << L"Low latency period: " << period << L" frames";
+				if (this->_sampleRate > 0) {
+					s << L" (" << period * 1000 / this->_sampleRate << L" ms)";
+				}
+				s << L".";
+			}
+		}
+		const uint64_t recoveries = this->recoveryCount();
+		if (recoveries > 0) {
+			if (s.tellp() > 0) {
+				s << L"\n";
+			}
+			s << L"Reopened after the device was lost: " << recoveries << L" times.";
+		}
+		SetDlgItemText(this->_dialog, ID_STATUS, s.str().c_str());
+	}
+
 	// Update which controls are enabled. The device can only be chosen when we
 	// aren't sending.
 	void updateControls() {
@@ -248,6 +548,7 @@ class Clap2App : public BasePlugin {
 		EnableWindow(this->_deviceCombo, !this->_sending);
 	}
 
+	// Called in a background thread by StreamOpener.
 	bool startSend(double sampleRate, uint32_t maxFrameCount) {
 		if (this->_device.empty()) {
 			return false;
@@ -270,41 +571,73 @@ class Clap2App : public BasePlugin {
 		if (FAILED(hr)) {
 			return false;
 		}
-		hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, (void**)&this->_client);
-		if (FAILED(hr)) {
-			return false;
-		}
-		// Get the device's minimum buffer size. We will use this to determine when
-		// we're ready to start playback.
-		hr = this->_client->Initialize(
-			AUDCLNT_SHAREMODE_SHARED,
-			AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
-			0, 0, &format, nullptr
-		);
-		if (FAILED(hr)) {
-			return false;
-		}
-		hr = this->_client->GetBufferSize(&this->_renderMinFrames);
-		if (FAILED(hr)) {
-			return false;
+		auto activate = [&device] () -> CComPtr<IAudioClient> {
+			CComPtr<IAudioClient> client;
+			HRESULT hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL,
+				nullptr, (void**)&client);
+			if (FAILED(hr)) {
+				return nullptr;
+			}
+			return client;
+		};
+		constexpr DWORD flags = AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+			AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+		EndpointCaps caps;
+		EndpointCache::Probe probe;
+		if (!EndpointCache::get().find(this->_device, format.nSamplesPerSec, caps,
+				probe)) {
+			// Get the device's minimum buffer size. We will use this to determine when
+			// we're ready to start playback. We can only get it by initialising a
+			// client, so this only happens the first time we send to this device at
+			// this sample rate.
+			CComPtr<IAudioClient> probe = activate();
+			if (!probe) {
+				return false;
+			}
+			probe->GetDevicePeriod(&caps.defaultPeriod, &caps.minimumPeriod);
+			hr = probe->Initialize(AUDCLNT_SHAREMODE_SHARED, flags, 0, 0, &format,
+				nullptr);
+			if (FAILED(hr)) {
+				return false;
+			}
+			hr = probe->GetBufferSize(&caps.bufferFrames);
+			if (FAILED(hr)) {
+				return false;
+			}
+			EndpointCache::get().add(this->_device, format.nSamplesPerSec, caps);
 		}
+		// This might be a stream we're recovering, in which case the audio jumps, so
+		// fade in rather than clicking.
+		this->_fadeIn.start((uint32_t)(sampleRate * FADE_IN_SECS));
 		// The device will still be playing the last host chunk when we send another
 		// one. It can also take a while to begin playback. Therefore, use a large
 		// buffer. This makes playback more tolerant to other unanticipated causes of
 		// underruns too.
-		hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, (void**)&this->_client);
-		if (FAILED(hr)) {
-			return false;
-		}
 		const REFERENCE_TIME bufferDuration = REFTIMES_PER_SEC * 5;
-		hr = this->_client->Initialize(
-			AUDCLNT_SHAREMODE_SHARED,
-			AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
-			bufferDuration, 0, &format, nullptr
-		);
-		if (FAILED(hr)) {
+		// In low latency mode, the buffer Windows gives us is much smaller. We still
+		// need room for a few host blocks, or we'll underrun whenever the host
+		// delivers a block late.
+		const bool lowLatency = this->_lowLatency;
+		uint32_t periodFrames = 0;
+		this->_client = initializeSharedClient(activate, format, flags,
+			bufferDuration, lowLatency, maxFrameCount * 3, periodFrames);
+		if (!this->_client) {
 			return false;
 		}
+		if (!lowLatency) {
+			this->_lowLatencyPeriod = 0;
+		} else {
+			this->_lowLatencyPeriod = periodFrames != 0 ? periodFrames :
+				LOW_LATENCY_UNAVAILABLE;
+		}
+		if (periodFrames != 0) {
+			// The device consumes a period at a time, so begin playback once we have
+			// a host block plus a couple of periods rather than the default device
+			// buffer.
+			this->_renderMinFrames = maxFrameCount + periodFrames * 2;
+		} else {
+			this->_renderMinFrames = caps.bufferFrames;
+		}
 		hr = this->_client->GetBufferSize(&this->_renderBufferFrames);
 		if (FAILED(hr)) {
 			return false;
@@ -313,6 +646,7 @@ class Clap2App : public BasePlugin {
 			"activate maxFrameCount " << maxFrameCount <<
 			" sampleRate " << sampleRate <<
 			" requested bufferDuration " << bufferDuration <<
+			" periodFrames " << periodFrames <<
 			" _renderMinFrames " << this->_renderMinFrames <<
 			" _renderBufferFrames " << this->_renderBufferFrames
 		);
@@ -324,58 +658,32 @@ class Clap2App : public BasePlugin {
 	}
 
 	void buildDeviceList() {
-		this->_devices.clear();
-		ComboBox_ResetContent(this->_deviceCombo);
-		CComPtr<IMMDeviceEnumerator> enumerator;
-		HRESULT hr = enumerator.CoCreateInstance(__uuidof(MMDeviceEnumerator));
-		if (FAILED(hr)) {
-			return;
-		}
-		CComPtr<IMMDeviceCollection> devices;
-		hr = enumerator->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE, &devices);
-		if (FAILED(hr)) {
-			return;
+		// Keep whatever the user has selected, even if they haven't pressed Send
+		// yet.
+		std::wstring chosenDevice = this->_device;
+		const int choice = ComboBox_GetCurSel(this->_deviceCombo);
+		if (choice != CB_ERR) {
+			chosenDevice = (*this->_devices)[choice].id;
 		}
-		UINT count = 0;
-		devices->GetCount(&count);
-		for (UINT d = 0; d < count; ++d) {
-			CComPtr<IMMDevice> device;
-			hr = devices->Item(d, &device);
-			if (FAILED(hr)) {
-				continue;
-			}
-			wchar_t* id;
-			hr = device->GetId(&id);
-			if (FAILED(hr)) {
-				continue;
-			}
-			this->_devices.push_back(id);
-			const bool selected = this->_device == id;
-			CoTaskMemFree(id);
-			CComPtr<IPropertyStore> props;
-			hr = device->OpenPropertyStore(STGM_READ, &props);
-			if (FAILED(hr)) {
-				return;
-			}
-			PROPVARIANT val;
-			hr = props->GetValue(PKEY_Device_FriendlyName, &val);
-			if (FAILED(hr)) {
-				return;
-			}
-			ComboBox_AddString(this->_deviceCombo, val.pwszVal);
-			if (selected) {
+		ComboBox_ResetContent(this->_deviceCombo);
+		this->_devices = DeviceRegistry::get().snapshot(eRender);
+		for (const AudioDevice& device : *this->_devices) {
+			ComboBox_AddString(this->_deviceCombo, device.name.c_str());
+			if (device.id == chosenDevice) {
 				// Select the previously chosen device.
-				ComboBox_SetCurSel(this->_deviceCombo, this->_devices.size() - 1);
+				ComboBox_SetCurSel(this->_deviceCombo,
+					ComboBox_GetCount(this->_deviceCombo) - 1);
 			}
 		}
 	}
 
+	StreamOpener _opener;
 	CComPtr<IAudioClient> _client;
 	CComPtr<IAudioRenderClient> _render;
 	HWND _dialog = nullptr;
 	HWND _deviceCombo = nullptr;
 	// The devices we have found.
-	std::vector<std::wstring> _devices;
+	std::shared_ptr<const DeviceList> _devices;
 	// The chosen device.
 	std::wstring _device;
 	// Whether the user has pressed Send; i.e. whether we should be sending.
@@ -384,6 +692,34 @@ class Clap2App : public BasePlugin {
 	UINT32 _renderBufferFrames;
 	// The minimum number of frames required to prevent rendering glitches.
 	UINT32 _renderMinFrames = 0;
+	double _sampleRate = 0;
+	uint32_t _maxFrameCount = 0;
+	FadeIn _fadeIn;
+	// Convert the host's planar audio to the device's interleaved format,
+	// measuring its level and fading in as we go, in a single pass.
+	FusedStages<PlanarSource, MeterStage, GainRampStage<FadeIn>,
+		InterleavedSink> _send;
+	// What _send measured in the current block. This is only touched by the
+	// audio thread.
+	LevelSums _sendLevels;
+	uint64_t _recoveries = 0;
+	// Whether to use the smallest engine period the device supports. This is
+	// read by the thread which opens streams.
+	std::atomic<bool> _lowLatency = false;
+	// The low latency period of the stream we opened in frames, 0 if low latency
+	// mode wasn't requested or LOW_LATENCY_UNAVAILABLE if the device couldn't
+	// provide it. This is written by the thread which opens streams.
+	std::atomic<uint32_t> _lowLatencyPeriod = 0;
+	OfflineRender _offline;
+	LevelMeter _meter;
+	TransportIdle _transport;
+	// Whether we stopped the device because the transport stopped. This is only
+	// touched by the audio thread.
+	bool _transportStopped = false;
+	// The round trip latency in samples from the last measurement.
+	int64_t _latency = NO_LATENCY;
+	// Whether we started a latency measurement which hasn't finished yet.
+	bool _measuring = false;
 };
 
 extern const clap_plugin_descriptor clap2AppDescriptor = {
@@ -8,6 +8,255 @@
 
 #include "common.h"
 
+#include <audioclient.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+#include "resource.h"
+
+// How long to wait between attempts to reopen a lost stream.
+constexpr DWORD RETRY_INTERVAL_MS = 1000;
+
+void StreamOpener::start(const clap_host* host, std::function<bool()> open,
+	bool retry
+) {
+	this->stop();
+	// The thread which opens the stream moves on once it is open, but the COM
+	// objects it created are used afterwards. Keep the multithreaded apartment alive for the
+	// life of the process so they remain valid.
+	static CO_MTA_USAGE_COOKIE mtaCookie = [] {
+		CO_MTA_USAGE_COOKIE cookie = nullptr;
+		CoIncrementMTAUsage(&cookie);
+		return cookie;
+	}();
+	this->_state = State::Opening;
+	if (!this->_cancelEvent) {
+		this->_cancelEvent = CreateEvent(nullptr, true, false, nullptr);
+	}
+	ResetEvent(this->_cancelEvent);
+	auto run = [this, host, open = std::move(open), retry] {
+		CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+		bool succeeded = open();
+		while (!succeeded && retry) {
+			// The device probably hasn't come back yet. Reopening by device id means
+			// we'll resume as soon as it reappears.
+			if (WaitForSingleObject(this->_cancelEvent, RETRY_INTERVAL_MS) ==
+					WAIT_OBJECT_0) {
+				break;
+			}
+			succeeded = open();
+		}
+		CoUninitialize();
+		this->_state.store(succeeded ? State::Ready : State::Failed,
+			std::memory_order_release);
+		if (succeeded) {
+			host->request_process(host);
+		} else {
+			host->request_callback(host);
+		}
+	};
+	if (retry) {
+		// Retrying can take a long time, so don't tie up a worker with it.
+		this->_thread = std::thread(std::move(run));
+	} else {
+		this->_job = WorkerPool::get().submit(std::move(run));
+	}
+}
+
+void StreamOpener::stop() {
+	if (this->_cancelEvent) {
+		SetEvent(this->_cancelEvent);
+	}
+	if (this->_job) {
+		this->_job->cancelOrWait();
+		this->_job = nullptr;
+	}
+	if (this->_thread.joinable()) {
+		this->_thread.join();
+	}
+	this->_state = State::Idle;
+}
+
+bool StreamOpener::checkFailed() {
+	State expected = State::Failed;
+	return this->_state.compare_exchange_strong(expected, State::Idle);
+}
+
+bool StreamOpener::abandon() {
+	State expected = State::Ready;
+	return this->_state.compare_exchange_strong(expected, State::Lost);
+}
+
+bool StreamOpener::checkLost() {
+	State expected = State::Lost;
+	return this->_state.compare_exchange_strong(expected, State::Idle);
+}
+
+bool isStreamLost(HRESULT hr) {
+	return hr == AUDCLNT_E_DEVICE_INVALIDATED ||
+		hr == AUDCLNT_E_SERVICE_NOT_RUNNING ||
+		hr == AUDCLNT_E_RESOURCES_INVALIDATED;
+}
+
+void OfflineRender::_fail(const clap_host* host, const char* message) {
+	++this->_failures;
+	if (this->_warned.exchange(true)) {
+		return;
+	}
+	auto* log = (const clap_host_log*)host->get_extension(host, CLAP_EXT_LOG);
+	if (log) {
+		log->log(host, CLAP_LOG_WARNING, message);
+	}
+}
+
+uint32_t TransportIdle::firstActiveFrame(const clap_process* process) {
+	constexpr uint32_t ACTIVE_FLAGS = CLAP_TRANSPORT_IS_PLAYING |
+		CLAP_TRANSPORT_IS_RECORDING;
+	if (!process->transport || process->transport->flags & ACTIVE_FLAGS) {
+		return 0;
+	}
+	const clap_input_events* events = process->in_events;
+	const uint32_t count = events->size(events);
+	for (uint32_t e = 0; e < count; ++e) {
+		const clap_event_header* header = events->get(events, e);
+		if (header->space_id == CLAP_CORE_EVENT_SPACE_ID &&
+				header->type == CLAP_EVENT_TRANSPORT &&
+				((const clap_event_transport*)header)->flags & ACTIVE_FLAGS) {
+			return std::min(header->time, process->frames_count);
+		}
+	}
+	return process->frames_count;
+}
+
+bool levelParamInfo(uint32_t index, clap_param_info* info) {
+	static const char* const names[] = {
+		"Left peak", "Right peak", "Left RMS", "Right RMS",
+	};
+	if (index >= LEVEL_PARAMS_COUNT) {
+		return false;
+	}
+	*info = {
+		.id = index,
+		// Only we set these. Hosts can still record them as automation.
+		.flags = CLAP_PARAM_IS_READONLY,
+		.cookie = nullptr,
+		.min_value = MIN_LEVEL_DB,
+		.max_value = MAX_LEVEL_DB,
+		.default_value = MIN_LEVEL_DB,
+	};
+	snprintf(info->name, sizeof(info->name), "%s", names[index]);
+	snprintf(info->module, sizeof(info->module), "Meter");
+	return true;
+}
+
+bool levelParamValue(const Levels& levels, clap_id id, double* value) {
+	if (id >= LEVEL_PARAMS_COUNT) {
+		return false;
+	}
+	const int channel = id == LEFT_PEAK_PARAM || id == LEFT_RMS_PARAM ? 0 : 1;
+	const bool isPeak = id == LEFT_PEAK_PARAM || id == RIGHT_PEAK_PARAM;
+	*value = levelToDb(
+		isPeak ? levels.peak[channel] : levels.rms[channel]);
+	return true;
+}
+
+bool levelParamToText(clap_id id, double value, char* display,
+	uint32_t size
+) {
+	if (id >= LEVEL_PARAMS_COUNT) {
+		return false;
+	}
+	if (value <= MIN_LEVEL_DB) {
+		snprintf(display, size, "-inf dB");
+	} else {
+		snprintf(display, size, "%.1f dB", value);
+	}
+	return true;
+}
+
+bool MeterScope::_measure() {
+	const clap_audio_buffer* buffers = this->_measureInputs ?
+		this->_process->audio_inputs : this->_process->audio_outputs;
+	const uint32_t count = this->_measureInputs ?
+		this->_process->audio_inputs_count : this->_process->audio_outputs_count;
+	const float* left = nullptr;
+	const float* right = nullptr;
+	if (count > 0 && buffers[0].data32) {
+		left = buffers[0].data32[0];
+		// A mono input is shown in both channels.
+		right = buffers[0].channel_count > 1 ? buffers[0].data32[1] : left;
+	}
+	return this->_meter.process(left, right, this->_process->frames_count);
+}
+
+MeterScope::~MeterScope() {
+	if (this->_measured) {
+		if (!this->_published) {
+			return;
+		}
+	} else if (!this->_measure()) {
+		return;
+	}
+	const Levels& levels = this->_meter.current();
+	const clap_output_events* events = this->_process->out_events;
+	for (clap_id id = 0; id < LEVEL_PARAMS_COUNT; ++id) {
+		clap_event_param_value event = {
+			.header = {
+				.size = sizeof(clap_event_param_value),
+				.time = 0,
+				.space_id = CLAP_CORE_EVENT_SPACE_ID,
+				.type = CLAP_EVENT_PARAM_VALUE,
+				.flags = 0,
+			},
+			.param_id = id,
+			.cookie = nullptr,
+			.note_id = -1,
+			.port_index = -1,
+			.channel = -1,
+			.key = -1,
+		};
+		levelParamValue(levels, id, &event.value);
+		events->try_push(events, &event.header);
+	}
+}
+
+void showLevels(HWND dialog, LevelMeter& meter, bool active) {
+	if (!active) {
+		SetDlgItemText(dialog, ID_LEVELS, L"");
+		return;
+	}
+	const Levels& levels = meter.read();
+	std::wostringstream s;
+	s << std::fixed << std::setprecision(1);
+	const wchar_t* const channels[] = {L"Left", L"Right"};
+	for (int c = 0; c < 2; ++c) {
+		if (c > 0) {
+			s << L"; ";
+		}
+		s << channels[c] << L" ";
+		const float peak = levelToDb(levels.peak[c]);
+		if (peak <= MIN_LEVEL_DB) {
+			s << L"silent";
+			continue;
+		}
+		s << L"peak " << peak << L" dB, RMS " << levelToDb(levels.rms[c]) <<
+			L" dB";
+	}
+	SetDlgItemText(dialog, ID_LEVELS, s.str().c_str());
+}
+
+void outputSilence(const clap_process* process) {
+	for (uint32_t p = 0; p < process->audio_outputs_count; ++p) {
+		const clap_audio_buffer& output = process->audio_outputs[p];
+		for (uint32_t c = 0; c < output.channel_count; ++c) {
+			std::fill_n(output.data32[c], process->frames_count, 0.0f);
+		}
+	}
+}
+
 bool isReaperWrapper(HWND hwnd) {
 	wchar_t className[30];
 	return GetClassName(hwnd, className, _countof(className)) != 0 &&
@@ -15,8 +15,17 @@
 #include <dshow.h>
 #include <windows.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
 #include "clap/helpers/plugin.hh"
 
+#include "levelMeter.h"
+#include "workerPool.h"
+
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #define HINST_THISDLL ((HINSTANCE)&__ImageBase)
 
@@ -71,6 +80,243 @@ class AutoHandle {
 	HANDLE _handle;
 };
 
+// Sets up a stream in a background thread so that activate() doesn't block
+// while Windows opens the device, which can take seconds. process() must check
+// isReady() before touching anything set up by the background thread.
+class StreamOpener {
+	public:
+	~StreamOpener() {
+		this->stop();
+	}
+
+	// Call open on the shared WorkerPool, so that instances restored together open
+	// their streams in parallel. If it succeeds, the host is asked to call
+	// process() so that a sleeping plug-in starts delivering audio. If it fails,
+	// the host is asked to call onMainThread(), which should call checkFailed().
+	// If retry is true, open is instead called repeatedly until it succeeds or
+	// stop() is called. This is used to recover a lost stream, and it uses a
+	// thread of its own, since it can take a long time.
+	void start(const clap_host* host, std::function<bool()> open,
+		bool retry = false);
+	// Cancel the open if it hasn't started yet. Otherwise, wait for it to finish.
+	// Then forget the stream.
+	void stop();
+
+	bool isReady() const {
+		return this->_state.load(std::memory_order_acquire) == State::Ready;
+	}
+
+	// Returns true if the last open failed. This only returns true once for each
+	// failure.
+	bool checkFailed();
+
+	// Called from the audio thread when it finds that the stream has stopped
+	// working; e.g. because the device was unplugged. After this, isReady()
+	// returns false, so the audio thread won't touch the stream again until it
+	// has been reopened. Returns true if the stream was ready, in which case the
+	// caller should request a callback on the main thread, which should call
+	// checkLost().
+	bool abandon();
+
+	// Returns true if the stream was abandoned and should be reopened. This only
+	// returns true once for each loss.
+	bool checkLost();
+
+	private:
+	enum class State {
+		Idle,
+		Opening,
+		Ready,
+		Failed,
+		Lost,
+	};
+	std::atomic<State> _state = State::Idle;
+	std::shared_ptr<WorkerPool::Job> _job;
+	std::thread _thread;
+	// Signalled by stop() to cancel retries.
+	AutoHandle _cancelEvent;
+};
+
+// Whether a WASAPI error means that a stream can never work again and must be
+// reopened.
+bool isStreamLost(HRESULT hr);
+
+// Ramps audio up from silence so that starting or resuming a stream doesn't
+// click.
+class FadeIn {
+	public:
+	void start(uint32_t frames) {
+		this->_total = this->_remaining = frames;
+	}
+
+	// The gain to apply to the next frame.
+	float next() {
+		if (this->_remaining == 0) {
+			return 1.0f;
+		}
+		return 1.0f - (float)this->_remaining-- / this->_total;
+	}
+
+	private:
+	uint32_t _total = 0;
+	uint32_t _remaining = 0;
+};
+
+// Handles the host rendering offline, which can be much faster than real time.
+// Our sources and destinations only run in real time, so we either wait for
+// them, which makes the render run in real time, or give up and warn the user.
+class OfflineRender {
+	public:
+	// How long process() waits before giving up.
+	static constexpr auto TIMEOUT = std::chrono::seconds(2);
+
+	// Called from renderSetMode().
+	void setMode(clap_plugin_render_mode mode) {
+		this->_offline = mode == CLAP_RENDER_OFFLINE;
+		this->_warned = false;
+		this->_starved = false;
+	}
+
+	bool isOffline() const {
+		return this->_offline.load(std::memory_order_relaxed);
+	}
+
+	// Whether to wait rather than giving up straight away. This is a user
+	// setting.
+	bool shouldWait() const {
+		return this->_wait;
+	}
+
+	void setWait(bool wait) {
+		this->_wait = wait;
+	}
+
+	// The number of blocks we gave up on.
+	uint64_t failures() const {
+		return this->_failures;
+	}
+
+	// Called from process() while rendering offline. Polls ready until it returns
+	// true or TIMEOUT expires. Returns false if we gave up, in which case the
+	// host is warned with message the first time this happens in a render. Once
+	// we've given up, we don't wait again until ready returns true, so that a
+	// source which has gone away doesn't stall every block.
+	template<typename Ready>
+	bool waitUntil(const clap_host* host, const char* message, Ready ready) {
+		if (ready()) {
+			this->_starved = false;
+			return true;
+		}
+		if (this->_wait && !this->_starved) {
+			const auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+			do {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				if (ready()) {
+					return true;
+				}
+			} while (std::chrono::steady_clock::now() < deadline);
+			this->_starved = true;
+		}
+		this->_fail(host, message);
+		return false;
+	}
+
+	private:
+	void _fail(const clap_host* host, const char* message);
+
+	std::atomic<bool> _offline = false;
+	std::atomic<bool> _wait = true;
+	std::atomic<bool> _warned = false;
+	std::atomic<uint64_t> _failures = 0;
+	// This is only touched by the audio thread while rendering.
+	bool _starved = false;
+};
+
+// Works out whether the host's transport is idle; i.e. stopped and not
+// recording. Plug-ins can stop their streams while it is idle so that the many
+// instances nobody is listening to don't keep the audio engine busy. Hosts
+// which don't report the transport are never idle.
+class TransportIdle {
+	public:
+	// Whether to stop while the transport is idle. This is a user setting.
+	bool isEnabled() const {
+		return this->_enabled.load(std::memory_order_relaxed);
+	}
+
+	void setEnabled(bool enabled) {
+		this->_enabled = enabled;
+	}
+
+	// The first frame of process during which the transport is playing or
+	// recording, or frames_count if it is idle for the whole block. A transport
+	// which starts part way through a block is reported as an event, so this
+	// is sample accurate.
+	static uint32_t firstActiveFrame(const clap_process* process);
+
+	// Whether the plug-in should stop its stream for this block.
+	bool isIdle(const clap_process* process) const {
+		return this->isEnabled() &&
+			firstActiveFrame(process) == process->frames_count;
+	}
+
+	private:
+	std::atomic<bool> _enabled = false;
+};
+
+// The plug-ins report the levels they measure as read-only parameters so that
+// hosts can show and record them. Their values are in dB.
+enum LevelParam : clap_id {
+	LEFT_PEAK_PARAM,
+	RIGHT_PEAK_PARAM,
+	LEFT_RMS_PARAM,
+	RIGHT_RMS_PARAM,
+	LEVEL_PARAMS_COUNT,
+};
+
+bool levelParamInfo(uint32_t index, clap_param_info* info);
+bool levelParamValue(const Levels& levels, clap_id id, double* value);
+bool levelParamToText(clap_id id, double value, char* display,
+	uint32_t size);
+
+// Measures the levels of the host's buffers when process() returns, whichever
+// way it returns, and reports them to the host when they are published. If
+// measureInputs is true, the input buffers are measured. Otherwise, the output
+// buffers are measured.
+class MeterScope {
+	public:
+	MeterScope(LevelMeter& meter, const clap_process* process,
+		bool measureInputs): _meter(meter), _process(process),
+		_measureInputs(measureInputs) {}
+	~MeterScope();
+
+	// Tell the scope that the whole block has already been measured, e.g. by a
+	// MeterStage, so it doesn't read the buffers again. published is whether that
+	// published new levels, in which case they are still reported to the host.
+	void measured(bool published) {
+		this->_measured = true;
+		this->_published = published;
+	}
+
+	private:
+	// Measure the block. Returns true if new levels were published.
+	bool _measure();
+
+	LevelMeter& _meter;
+	const clap_process* _process;
+	bool _measureInputs;
+	bool _measured = false;
+	bool _published = false;
+};
+
+// Show the levels most recently published by meter in a dialog's ID_LEVELS
+// control. If active is false, nothing is being measured, so no levels are
+// shown. This is called periodically from the main thread while the dialog is
+// open.
+void showLevels(HWND dialog, LevelMeter& meter, bool active);
+
+// Fill all of the host's output buffers with silence.
+void outputSilence(const clap_process* process);
+
 HWND createDialog(HWND parent, int resourceId, DLGPROC dialogProc);
 bool guiShowCommon(HWND dialog);
 bool dialogProcCommon(HWND dialog, UINT msg);
@@ -0,0 +1,163 @@
+/*
+ * App2Clap
+ * Cross-correlation and test signal generation
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "correlation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+std::vector<float> generateMls(unsigned int order) {
+	// Feedback masks for a Galois LFSR which produce a maximum length sequence,
+	// indexed by order.
+	static const uint32_t masks[] = {
+		0, 0, 0x3, 0x6, 0xC, 0x14, 0x30, 0x60, 0xB8, 0x110, 0x240, 0x500, 0x829,
+		0x100D, 0x2015, 0x6000, 0xD008, 0x12000, 0x20400, 0x40023, 0x90000,
+		0x140000, 0x300000, 0x420000, 0xE10000,
+	};
+	if (order < 2 || order >= std::size(masks)) {
+		return {};
+	}
+	const size_t length = ((size_t)1 << order) - 1;
+	std::vector<float> sequence(length);
+	uint32_t state = 1;
+	for (size_t i = 0; i < length; ++i) {
+		const bool bit = state & 1;
+		sequence[i] = bit ? 1.0f : -1.0f;
+		state >>= 1;
+		if (bit) {
+			state ^= masks[order];
+		}
+	}
+	return sequence;
+}
+
+Fft::Fft(size_t size): _size(size), _bitReverse(size),
+_twiddleReal(size > 1 ? size - 1 : 0), _twiddleImag(size > 1 ? size - 1 : 0) {
+	unsigned int bits = 0;
+	while (((size_t)1 << bits) < size) {
+		++bits;
+	}
+	for (size_t i = 0; i < size; ++i) {
+		uint32_t reversed = 0;
+		for (unsigned int b = 0; b < bits; ++b) {
+			if (i & ((size_t)1 << b)) {
+				reversed |= 1u << (bits - 1 - b);
+			}
+		}
+		this->_bitReverse[i] = reversed;
+	}
+	// The stage which combines transforms of size half uses half twiddle factors,
+	// starting at index half - 1.
+	for (size_t half = 1; half < size; half *= 2) {
+		for (size_t k = 0; k < half; ++k) {
+			const double angle = -std::numbers::pi * k / half;
+			this->_twiddleReal[half - 1 + k] = (float)std::cos(angle);
+			this->_twiddleImag[half - 1 + k] = (float)std::sin(angle);
+		}
+	}
+}
+
+void Fft::forward(float* real, float* imag) const {
+	this->_transform(real, imag, false);
+}
+
+void Fft::inverse(float* real, float* imag) const {
+	this->_transform(real, imag, true);
+}
+
+void Fft::_transform(float* real, float* imag, bool inverse) const {
+	const size_t size = this->_size;
+	for (size_t i = 0; i < size; ++i) {
+		const size_t j = this->_bitReverse[i];
+		if (i < j) {
+			std::swap(real[i], real[j]);
+			std::swap(imag[i], imag[j]);
+		}
+	}
+	// The inverse transform uses the complex conjugates of the twiddle factors.
+	const float sign = inverse ? -1.0f : 1.0f;
+	for (size_t half = 1; half < size; half *= 2) {
+		const float* wr = &this->_twiddleReal[half - 1];
+		const float* wi = &this->_twiddleImag[half - 1];
+		for (size_t start = 0; start < size; start += half * 2) {
+			float* __restrict ar = real + start;
+			float* __restrict ai = imag + start;
+			float* __restrict br = real + start + half;
+			float* __restrict bi = imag + start + half;
+			for (size_t k = 0; k < half; ++k) {
+				const float twi = wi[k] * sign;
+				const float tr = br[k] * wr[k] - bi[k] * twi;
+				const float ti = br[k] * twi + bi[k] * wr[k];
+				br[k] = ar[k] - tr;
+				bi[k] = ai[k] - ti;
+				ar[k] += tr;
+				ai[k] += ti;
+			}
+		}
+	}
+}
+
+static size_t nextPowerOf2(size_t value) {
+	size_t power = 1;
+	while (power < value) {
+		power *= 2;
+	}
+	return power;
+}
+
+CrossCorrelator::CrossCorrelator(size_t referenceLength, size_t signalLength):
+_referenceLength(referenceLength), _signalLength(signalLength),
+// The reference is zero padded, so a transform the size of the signal is
+// enough to avoid circular wrapping for all of the delays we consider.
+_fft(nextPowerOf2(std::max(referenceLength, signalLength))),
+_refReal(_fft.size()), _refImag(_fft.size()),
+_sigReal(_fft.size()), _sigImag(_fft.size()) {}
+
+CorrelationResult CrossCorrelator::find(const float* reference,
+	const float* signal
+) {
+	const size_t size = this->_fft.size();
+	std::fill(std::copy_n(reference, this->_referenceLength,
+		this->_refReal.begin()), this->_refReal.end(), 0.0f);
+	std::fill(this->_refImag.begin(), this->_refImag.end(), 0.0f);
+	std::fill(std::copy_n(signal, this->_signalLength, this->_sigReal.begin()),
+		this->_sigReal.end(), 0.0f);
+	std::fill(this->_sigImag.begin(), this->_sigImag.end(), 0.0f);
+	this->_fft.forward(this->_refReal.data(), this->_refImag.data());
+	this->_fft.forward(this->_sigReal.data(), this->_sigImag.data());
+	// Multiply the signal spectrum by the conjugate of the reference spectrum.
+	float* __restrict sr = this->_sigReal.data();
+	float* __restrict si = this->_sigImag.data();
+	const float* __restrict rr = this->_refReal.data();
+	const float* __restrict ri = this->_refImag.data();
+	for (size_t i = 0; i < size; ++i) {
+		const float real = sr[i] * rr[i] + si[i] * ri[i];
+		const float imag = si[i] * rr[i] - sr[i] * ri[i];
+		sr[i] = real;
+		si[i] = imag;
+	}
+	this->_fft.inverse(sr, si);
+	// The path might invert polarity, so look for the largest magnitude.
+	const size_t maxDelay = this->_signalLength > this->_referenceLength ?
+		this->_signalLength - this->_referenceLength : 0;
+	CorrelationResult result = {0, 0.0f};
+	float peak = 0.0f;
+	double sum = 0.0;
+	for (size_t delay = 0; delay <= maxDelay; ++delay) {
+		const float magnitude = std::abs(sr[delay]);
+		sum += magnitude;
+		if (magnitude > peak) {
+			peak = magnitude;
+			result.delay = delay;
+		}
+	}
+	const double mean = sum / (maxDelay + 1);
+	result.peakRatio = mean > 0 ? (float)(peak / mean) : 0.0f;
+	return result;
+}
@@ -0,0 +1,74 @@
+/*
+ * App2Clap
+ * Header for cross-correlation and test signal generation
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Generate a maximum length sequence of length 2^order - 1 with values of
+// -1 and 1. order must be between 2 and 24.
+std::vector<float> generateMls(unsigned int order);
+
+// A complex FFT of a fixed power of 2 size. The data is kept in separate real
+// and imaginary arrays and the twiddle factors for each stage are contiguous, so
+// the butterfly loops vectorise.
+class Fft {
+	public:
+	explicit Fft(size_t size);
+
+	size_t size() const {
+		return this->_size;
+	}
+
+	// Transform in place. The inverse transform is not normalised.
+	void forward(float* real, float* imag) const;
+	void inverse(float* real, float* imag) const;
+
+	private:
+	void _transform(float* real, float* imag, bool inverse) const;
+
+	size_t _size;
+	std::vector<uint32_t> _bitReverse;
+	// The twiddle factors for all stages, with the factors for each stage stored
+	// one after the other.
+	std::vector<float> _twiddleReal;
+	std::vector<float> _twiddleImag;
+};
+
+struct CorrelationResult {
+	// The number of samples by which the signal is delayed relative to the
+	// reference.
+	size_t delay;
+	// The ratio of the correlation peak to the mean absolute correlation. Higher
+	// is more reliable. Even a noisy loopback of a broadband signal produces a
+	// ratio well above 20.
+	float peakRatio;
+};
+
+// A correlation peak below this ratio means the reference isn't in the signal.
+constexpr float MIN_PEAK_RATIO = 10;
+
+// Finds the delay of a reference signal within a longer signal using FFT
+// cross-correlation. All memory is allocated on construction, so find() can be
+// called repeatedly without allocating.
+class CrossCorrelator {
+	public:
+	CrossCorrelator(size_t referenceLength, size_t signalLength);
+
+	// Find the delay of reference within signal, considering delays up to
+	// signalLength - referenceLength samples.
+	CorrelationResult find(const float* reference, const float* signal);
+
+	private:
+	size_t _referenceLength;
+	size_t _signalLength;
+	Fft _fft;
+	std::vector<float> _refReal, _refImag, _sigReal, _sigImag;
+};
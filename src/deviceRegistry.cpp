@@ -0,0 +1,157 @@
+/*
+ * App2Clap
+ * Audio device registry
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "deviceRegistry.h"
+
+#include <functiondiscoverykeys.h>
+#include <Functiondiscoverykeys_devpkey.h>
+
+#include <algorithm>
+
+DeviceRegistry& DeviceRegistry::get() {
+	static DeviceRegistry registry;
+	return registry;
+}
+
+std::shared_ptr<const DeviceList> DeviceRegistry::snapshot(EDataFlow flow) {
+	std::lock_guard lock(this->_mutex);
+	if (!this->_enumerator) {
+		HRESULT hr = this->_enumerator.CoCreateInstance(__uuidof(MMDeviceEnumerator));
+		if (FAILED(hr)) {
+			return std::make_shared<const DeviceList>();
+		}
+		this->_enumerator->RegisterEndpointNotificationCallback(this);
+	}
+	const int index = flow == eCapture ? 1 : 0;
+	// Read the generation before enumerating so that if something changes while
+	// we're enumerating, we'll enumerate again next time.
+	const unsigned int generation = this->_generation;
+	auto& list = this->_lists[index];
+	if (!list || this->_listGenerations[index] != generation) {
+		list = this->_enumerate(flow);
+		this->_listGenerations[index] = generation;
+	}
+	return list;
+}
+
+std::shared_ptr<const DeviceList> DeviceRegistry::_enumerate(EDataFlow flow) {
+	auto list = std::make_shared<DeviceList>();
+	CComPtr<IMMDeviceCollection> devices;
+	HRESULT hr = this->_enumerator->EnumAudioEndpoints(flow, DEVICE_STATE_ACTIVE,
+		&devices);
+	if (FAILED(hr)) {
+		return list;
+	}
+	UINT count = 0;
+	devices->GetCount(&count);
+	for (UINT d = 0; d < count; ++d) {
+		CComPtr<IMMDevice> device;
+		hr = devices->Item(d, &device);
+		if (FAILED(hr)) {
+			continue;
+		}
+		wchar_t* id;
+		hr = device->GetId(&id);
+		if (FAILED(hr)) {
+			continue;
+		}
+		list->push_back({id, L""});
+		AudioDevice& entry = list->back();
+		CoTaskMemFree(id);
+		CComPtr<IPropertyStore> props;
+		hr = device->OpenPropertyStore(STGM_READ, &props);
+		if (SUCCEEDED(hr)) {
+			PROPVARIANT val;
+			PropVariantInit(&val);
+			hr = props->GetValue(PKEY_Device_FriendlyName, &val);
+			if (SUCCEEDED(hr) && val.vt == VT_LPWSTR) {
+				entry.name = val.pwszVal;
+			}
+			PropVariantClear(&val);
+		}
+		if (entry.name.empty()) {
+			// We couldn't get a name, but the device is still usable.
+			entry.name = entry.id;
+		}
+	}
+	return list;
+}
+
+void DeviceRegistry::addListener(HWND window) {
+	std::lock_guard lock(this->_listenersMutex);
+	this->_listeners.push_back(window);
+}
+
+void DeviceRegistry::removeListener(HWND window) {
+	std::lock_guard lock(this->_listenersMutex);
+	std::erase(this->_listeners, window);
+}
+
+void DeviceRegistry::shutdown() {
+	std::lock_guard lock(this->_mutex);
+	if (this->_enumerator) {
+		this->_enumerator->UnregisterEndpointNotificationCallback(this);
+		this->_enumerator = nullptr;
+	}
+	this->_lists[0] = this->_lists[1] = nullptr;
+}
+
+void DeviceRegistry::_invalidate() {
+	++this->_generation;
+	// This lock is only ever held briefly and never while calling Windows, so
+	// it's safe to take it here.
+	std::lock_guard lock(this->_listenersMutex);
+	for (HWND window : this->_listeners) {
+		PostMessage(window, WM_DEVICES_CHANGED, 0, 0);
+	}
+}
+
+HRESULT STDMETHODCALLTYPE DeviceRegistry::QueryInterface(REFIID riid,
+	void** ppInterface
+) {
+	if (riid == __uuidof(IUnknown) || riid == __uuidof(IMMNotificationClient)) {
+		*ppInterface = static_cast<IMMNotificationClient*>(this);
+		return S_OK;
+	}
+	*ppInterface = nullptr;
+	return E_NOINTERFACE;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceRegistry::OnDeviceStateChanged(LPCWSTR deviceId,
+	DWORD newState
+) {
+	this->_invalidate();
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceRegistry::OnDeviceAdded(LPCWSTR deviceId) {
+	this->_invalidate();
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceRegistry::OnDeviceRemoved(LPCWSTR deviceId) {
+	this->_invalidate();
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceRegistry::OnDefaultDeviceChanged(EDataFlow flow,
+	ERole role, LPCWSTR defaultDeviceId
+) {
+	// We don't list the default device separately, so this doesn't affect us.
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceRegistry::OnPropertyValueChanged(
+	LPCWSTR deviceId, const PROPERTYKEY key
+) {
+	if (key.fmtid == PKEY_Device_FriendlyName.fmtid &&
+			key.pid == PKEY_Device_FriendlyName.pid) {
+		this->_invalidate();
+	}
+	return S_OK;
+}
@@ -0,0 +1,83 @@
+/*
+ * App2Clap
+ * Header for the audio device registry
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include "common.h"
+
+#include <atlcomcli.h>
+#include <mmdeviceapi.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Posted to listening windows when the list of devices changes.
+constexpr UINT WM_DEVICES_CHANGED = WM_APP + 1;
+
+struct AudioDevice {
+	std::wstring id;
+	std::wstring name;
+};
+using DeviceList = std::vector<AudioDevice>;
+
+// Keeps track of the active audio devices for all instances in the process.
+// Devices are enumerated lazily the first time they're needed and again only
+// after Windows notifies us that something changed.
+class DeviceRegistry : public IMMNotificationClient {
+	public:
+	static DeviceRegistry& get();
+
+	// Get the active devices for flow, which must be eRender or eCapture. The
+	// returned list never changes, even if devices change later.
+	std::shared_ptr<const DeviceList> snapshot(EDataFlow flow);
+
+	// Ask for WM_DEVICES_CHANGED to be posted to window whenever devices change.
+	void addListener(HWND window);
+	void removeListener(HWND window);
+
+	// Stop receiving notifications from Windows. This must be called before the
+	// plug-in is unloaded.
+	void shutdown();
+
+	// IUnknown
+	// We're a static singleton, so reference counting is not needed.
+	ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+	ULONG STDMETHODCALLTYPE Release() override { return 1; }
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid,
+		void** ppInterface) override;
+
+	// IMMNotificationClient
+	HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR deviceId,
+		DWORD newState) override;
+	HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR deviceId) override;
+	HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR deviceId) override;
+	HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role,
+		LPCWSTR defaultDeviceId) override;
+	HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR deviceId,
+		const PROPERTYKEY key) override;
+
+	private:
+	// Called when devices change. Marks our lists as stale so they will be
+	// enumerated again when next needed and notifies listeners.
+	void _invalidate();
+	std::shared_ptr<const DeviceList> _enumerate(EDataFlow flow);
+
+	std::mutex _mutex;
+	CComPtr<IMMDeviceEnumerator> _enumerator;
+	// The lists for eRender and eCapture.
+	std::shared_ptr<const DeviceList> _lists[2];
+	// Incremented whenever devices change. Windows says we mustn't wait on locks
+	// in notification callbacks, so we use this instead of touching _lists there.
+	std::atomic<unsigned int> _generation = 0;
+	// The generation at which each list was enumerated.
+	unsigned int _listGenerations[2] = {};
+	std::mutex _listenersMutex;
+	std::vector<HWND> _listeners;
+};
@@ -0,0 +1,131 @@
+/*
+ * App2Clap
+ * Direct-to-disk recorder
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "diskRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "rtMemory.h"
+
+// How much audio the ring holds. This is how long the writer can be stalled
+// (e.g. by a slow disk) before audio is dropped.
+constexpr double RING_SECS = 4;
+// How often the writer wakes up to drain the ring. Waking less often means
+// fewer, larger writes.
+constexpr auto WRITE_INTERVAL = std::chrono::milliseconds(250);
+// How often the header is updated. This bounds how much audio a crash loses.
+constexpr double FINALIZE_SECS = 2;
+// How much audio to allocate space for in the file at a time.
+constexpr double ALLOCATION_SECS = 30;
+
+bool DiskRecorder::start(const std::filesystem::path& path,
+	uint32_t sampleRate, WavSampleFormat format
+) {
+	if (this->_thread.joinable()) {
+		// The previous recording has finished, but we haven't joined it yet.
+		this->_thread.join();
+	}
+	const uint64_t allocationChunk = (uint64_t)(ALLOCATION_SECS * sampleRate) *
+		2 * (format == WavSampleFormat::Int16 ? 2 : 4);
+	if (!this->_writer.open(path, sampleRate, 2, format, true,
+			allocationChunk)) {
+		return false;
+	}
+	this->_sampleRate = sampleRate;
+	this->_ringFrames = (size_t)(RING_SECS * sampleRate);
+	this->_ring.assign(this->_ringFrames * 2, 0.0f);
+	prepareRtMemory(this->_ring);
+	this->_writePos = 0;
+	this->_readPos = 0;
+	this->_finishing = false;
+	this->_done = false;
+	this->_failed = false;
+	this->_framesWritten = 0;
+	this->_droppedFrames = 0;
+	this->_thread = std::thread([this] { this->_run(); });
+	return true;
+}
+
+void DiskRecorder::write(const float* left, const float* right,
+	size_t frames
+) {
+	const uint64_t writePos = this->_writePos.load(std::memory_order_relaxed);
+	const uint64_t used = writePos -
+		this->_readPos.load(std::memory_order_acquire);
+	const size_t space = this->_ringFrames - (size_t)used;
+	if (frames > space) {
+		this->_droppedFrames.fetch_add(frames - space, std::memory_order_relaxed);
+		frames = space;
+	}
+	size_t pos = (size_t)(writePos % this->_ringFrames);
+	float* data = this->_ring.data();
+	for (size_t f = 0; f < frames; ++f) {
+		data[pos * 2] = left ? left[f] : 0.0f;
+		data[pos * 2 + 1] = right ? right[f] : 0.0f;
+		if (++pos == this->_ringFrames) {
+			pos = 0;
+		}
+	}
+	this->_writePos.store(writePos + frames, std::memory_order_release);
+}
+
+void DiskRecorder::finish() {
+	this->_finishing.store(true, std::memory_order_release);
+}
+
+void DiskRecorder::stop() {
+	if (!this->_thread.joinable()) {
+		return;
+	}
+	this->finish();
+	this->_thread.join();
+}
+
+void DiskRecorder::_drain() {
+	const uint64_t writePos = this->_writePos.load(std::memory_order_acquire);
+	uint64_t readPos = this->_readPos.load(std::memory_order_relaxed);
+	while (readPos < writePos) {
+		// Write up to the end of the ring in one go, then wrap around.
+		const size_t pos = (size_t)(readPos % this->_ringFrames);
+		const size_t frames = (size_t)std::min<uint64_t>(writePos - readPos,
+			this->_ringFrames - pos);
+		if (!this->failed() &&
+				!this->_writer.write(this->_ring.data() + pos * 2, frames)) {
+			// The disk is probably full. Keep draining so the audio thread isn't
+			// affected, but stop writing.
+			this->_failed.store(true, std::memory_order_relaxed);
+		}
+		readPos += frames;
+		this->_readPos.store(readPos, std::memory_order_release);
+	}
+	this->_framesWritten.store(this->_writer.framesWritten(),
+		std::memory_order_relaxed);
+}
+
+void DiskRecorder::_run() {
+	const uint64_t finalizeFrames = (uint64_t)(FINALIZE_SECS * this->_sampleRate);
+	uint64_t lastFinalize = 0;
+	for (;;) {
+		// Check this before draining so that everything written before finish()
+		// gets drained.
+		const bool finishing = this->_finishing.load(std::memory_order_acquire);
+		this->_drain();
+		if (finishing) {
+			break;
+		}
+		const uint64_t frames = this->_writer.framesWritten();
+		if (frames - lastFinalize >= finalizeFrames) {
+			this->_writer.finalize();
+			lastFinalize = frames;
+		}
+		std::this_thread::sleep_for(WRITE_INTERVAL);
+	}
+	this->_writer.close();
+	this->_done.store(true, std::memory_order_release);
+}
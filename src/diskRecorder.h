@@ -0,0 +1,92 @@
+/*
+ * App2Clap
+ * Header for the direct-to-disk recorder
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#include "lockfree.h"
+#include "wavFile.h"
+
+// Streams stereo audio from the audio thread to a WAV file. The audio thread
+// only copies into a ring buffer; a background thread drains it in large
+// writes to a file which is allocated well ahead of them and periodically
+// updates the file's header, so a crash loses at most a few seconds of audio. Files which grow beyond 4 GB become RF64 files.
+class DiskRecorder {
+	public:
+	~DiskRecorder() {
+		this->stop();
+	}
+
+	// Create the file and start the writer thread. This must be called from the
+	// main thread while the recorder is idle; i.e. isRecording() returns false.
+	bool start(const std::filesystem::path& path, uint32_t sampleRate,
+		WavSampleFormat format);
+
+	// Append frames of planar audio. Null buffers are written as silence. This
+	// must only be called from one thread at a time; i.e. the audio thread. If the
+	// writer can't keep up, the audio which doesn't fit is dropped and counted.
+	void write(const float* left, const float* right, size_t frames);
+
+	// End the recording once everything written so far is on disk. This doesn't
+	// wait. It must be called by the thread which calls write() or once that
+	// thread will no longer call write().
+	void finish();
+
+	// Finish and wait for the file to be closed. This must be called from the
+	// main thread when write() will no longer be called.
+	void stop();
+
+	// Whether a recording is in progress or still being written to disk.
+	bool isRecording() const {
+		return this->_thread.joinable() &&
+			!this->_done.load(std::memory_order_acquire);
+	}
+
+	bool failed() const {
+		return this->_failed.load(std::memory_order_relaxed);
+	}
+
+	uint32_t sampleRate() const {
+		return this->_sampleRate;
+	}
+
+	uint64_t framesWritten() const {
+		return this->_framesWritten.load(std::memory_order_relaxed);
+	}
+
+	uint64_t droppedFrames() const {
+		return this->_droppedFrames.load(std::memory_order_relaxed);
+	}
+
+	private:
+	void _run();
+	// Write everything in the ring to the file.
+	void _drain();
+
+	WavWriter _writer;
+	uint32_t _sampleRate = 0;
+	// Interleaved stereo audio.
+	std::vector<float> _ring;
+	size_t _ringFrames = 0;
+	// These only ever increase. The write position is only changed by write()
+	// and the read position only by the writer thread.
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _writePos = 0;
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _readPos = 0;
+	std::atomic<bool> _finishing = false;
+	std::atomic<bool> _done = false;
+	std::atomic<bool> _failed = false;
+	std::atomic<uint64_t> _framesWritten = 0;
+	std::atomic<uint64_t> _droppedFrames = 0;
+	std::thread _thread;
+};
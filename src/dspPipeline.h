@@ -0,0 +1,446 @@
+/*
+ * App2Clap
+ * Fused processing stages for the audio paths
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <tuple>
+
+#include "levelMeter.h"
+#include "lockfree.h"
+#include "rtMemory.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define DSP_SSE2
+#include <emmintrin.h>
+#endif
+
+// Hands out scratch buffers from a single block of memory owned by a plug-in
+// instance. The block is allocated and prefaulted when activating, so the audio
+// thread never allocates or takes a page fault. The block and each buffer in it
+// start on their own cache line.
+class DspArena {
+	public:
+	// The number of floats to reserve for a buffer of floats, including
+	// padding to the next cache line.
+	static constexpr size_t footprint(size_t floats) {
+		return (floats + FLOATS_PER_LINE - 1) / FLOATS_PER_LINE * FLOATS_PER_LINE;
+	}
+
+	// Make room for floats, which should be the sum of the footprints of the
+	// buffers which will be allocated. This discards all earlier allocations. It
+	// must not be called from the audio thread.
+	void reserve(size_t floats) {
+		if (floats > this->_size) {
+			this->_storage.reset(
+				new (std::align_val_t(CACHE_LINE_SIZE)) float[floats]());
+			this->_size = floats;
+			prepareRtMemory(this->_storage.get(), floats * sizeof(float));
+		}
+		this->_used = 0;
+	}
+
+	// Get a buffer of floats. Returns null if there isn't enough space left,
+	// which means reserve() was given too little.
+	float* allocate(size_t floats) {
+		const size_t needed = footprint(floats);
+		if (this->_used + needed > this->_size) {
+			return nullptr;
+		}
+		float* data = this->_storage.get() + this->_used;
+		this->_used += needed;
+		return data;
+	}
+
+	private:
+	static constexpr size_t FLOATS_PER_LINE = CACHE_LINE_SIZE / sizeof(float);
+
+	struct AlignedDelete {
+		void operator()(float* data) const {
+			::operator delete[](data, std::align_val_t(CACHE_LINE_SIZE));
+		}
+	};
+
+	std::unique_ptr<float[], AlignedDelete> _storage;
+	size_t _size = 0;
+	size_t _used = 0;
+};
+
+// The number of frames stages process at once.
+constexpr uint32_t DSP_STRIP_FRAMES = 4;
+
+// DSP_STRIP_FRAMES consecutive samples of one channel. With SSE2, this is a
+// single register. Otherwise, the compiler can usually still vectorise the
+// loops over its lanes.
+#ifdef DSP_SSE2
+using DspVector = __m128;
+
+inline DspVector dspLoad(const float* data) {
+	return _mm_loadu_ps(data);
+}
+
+inline void dspStore(float* data, DspVector vector) {
+	_mm_storeu_ps(data, vector);
+}
+
+inline DspVector dspZero() {
+	return _mm_setzero_ps();
+}
+
+inline DspVector dspMul(DspVector a, DspVector b) {
+	return _mm_mul_ps(a, b);
+}
+
+inline DspVector dspAdd(DspVector a, DspVector b) {
+	return _mm_add_ps(a, b);
+}
+
+inline DspVector dspMax(DspVector a, DspVector b) {
+	return _mm_max_ps(a, b);
+}
+
+inline DspVector dspAbs(DspVector vector) {
+	// Clearing the sign bit gives the absolute value.
+	return _mm_and_ps(vector, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));
+}
+
+// Split DSP_STRIP_FRAMES interleaved stereo frames into their channels.
+inline void dspDeinterleave(const float* data, DspVector& left,
+	DspVector& right
+) {
+	const __m128 first = _mm_loadu_ps(data);
+	const __m128 second = _mm_loadu_ps(data + 4);
+	left = _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0));
+	right = _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+inline void dspInterleave(float* data, DspVector left, DspVector right) {
+	_mm_storeu_ps(data, _mm_unpacklo_ps(left, right));
+	_mm_storeu_ps(data + 4, _mm_unpackhi_ps(left, right));
+}
+#else
+struct DspVector {
+	float lanes[DSP_STRIP_FRAMES];
+};
+
+inline DspVector dspLoad(const float* data) {
+	DspVector vector;
+	std::copy_n(data, DSP_STRIP_FRAMES, vector.lanes);
+	return vector;
+}
+
+inline void dspStore(float* data, DspVector vector) {
+	std::copy_n(vector.lanes, DSP_STRIP_FRAMES, data);
+}
+
+inline DspVector dspZero() {
+	return {};
+}
+
+template<typename Op>
+inline DspVector dspEach(DspVector a, DspVector b, Op op) {
+	for (uint32_t l = 0; l < DSP_STRIP_FRAMES; ++l) {
+		a.lanes[l] = op(a.lanes[l], b.lanes[l]);
+	}
+	return a;
+}
+
+inline DspVector dspMul(DspVector a, DspVector b) {
+	return dspEach(a, b, [](float x, float y) { return x * y; });
+}
+
+inline DspVector dspAdd(DspVector a, DspVector b) {
+	return dspEach(a, b, [](float x, float y) { return x + y; });
+}
+
+inline DspVector dspMax(DspVector a, DspVector b) {
+	return dspEach(a, b, [](float x, float y) { return std::max(x, y); });
+}
+
+inline DspVector dspAbs(DspVector vector) {
+	return dspEach(vector, vector, [](float x, float) { return std::abs(x); });
+}
+
+inline void dspDeinterleave(const float* data, DspVector& left,
+	DspVector& right
+) {
+	for (uint32_t l = 0; l < DSP_STRIP_FRAMES; ++l) {
+		left.lanes[l] = data[l * 2];
+		right.lanes[l] = data[l * 2 + 1];
+	}
+}
+
+inline void dspInterleave(float* data, DspVector left, DspVector right) {
+	for (uint32_t l = 0; l < DSP_STRIP_FRAMES; ++l) {
+		data[l * 2] = left.lanes[l];
+		data[l * 2 + 1] = right.lanes[l];
+	}
+}
+#endif
+
+// The largest lane and the sum of the lanes.
+inline float dspMaxLane(DspVector vector) {
+	alignas(16) float lanes[DSP_STRIP_FRAMES];
+	dspStore(lanes, vector);
+	return std::max({lanes[0], lanes[1], lanes[2], lanes[3]});
+}
+
+inline float dspSumLanes(DspVector vector) {
+	alignas(16) float lanes[DSP_STRIP_FRAMES];
+	dspStore(lanes, vector);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// A strip of frames passing through a chain of stages. Only the first count
+// frames are real. The rest are silence, so stages needn't treat them
+// specially unless they read or write a buffer or keep state per frame.
+struct DspStrip {
+	DspVector left;
+	DspVector right;
+	uint32_t count;
+};
+
+// The defaults for the optional parts of a stage. A stage processes a strip of
+// frames at a time in strip(). A source replaces the strip it is given, a sink
+// consumes it and anything else transforms it in place. begin() and end() are
+// called around each block.
+struct DspStage {
+	void begin() {}
+	void end() {}
+};
+
+// Runs a chain of stages over a block in a single pass. Each strip goes
+// through every stage before the next strip is touched, so the compiler can
+// inline the whole chain into one loop and each sample is loaded and stored
+// once, no matter how many stages there are. Stages are assembled when the
+// plug-in is activated and are bound to their buffers before each block.
+template<typename... Stages>
+class FusedStages {
+	public:
+	template<size_t index>
+	auto& stage() {
+		return std::get<index>(this->_stages);
+	}
+
+	void process(uint32_t frames) {
+		// Work on a copy of the stages. Vector types may alias floats, so the
+		// compiler would otherwise have to assume that writing the output could
+		// change a stage's state and reload that state for every strip. Stages are
+		// small, so copying them is cheap.
+		std::tuple<Stages...> local = this->_stages;
+		std::apply([frames](Stages&... stages) {
+			(stages.begin(), ...);
+			DspStrip strip;
+			uint32_t f = 0;
+			// Full strips are the common case. Setting count here lets the compiler
+			// drop the handling of partial strips from this loop.
+			for (; f + DSP_STRIP_FRAMES <= frames; f += DSP_STRIP_FRAMES) {
+				strip.count = DSP_STRIP_FRAMES;
+				(stages.strip(strip), ...);
+			}
+			if (f < frames) {
+				strip.count = frames - f;
+				(stages.strip(strip), ...);
+			}
+			(stages.end(), ...);
+		}, local);
+		this->_stages = local;
+	}
+
+	private:
+	std::tuple<Stages...> _stages;
+};
+
+// Reads planar audio, such as the host's buffers. If right is null, left is
+// used for both channels.
+class PlanarSource : public DspStage {
+	public:
+	void bind(const float* left, const float* right) {
+		this->_left = left;
+		this->_right = right ? right : left;
+	}
+
+	void strip(DspStrip& strip) {
+		if (strip.count == DSP_STRIP_FRAMES) {
+			strip.left = dspLoad(this->_left);
+			strip.right = dspLoad(this->_right);
+		} else {
+			alignas(16) float left[DSP_STRIP_FRAMES] = {};
+			alignas(16) float right[DSP_STRIP_FRAMES] = {};
+			std::copy_n(this->_left, strip.count, left);
+			std::copy_n(this->_right, strip.count, right);
+			strip.left = dspLoad(left);
+			strip.right = dspLoad(right);
+		}
+		this->_left += strip.count;
+		this->_right += strip.count;
+	}
+
+	private:
+	const float* _left = nullptr;
+	const float* _right = nullptr;
+};
+
+// Reads interleaved stereo audio, such as a WASAPI buffer or the audio a
+// StereoRing holds.
+class InterleavedSource : public DspStage {
+	public:
+	void bind(const float* data) {
+		this->_data = data;
+	}
+
+	void strip(DspStrip& strip) {
+		if (strip.count == DSP_STRIP_FRAMES) {
+			dspDeinterleave(this->_data, strip.left, strip.right);
+		} else {
+			alignas(16) float data[DSP_STRIP_FRAMES * 2] = {};
+			std::copy_n(this->_data, strip.count * 2, data);
+			dspDeinterleave(data, strip.left, strip.right);
+		}
+		this->_data += strip.count * 2;
+	}
+
+	private:
+	const float* _data = nullptr;
+};
+
+// Writes planar audio, such as the host's buffers.
+class PlanarSink : public DspStage {
+	public:
+	void bind(float* left, float* right) {
+		this->_left = left;
+		this->_right = right;
+	}
+
+	void strip(DspStrip& strip) {
+		if (strip.count == DSP_STRIP_FRAMES) {
+			dspStore(this->_left, strip.left);
+			dspStore(this->_right, strip.right);
+		} else {
+			alignas(16) float left[DSP_STRIP_FRAMES];
+			alignas(16) float right[DSP_STRIP_FRAMES];
+			dspStore(left, strip.left);
+			dspStore(right, strip.right);
+			std::copy_n(left, strip.count, this->_left);
+			std::copy_n(right, strip.count, this->_right);
+		}
+		this->_left += strip.count;
+		this->_right += strip.count;
+	}
+
+	private:
+	float* _left = nullptr;
+	float* _right = nullptr;
+};
+
+// Writes interleaved stereo audio, such as a WASAPI buffer.
+class InterleavedSink : public DspStage {
+	public:
+	void bind(float* data) {
+		this->_data = data;
+	}
+
+	void strip(DspStrip& strip) {
+		if (strip.count == DSP_STRIP_FRAMES) {
+			dspInterleave(this->_data, strip.left, strip.right);
+		} else {
+			alignas(16) float data[DSP_STRIP_FRAMES * 2];
+			dspInterleave(data, strip.left, strip.right);
+			std::copy_n(data, strip.count * 2, this->_data);
+		}
+		this->_data += strip.count * 2;
+	}
+
+	private:
+	float* _data = nullptr;
+};
+
+// Applies a gain which changes every frame. Ramp must have a next() method
+// returning the gain for the next frame and must be copyable, such as FadeIn.
+template<typename Ramp>
+class GainRampStage : public DspStage {
+	public:
+	void bind(Ramp& ramp) {
+		this->_ramp = &ramp;
+	}
+
+	// The ramp is advanced in a copy for the rest of the block so that the
+	// compiler can keep it in registers rather than storing it after every frame.
+	void begin() {
+		this->_current = *this->_ramp;
+	}
+
+	void strip(DspStrip& strip) {
+		alignas(16) float gains[DSP_STRIP_FRAMES] = {};
+		for (uint32_t f = 0; f < strip.count; ++f) {
+			gains[f] = this->_current.next();
+		}
+		const DspVector gain = dspLoad(gains);
+		strip.left = dspMul(strip.left, gain);
+		strip.right = dspMul(strip.right, gain);
+	}
+
+	void end() {
+		*this->_ramp = this->_current;
+	}
+
+	private:
+	Ramp* _ramp = nullptr;
+	Ramp _current;
+};
+
+// Measures the audio passing through it and adds the result to the LevelSums
+// it is bound to. The owner passes the sums to a LevelMeter once the whole
+// block has been produced, so a block which is produced in pieces is still
+// measured as one. If it isn't bound, nothing is added. The silence which pads
+// a partial strip doesn't change the peak or the sum of squares.
+class MeterStage : public DspStage {
+	public:
+	void bind(LevelSums* sums) {
+		this->_sums = sums;
+	}
+
+	void begin() {
+		this->_leftPeak = this->_rightPeak = dspZero();
+		this->_leftSquares = this->_rightSquares = dspZero();
+	}
+
+	void strip(DspStrip& strip) {
+		this->_leftPeak = dspMax(this->_leftPeak, dspAbs(strip.left));
+		this->_rightPeak = dspMax(this->_rightPeak, dspAbs(strip.right));
+		this->_leftSquares = dspAdd(this->_leftSquares,
+			dspMul(strip.left, strip.left));
+		this->_rightSquares = dspAdd(this->_rightSquares,
+			dspMul(strip.right, strip.right));
+	}
+
+	void end() {
+		if (!this->_sums) {
+			return;
+		}
+		LevelSums block;
+		block.peak[0] = dspMaxLane(this->_leftPeak);
+		block.peak[1] = dspMaxLane(this->_rightPeak);
+		block.sumSquares[0] = dspSumLanes(this->_leftSquares);
+		block.sumSquares[1] = dspSumLanes(this->_rightSquares);
+		this->_sums->merge(block);
+	}
+
+	private:
+	LevelSums* _sums = nullptr;
+	// Each lane accumulates every fourth frame.
+	DspVector _leftPeak;
+	DspVector _rightPeak;
+	DspVector _leftSquares;
+	DspVector _rightSquares;
+};
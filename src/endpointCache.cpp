@@ -0,0 +1,87 @@
+/*
+ * App2Clap
+ * Endpoint capability cache
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "endpointCache.h"
+
+#include <sstream>
+
+EndpointCache& EndpointCache::get() {
+	static EndpointCache cache;
+	return cache;
+}
+
+std::wstring EndpointCache::processLoopback(DWORD pid, bool include,
+	REFERENCE_TIME bufferDuration
+) {
+	std::wostringstream s;
+	s << L"process-loopback:" << pid << (include ? L":include:" : L":exclude:") <<
+		bufferDuration;
+	return s.str();
+}
+
+EndpointCache::Probe::~Probe() {
+	if (this->_cache) {
+		this->_cache->_release(*this);
+	}
+}
+
+bool EndpointCache::find(const std::wstring& endpoint, DWORD sampleRate,
+	EndpointCaps& caps, Probe& probe
+) {
+	const Key key = {endpoint, sampleRate};
+	std::unique_lock lock(this->_mutex);
+	for (;;) {
+		auto it = this->_caps.find(key);
+		if (it != this->_caps.end()) {
+			caps = it->second;
+			return true;
+		}
+		if (!this->_probing.contains(key)) {
+			break;
+		}
+		// If the other thread fails, we'll try ourselves.
+		this->_probed.wait(lock);
+	}
+	this->_probing[key] = &probe;
+	probe._cache = this;
+	probe._key = key;
+	return false;
+}
+
+void EndpointCache::add(const std::wstring& endpoint, DWORD sampleRate,
+	const EndpointCaps& caps
+) {
+	const Key key = {endpoint, sampleRate};
+	{
+		std::lock_guard lock(this->_mutex);
+		this->_caps[key] = caps;
+		this->_probing.erase(key);
+	}
+	this->_probed.notify_all();
+}
+
+void EndpointCache::_release(const Probe& probe) {
+	{
+		std::lock_guard lock(this->_mutex);
+		auto it = this->_probing.find(probe._key);
+		// Another thread might have started probing since we added, e.g. if the
+		// endpoint was removed in the meantime.
+		if (it == this->_probing.end() || it->second != &probe) {
+			return;
+		}
+		this->_probing.erase(it);
+	}
+	this->_probed.notify_all();
+}
+
+void EndpointCache::remove(const std::wstring& endpoint) {
+	std::lock_guard lock(this->_mutex);
+	std::erase_if(this->_caps, [&endpoint](const auto& item) {
+		return item.first.first == endpoint;
+	});
+}
@@ -0,0 +1,84 @@
+/*
+ * App2Clap
+ * Header for the endpoint capability cache
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include "common.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+// What we learned about an endpoint when we first initialised a stream for it.
+struct EndpointCaps {
+	// The buffer size Windows gave us when initialising a shared mode stream.
+	UINT32 bufferFrames = 0;
+	// The periods reported by IAudioClient::GetDevicePeriod. These are 0 for
+	// endpoints which don't report them, such as process loopback.
+	REFERENCE_TIME defaultPeriod = 0;
+	REFERENCE_TIME minimumPeriod = 0;
+};
+
+// Remembers the capabilities of endpoints for each format across all
+// instances in the process. An IAudioClient can only be initialised once, so
+// without this, every stream we open would have to initialise one client just
+// to find out how to initialise the real one.
+class EndpointCache {
+	using Key = std::pair<std::wstring, DWORD>;
+
+	public:
+	// The endpoint name used for process loopback capture of pid. Windows
+	// creates a separate endpoint for each target process and mode. Unlike
+	// devices, we probe these with the buffer duration we're going to use, which
+	// affects the buffer size we get, so that is part of the name too.
+	static std::wstring processLoopback(DWORD pid, bool include,
+		REFERENCE_TIME bufferDuration);
+
+	// Held by a thread which is finding out the capabilities of an endpoint, so
+	// that other threads wait for it instead of doing the same thing.
+	class Probe {
+		public:
+		Probe() = default;
+		Probe(const Probe&) = delete;
+		Probe& operator=(const Probe&) = delete;
+		~Probe();
+
+		private:
+		friend class EndpointCache;
+		EndpointCache* _cache = nullptr;
+		Key _key;
+	};
+
+	static EndpointCache& get();
+
+	// Look up the capabilities of endpoint at sampleRate. If they aren't known
+	// but another thread is finding them out, e.g. because several instances
+	// using the same endpoint are opening at once, wait for it. Returns false if
+	// they still aren't known, in which case the caller should find them out
+	// and call add(). Until it does or probe is destroyed, other threads looking
+	// up the same endpoint wait.
+	bool find(const std::wstring& endpoint, DWORD sampleRate,
+		EndpointCaps& caps, Probe& probe);
+	void add(const std::wstring& endpoint, DWORD sampleRate,
+		const EndpointCaps& caps);
+	// Forget everything we know about endpoint. This is used when a stream is
+	// lost, since the endpoint might come back with a different configuration.
+	void remove(const std::wstring& endpoint);
+
+	private:
+	// Called when probe is destroyed.
+	void _release(const Probe& probe);
+
+	std::mutex _mutex;
+	std::map<Key, EndpointCaps> _caps;
+	// The endpoints being probed and who is probing them.
+	std::map<Key, const Probe*> _probing;
+	// Notified whenever a probe finishes, whether or not it succeeded.
+	std::condition_variable _probed;
+};
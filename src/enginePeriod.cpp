@@ -0,0 +1,174 @@
+/*
+ * App2Clap
+ * Low latency engine period negotiation
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "enginePeriod.h"
+
+uint32_t chooseEnginePeriod(const EnginePeriodCaps& caps,
+	uint32_t currentFrames
+) {
+	if (caps.fundamentalFrames == 0 || caps.minFrames == 0 ||
+			caps.minFrames > caps.maxFrames) {
+		// The endpoint reported nonsense.
+		return 0;
+	}
+	const auto isSupported = [&caps](uint32_t frames) {
+		return frames >= caps.minFrames && frames <= caps.maxFrames &&
+			frames % caps.fundamentalFrames == 0;
+	};
+	if (currentFrames != 0 && currentFrames != caps.defaultFrames) {
+		// Another stream has already changed the engine's period. Asking for any
+		// other period would fail, but we can share that one.
+		return isSupported(currentFrames) && currentFrames < caps.defaultFrames ?
+			currentFrames : 0;
+	}
+	// The minimum should be a multiple of the fundamental, but don't rely on it.
+	uint32_t frames = caps.minFrames;
+	if (frames % caps.fundamentalFrames != 0) {
+		frames += caps.fundamentalFrames - frames % caps.fundamentalFrames;
+	}
+	if (!isSupported(frames) || frames >= caps.defaultFrames) {
+		// There's nothing to gain over the default.
+		return 0;
+	}
+	return frames;
+}
+
+bool negotiateEnginePeriod(PeriodEndpoint& endpoint, bool lowLatency,
+	uint32_t minBufferFrames, uint32_t& periodFrames
+) {
+	periodFrames = 0;
+	if (lowLatency) {
+		EnginePeriodCaps caps;
+		uint32_t currentFrames = 0;
+		if (endpoint.queryPeriods(caps, currentFrames)) {
+			const uint32_t frames = chooseEnginePeriod(caps, currentFrames);
+			uint32_t bufferFrames = 0;
+			if (frames != 0 && endpoint.initializeWithPeriod(frames, bufferFrames) &&
+					bufferFrames >= minBufferFrames) {
+				periodFrames = frames;
+				return true;
+			}
+		}
+	}
+	return endpoint.initializeDefault();
+}
+
+#ifdef _WIN32
+
+// Adapts an IAudioClient3 to the negotiation. Each attempt to initialise gets a
+// client which hasn't been initialised before.
+class AudioClientEndpoint : public PeriodEndpoint {
+	public:
+	AudioClientEndpoint(const std::function<CComPtr<IAudioClient>()>& activate,
+		const WAVEFORMATEX& format, DWORD flags, REFERENCE_TIME bufferDuration):
+		_activate(activate), _format(format), _flags(flags),
+		_bufferDuration(bufferDuration) {}
+
+	bool queryPeriods(EnginePeriodCaps& caps, uint32_t& currentFrames) override {
+		// We only query this client, so it can still be initialised afterwards.
+		this->_spare = this->_take();
+		CComQIPtr<IAudioClient3> client3(this->_spare);
+		if (!client3) {
+			// This is older than Windows 10.
+			return false;
+		}
+		UINT32 defaultFrames, fundamentalFrames, minFrames, maxFrames;
+		HRESULT hr = client3->GetSharedModeEnginePeriod(&this->_format,
+			&defaultFrames, &fundamentalFrames, &minFrames, &maxFrames);
+		if (FAILED(hr)) {
+			// Low latency is only supported for the engine's own format.
+			return false;
+		}
+		caps = {
+			.defaultFrames = defaultFrames,
+			.fundamentalFrames = fundamentalFrames,
+			.minFrames = minFrames,
+			.maxFrames = maxFrames,
+		};
+		WAVEFORMATEX* currentFormat = nullptr;
+		UINT32 current = 0;
+		hr = client3->GetCurrentSharedModeEnginePeriod(&currentFormat, &current);
+		if (SUCCEEDED(hr)) {
+			CoTaskMemFree(currentFormat);
+			currentFrames = current;
+		}
+		return true;
+	}
+
+	bool initializeWithPeriod(uint32_t periodFrames,
+		uint32_t& bufferFrames
+	) override {
+		CComQIPtr<IAudioClient3> client3(this->_take());
+		if (!client3) {
+			return false;
+		}
+		HRESULT hr = client3->InitializeSharedAudioStream(this->_flags,
+			periodFrames, &this->_format, nullptr);
+		if (FAILED(hr)) {
+			return false;
+		}
+		UINT32 frames;
+		hr = client3->GetBufferSize(&frames);
+		if (FAILED(hr)) {
+			return false;
+		}
+		bufferFrames = frames;
+		this->client = client3;
+		return true;
+	}
+
+	bool initializeDefault() override {
+		this->client = this->_take();
+		if (!this->client) {
+			return false;
+		}
+		HRESULT hr = this->client->Initialize(AUDCLNT_SHAREMODE_SHARED,
+			this->_flags, this->_bufferDuration, 0, &this->_format, nullptr);
+		if (FAILED(hr)) {
+			this->client = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	// The client we initialised.
+	CComPtr<IAudioClient> client;
+
+	private:
+	// Get a client which hasn't been initialised.
+	CComPtr<IAudioClient> _take() {
+		if (this->_spare) {
+			CComPtr<IAudioClient> client = this->_spare;
+			this->_spare = nullptr;
+			return client;
+		}
+		return this->_activate();
+	}
+
+	const std::function<CComPtr<IAudioClient>()>& _activate;
+	// A client we activated to query but haven't initialised.
+	CComPtr<IAudioClient> _spare;
+	WAVEFORMATEX _format;
+	DWORD _flags;
+	REFERENCE_TIME _bufferDuration;
+};
+
+CComPtr<IAudioClient> initializeSharedClient(
+	const std::function<CComPtr<IAudioClient>()>& activate,
+	const WAVEFORMATEX& format, DWORD flags, REFERENCE_TIME bufferDuration,
+	bool lowLatency, uint32_t minBufferFrames, uint32_t& periodFrames
+) {
+	AudioClientEndpoint endpoint(activate, format, flags, bufferDuration);
+	if (!negotiateEnginePeriod(endpoint, lowLatency, minBufferFrames,
+			periodFrames)) {
+		return nullptr;
+	}
+	return endpoint.client;
+}
+
+#endif
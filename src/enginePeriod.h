@@ -0,0 +1,82 @@
+/*
+ * App2Clap
+ * Header for low latency engine period negotiation
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+// The negotiation talks to a PeriodEndpoint so that it can be tested against a
+// simulated endpoint. Only initializeSharedClient() uses WASAPI.
+
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <atlcomcli.h>
+#include <audioclient.h>
+
+#include <functional>
+#endif
+
+// The shared mode engine periods an endpoint supports for a format, in frames,
+// as reported by IAudioClient3::GetSharedModeEnginePeriod. Any multiple of
+// fundamentalFrames between minFrames and maxFrames is supported.
+struct EnginePeriodCaps {
+	uint32_t defaultFrames = 0;
+	uint32_t fundamentalFrames = 0;
+	uint32_t minFrames = 0;
+	uint32_t maxFrames = 0;
+};
+
+// Choose the engine period to request. currentFrames is the period the engine
+// is already running at, or 0 if that isn't known. Windows runs each engine at
+// a single period, so if another stream has already changed it, we can only
+// join that period. Returns 0 if there's no period smaller than the default
+// which we can use, in which case the stream should be initialised normally.
+uint32_t chooseEnginePeriod(const EnginePeriodCaps& caps,
+	uint32_t currentFrames);
+
+// The operations negotiation needs from an endpoint. On Windows, these wrap an
+// IAudioClient3. Tests can simulate an endpoint instead.
+class PeriodEndpoint {
+	public:
+	virtual ~PeriodEndpoint() = default;
+
+	// Get the periods the endpoint supports and the period its engine is
+	// currently running at. Returns false if the endpoint can't report these,
+	// e.g. because it doesn't support IAudioClient3.
+	virtual bool queryPeriods(EnginePeriodCaps& caps,
+		uint32_t& currentFrames) = 0;
+	// Initialise a stream with an engine period of periodFrames. On success,
+	// bufferFrames is set to the size of the buffer Windows gave us.
+	virtual bool initializeWithPeriod(uint32_t periodFrames,
+		uint32_t& bufferFrames) = 0;
+	// Initialise a stream normally, with the engine's default period. This must
+	// work even if initializeWithPeriod() was called and failed or its stream was
+	// rejected.
+	virtual bool initializeDefault() = 0;
+};
+
+// Initialise a stream on endpoint. If lowLatency is true, we try to use the
+// smallest period the endpoint supports, falling back to the default period if
+// that doesn't work or it results in a buffer smaller than minBufferFrames.
+// Returns false if the stream couldn't be initialised at all. Otherwise,
+// periodFrames is set to the low latency period we got, or 0 if the stream
+// uses the default period.
+bool negotiateEnginePeriod(PeriodEndpoint& endpoint, bool lowLatency,
+	uint32_t minBufferFrames, uint32_t& periodFrames);
+
+#ifdef _WIN32
+// Initialise a shared mode stream for format using negotiateEnginePeriod().
+// activate must return a new, uninitialised client each time it is called,
+// since a client can't be initialised again once an attempt has failed.
+// bufferDuration and flags are used for streams with the default period.
+// Returns the initialised client, or null on failure.
+CComPtr<IAudioClient> initializeSharedClient(
+	const std::function<CComPtr<IAudioClient>()>& activate,
+	const WAVEFORMATEX& format, DWORD flags, REFERENCE_TIME bufferDuration,
+	bool lowLatency, uint32_t minBufferFrames, uint32_t& periodFrames);
+#endif
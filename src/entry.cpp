@@ -10,6 +10,10 @@
 
 #include "clap/clap.h"
 
+#include "deviceRegistry.h"
+#include "sessionRegistry.h"
+#include "workerPool.h"
+
 extern const clap_plugin_descriptor app2ClapDescriptor;
 const clap_plugin* createApp2Clap(const clap_host* host);
 
@@ -52,7 +56,11 @@ static const clap_plugin_factory factory = {
 CLAP_EXPORT const clap_plugin_entry clap_entry = {
 	.clap_version = CLAP_VERSION,
 	.init = [] (const char *path) -> bool { return true; },
-	.deinit = [] () {},
+	.deinit = [] () {
+		SessionRegistry::get().shutdown();
+		DeviceRegistry::get().shutdown();
+		WorkerPool::get().shutdown();
+	},
 	.get_factory = [] (const char *factoryID) -> const void * {
 		return strcmp(factoryID, CLAP_PLUGIN_FACTORY_ID) == 0 ? &factory : nullptr;
 	},
@@ -0,0 +1,109 @@
+/*
+ * App2Clap
+ * Retroactive capture history
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "historyRing.h"
+
+#include <algorithm>
+#include <cmath>
+
+void HistoryRing::configure(size_t frames, bool pack16) {
+	if (frames == this->_capacity && pack16 == this->isPacked()) {
+		return;
+	}
+	this->_capacity = frames;
+	// Assigning zeroes touches every page now rather than on the audio thread.
+	if (pack16) {
+		this->_float = {};
+		this->_packed.assign(frames * 2, 0);
+	} else {
+		this->_packed = {};
+		this->_float.assign(frames * 2, 0.0f);
+	}
+	this->_written = 0;
+}
+
+template<typename Sample, typename Convert>
+void HistoryRing::_write(std::vector<Sample>& buffer, const float* left,
+	const float* right, size_t frames, Convert convert
+) {
+	const uint64_t written = this->_written.load(std::memory_order_relaxed);
+	// Only the most recent _capacity frames can be kept.
+	if (frames > this->_capacity) {
+		const size_t skip = frames - this->_capacity;
+		if (left) {
+			left += skip;
+			right += skip;
+		}
+		frames = this->_capacity;
+	}
+	size_t pos = (size_t)(written % this->_capacity);
+	Sample* data = buffer.data();
+	for (size_t f = 0; f < frames; ++f) {
+		data[pos * 2] = left ? convert(left[f]) : Sample{};
+		data[pos * 2 + 1] = right ? convert(right[f]) : Sample{};
+		if (++pos == this->_capacity) {
+			pos = 0;
+		}
+	}
+	this->_written.store(written + frames, std::memory_order_release);
+}
+
+static int16_t packSample(float sample) {
+	return (int16_t)std::lrint(std::clamp(sample, -1.0f, 1.0f) * 32767.0f);
+}
+
+static float identity(float sample) {
+	return sample;
+}
+
+void HistoryRing::write(const float* left, const float* right, size_t frames) {
+	if (this->_capacity == 0) {
+		return;
+	}
+	if (this->isPacked()) {
+		this->_write(this->_packed, left, right, frames, packSample);
+	} else {
+		this->_write(this->_float, left, right, frames, identity);
+	}
+}
+
+void HistoryRing::writeSilence(size_t frames) {
+	this->write(nullptr, nullptr, frames);
+}
+
+size_t HistoryRing::read(std::vector<float>& out) const {
+	out.clear();
+	if (this->_capacity == 0) {
+		return 0;
+	}
+	const uint64_t end = this->_written.load(std::memory_order_acquire);
+	const size_t count = (size_t)std::min<uint64_t>(end, this->_capacity);
+	const uint64_t start = end - count;
+	out.resize(count * 2);
+	for (size_t f = 0; f < count; ++f) {
+		const size_t pos = (size_t)((start + f) % this->_capacity);
+		if (this->isPacked()) {
+			out[f * 2] = this->_packed[pos * 2] / 32767.0f;
+			out[f * 2 + 1] = this->_packed[pos * 2 + 1] / 32767.0f;
+		} else {
+			out[f * 2] = this->_float[pos * 2];
+			out[f * 2 + 1] = this->_float[pos * 2 + 1];
+		}
+	}
+	// The writer kept going while we copied, so the oldest frames we copied might
+	// have been overwritten with newer audio. Drop those.
+	const uint64_t after = this->_written.load(std::memory_order_acquire);
+	const uint64_t oldestIntact = after > this->_capacity ?
+		after - this->_capacity : 0;
+	if (oldestIntact > start) {
+		const size_t drop = (size_t)std::min<uint64_t>(oldestIntact - start, count);
+		out.erase(out.begin(), out.begin() + drop * 2);
+		return count - drop;
+	}
+	return count;
+}
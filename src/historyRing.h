@@ -0,0 +1,57 @@
+/*
+ * App2Clap
+ * Header for the retroactive capture history
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Keeps the most recent stereo audio delivered by a capture plug-in so that the
+// user can save it after the fact, even if the host wasn't recording. All
+// memory is allocated up front, so writing never allocates.
+class HistoryRing {
+	public:
+	// Allocate space for frames stereo frames, discarding any history. If pack16
+	// is true, samples are stored as 16 bit integers, which halves the memory
+	// used at the cost of precision. If the configuration hasn't changed, the
+	// history is kept. This must not be called while a writer is running.
+	void configure(size_t frames, bool pack16);
+
+	size_t capacity() const {
+		return this->_capacity;
+	}
+
+	bool isPacked() const {
+		return !this->_packed.empty();
+	}
+
+	// Append frames of planar audio. This must only be called from one thread at
+	// a time; i.e. the audio thread.
+	void write(const float* left, const float* right, size_t frames);
+	void writeSilence(size_t frames);
+
+	// Copy the history, oldest first, as interleaved stereo into out. This can be
+	// called from another thread while the writer is running. Returns the number
+	// of frames copied.
+	size_t read(std::vector<float>& out) const;
+
+	private:
+	template<typename Sample, typename Convert>
+	void _write(std::vector<Sample>& buffer, const float* left,
+		const float* right, size_t frames, Convert convert);
+
+	size_t _capacity = 0;
+	// Only one of these is allocated, depending on whether we're packing.
+	std::vector<float> _float;
+	std::vector<int16_t> _packed;
+	// The total number of frames ever written. The next frame is written at this
+	// modulo _capacity.
+	std::atomic<uint64_t> _written = 0;
+};
@@ -7,11 +7,14 @@
  */
 
 #include "common.h"
+#include "capture.h"
+#include "deviceRegistry.h"
+#include "endpointCache.h"
+#include "enginePeriod.h"
+#include "rtMemory.h"
 
 #include <atlcomcli.h>
 #include <audioclient.h>
-#include <functiondiscoverykeys.h>
-#include <Functiondiscoverykeys_devpkey.h>
 #include <mmdeviceapi.h>
 #include <tlhelp32.h>
 #include <windowsx.h>
@@ -19,7 +22,6 @@
 #include <algorithm>
 #include <vector>
 
-#include "circular_buffer.h"
 #include "clap/helpers/plugin.hxx"
 
 #include "resource.h"
@@ -27,7 +29,7 @@
 constexpr DWORD IDLE_PID = 0;
 constexpr DWORD SYSTEM_PID = 4;
 
-const uint32_t STATE_VERSION = 1;
+const uint32_t STATE_VERSION = 6;
 
 class In2Clap : public BasePlugin {
 	public:
@@ -58,60 +60,150 @@ class In2Clap : public BasePlugin {
 		if (!this->_capturing) {
 			return false;
 		}
-		if (!this->startCapture(sampleRate, maxFrameCount)) {
-			// Don't leave the Capture button pressed when we aren't capturing.
-			this->_capturing = false;
-			if (this->_dialog) {
-				CheckDlgButton(this->_dialog, ID_CAPTURE, BST_UNCHECKED);
-			}
-			this->updateControls();
-			this->_capture = nullptr;
-			this->_client = nullptr;
-		}
+		this->_sampleRate = sampleRate;
+		this->_maxFrameCount = maxFrameCount;
+		this->_switcher.activate(sampleRate, maxFrameCount);
+		this->_meter.configure(sampleRate);
+		this->_switcher.history().configure(
+			(size_t)(this->_history.minutes * 60 * sampleRate),
+			this->_history.pack16);
+		// Opening the stream can take a while, so do it in the background. We
+		// output silence until it's ready.
+		this->_opener.start(this->_host.host(), [this, device = this->_device] {
+			return this->startCapture(this->_switcher.active(), device);
+		});
 		return true;
 	}
 
 	void deactivate() noexcept  override {
-		if (!this->_client) {
-			return;
-		}
-		this->_client->Stop();
-		this->_client = nullptr;
-		if (this->_captureEvent) {
-			// Signal the capture thread to exit.
-			SetEvent(this->_captureEvent);
-			this->_captureThread.join();
-			this->_captureEvent = nullptr;
-		}
-		this->_capture = nullptr;
+		this->_opener.stop();
+		this->_switcher.stop();
 	}
 
 	clap_process_status process(const clap_process *process) noexcept override {
-		if (!this->_capture) {
-			return CLAP_PROCESS_SLEEP;
+		RtScope rtScope;
+		MeterScope meterScope(this->_meter, process, false);
+		bool checkedTransport = false;
+		if (this->_offline.isOffline()) {
+			// The transport doesn't change while we wait, so check it once rather
+			// than every time we poll. If the stream isn't open yet, we check it
+			// below once it is.
+			if (this->_opener.isReady()) {
+				if (!this->_switcher.checkTransport(this->_host.host(), process,
+						this->_transport)) {
+					outputSilence(process);
+					return CLAP_PROCESS_CONTINUE;
+				}
+				checkedTransport = true;
+			}
+			if (!this->_offline.waitUntil(this->_host.host(),
+				"In2Clap: the captured audio didn't arrive in time for the offline render, so silence was rendered instead.",
+				[this, process] {
+					return this->_opener.isReady() &&
+						this->_switcher.active().hasAudio(process->frames_count);
+				}
+			)) {
+				outputSilence(process);
+				return CLAP_PROCESS_CONTINUE;
+			}
 		}
-		if (!this->_captureEvent) {
-			// We aren't using a background thread to capture audio, so capture here.
-			// There might be multiple packets ready to capture.
-			while (this->_buffer.size() < process->frames_count && this->_doCapture()) {}
+		if (!this->_opener.isReady()) {
+			outputSilence(process);
+			return CLAP_PROCESS_SLEEP;
 		}
-		dbg(
-			"process: frames_count " << process->frames_count <<
-			" buffer size " << this->_buffer.size()
-		);
-		if (this->_buffer.size() < process->frames_count) {
+		if (!checkedTransport && !this->_switcher.checkTransport(
+				this->_host.host(), process, this->_transport)) {
+			outputSilence(process);
+			// Don't sleep, since we need to be called to find out when the transport
+			// starts.
 			return CLAP_PROCESS_CONTINUE;
 		}
-		for (uint32_t f = 0; f < process->frames_count; ++f) {
-			std::tie(
-				process->audio_outputs[0].data32[0][f],
-				process->audio_outputs[0].data32[1][f]
-			) = this->_buffer.front();
-			this->_buffer.pop_front();
+		this->_switcher.read(process);
+		// The switcher measured the level while it delivered the audio.
+		meterScope.measured(this->_meter.add(this->_switcher.levels(),
+			process->frames_count));
+		if (this->_switcher.active().isLost() && this->_opener.abandon()) {
+			// Recovering needs to happen on the main thread.
+			this->_host.host()->request_callback(this->_host.host());
 		}
 		return CLAP_PROCESS_CONTINUE;
 	}
 
+	bool implementsParams() const noexcept override { return true; }
+
+	uint32_t paramsCount() const noexcept override {
+		return LEVEL_PARAMS_COUNT;
+	}
+
+	bool paramsInfo(uint32_t paramIndex, clap_param_info* info) const noexcept override {
+		return levelParamInfo(paramIndex, info);
+	}
+
+	bool paramsValue(clap_id paramId, double* value) noexcept override {
+		return levelParamValue(this->_meter.read(), paramId, value);
+	}
+
+	bool paramsValueToText(clap_id paramId, double value, char* display, uint32_t size) noexcept override {
+		return levelParamToText(paramId, value, display, size);
+	}
+
+	void paramsFlush(const clap_input_events* in, const clap_output_events* out) noexcept override {
+		// Our parameters are read-only, so there's nothing to apply.
+	}
+
+	bool implementsRender() const noexcept override { return true; }
+
+	bool renderHasHardRealtimeRequirement() noexcept override {
+		// We can only capture audio in real time.
+		return true;
+	}
+
+	bool renderSetMode(clap_plugin_render_mode mode) noexcept override {
+		// The host might render offline anyway. We handle that in process().
+		this->_offline.setMode(mode);
+		return true;
+	}
+
+	void onMainThread() noexcept override {
+		if (this->_opener.checkFailed()) {
+			// Don't leave the Capture button pressed when we aren't capturing.
+			this->_capturing = false;
+			if (this->_dialog) {
+				CheckDlgButton(this->_dialog, ID_CAPTURE, BST_UNCHECKED);
+			}
+			this->_switcher.stop();
+		} else if (this->_opener.checkLost()) {
+			// The device was unplugged, disabled or changed format. Keep trying to
+			// open it again in the background until it comes back. We output silence
+			// until then.
+			++this->_recoveries;
+			this->_opener.start(this->_host.host(), [this, device = this->_device] {
+				CaptureStream& stream = this->_switcher.active();
+				stream.stop();
+				// The device might come back with a different buffer size.
+				EndpointCache::get().remove(device);
+				return this->startCapture(stream, device);
+			}, true);
+		}
+		// This also finishes a switch, so it must be called even if the active
+		// stream failed or was lost.
+		if (this->_switcher.checkFailed()) {
+			// We couldn't switch to the new device. Restart so that activate() tries
+			// again and reports the failure if it still can't.
+			this->_host.host()->request_restart(this->_host.host());
+		}
+		if (this->_opener.isReady()) {
+			// The transport might have stopped or started.
+			this->_switcher.applyTransport();
+		}
+	}
+
+	// The number of times we've recovered from losing the stream since we were
+	// created.
+	uint64_t recoveryCount() const {
+		return this->_recoveries;
+	}
+
 	bool implementsGui() const noexcept override { return true; }
 
 	bool guiIsApiSupported(const char* api, bool isFloating) noexcept override {
@@ -130,6 +222,7 @@ class In2Clap : public BasePlugin {
 	}
 
 	void guiDestroy() noexcept override {
+		DeviceRegistry::get().removeListener(this->_dialog);
 		DestroyWindow(this->_dialog);
 		this->_dialog = this->_deviceCombo = nullptr;
 	}
@@ -151,10 +244,27 @@ class In2Clap : public BasePlugin {
 		SetWindowLongPtr(this->_dialog, GWLP_USERDATA, (LONG_PTR)this);
 		this->_deviceCombo = GetDlgItem(this->_dialog, ID_DEVICE);
 		this->buildDeviceList();
+		DeviceRegistry::get().addListener(this->_dialog);
 		// The GUI can be closed and reopened while we're capturing.
 		CheckDlgButton(this->_dialog, ID_CAPTURE,
 			this->_capturing ? BST_CHECKED : BST_UNCHECKED);
-		this->updateControls();
+		CheckDlgButton(this->_dialog, ID_RECORD,
+			this->_switcher.recorder().isRecording() ? BST_CHECKED : BST_UNCHECKED);
+		showHistorySettings(this->_dialog, this->_history);
+		showSpillMode(this->_dialog, this->_spillMode);
+		CheckDlgButton(this->_dialog, ID_OFFLINE_WAIT,
+			this->_offline.shouldWait() ? BST_CHECKED : BST_UNCHECKED);
+		CheckDlgButton(this->_dialog, ID_TRANSPORT_STOP,
+			this->_transport.isEnabled() ? BST_CHECKED : BST_UNCHECKED);
+		// Another instance might have been chosen while the GUI was closed.
+		CheckDlgButton(this->_dialog, ID_LATENCY_RECORDER,
+			this->_switcher.measuresLatency() ? BST_CHECKED : BST_UNCHECKED);
+		CheckDlgButton(this->_dialog, ID_LOW_LATENCY,
+			this->_lowLatency ? BST_CHECKED : BST_UNCHECKED);
+		showCaptureStatus(this->_dialog, this->_capturing, this->_opener,
+			this->_switcher, this->_offline, this->recoveryCount());
+		showLevels(this->_dialog, this->_meter, this->_capturing);
+		SetTimer(this->_dialog, STATUS_TIMER, 250, nullptr);
 		return true;
 	}
 
@@ -166,29 +276,67 @@ class In2Clap : public BasePlugin {
 		stream->write(stream, &nBytes, sizeof(size_t));
 		const wchar_t* device = this->_device.c_str();
 		stream->write(stream, device, nBytes);
+		stream->write(stream, &this->_history.minutes, sizeof(uint32_t));
+		stream->write(stream, &this->_history.pack16, sizeof(bool));
+		const SpillMode spill = this->_spillMode;
+		stream->write(stream, &spill, sizeof(SpillMode));
+		const bool offlineWait = this->_offline.shouldWait();
+		stream->write(stream, &offlineWait, sizeof(bool));
+		const bool transportStop = this->_transport.isEnabled();
+		stream->write(stream, &transportStop, sizeof(bool));
+		const bool lowLatency = this->_lowLatency;
+		stream->write(stream, &lowLatency, sizeof(bool));
 		return true;
 	}
 
 	bool stateLoad(const clap_istream* stream) noexcept override {
 		uint32_t version = 0;
 		stream->read(stream, &version, sizeof(uint32_t));
-		if (version != STATE_VERSION) {
+		// Version 2 added the history settings, version 3 added the spill mode,
+		// version 4 added the offline setting, version 5 added the transport
+		// setting and version 6 added low latency mode.
+		if (version < 1 || version > STATE_VERSION) {
 			return false;
 		}
 		size_t nBytes = 0;
 		stream->read(stream, &nBytes, sizeof(size_t));
+		if (nBytes > 0) {
+			const size_t nChars = nBytes / sizeof(wchar_t);
+			auto device = std::make_unique<wchar_t[]>(nChars);
+			stream->read(stream, device.get(), nBytes);
+			this->_device = std::wstring(device.get(), nChars);
+		}
+		if (version >= 2) {
+			stream->read(stream, &this->_history.minutes, sizeof(uint32_t));
+			stream->read(stream, &this->_history.pack16, sizeof(bool));
+		}
+		if (version >= 3) {
+			SpillMode spill = SpillMode::Off;
+			stream->read(stream, &spill, sizeof(SpillMode));
+			this->_spillMode = std::min(spill, SpillMode::CatchUp);
+		}
+		if (version >= 4) {
+			bool offlineWait = true;
+			stream->read(stream, &offlineWait, sizeof(bool));
+			this->_offline.setWait(offlineWait);
+		}
+		if (version >= 5) {
+			bool transportStop = false;
+			stream->read(stream, &transportStop, sizeof(bool));
+			this->_transport.setEnabled(transportStop);
+		}
+		if (version >= 6) {
+			bool lowLatency = false;
+			stream->read(stream, &lowLatency, sizeof(bool));
+			this->_lowLatency = lowLatency;
+		}
 		if (nBytes == 0) {
 			return true;
 		}
-		const size_t nChars = nBytes / sizeof(wchar_t);
-		auto device = std::make_unique<wchar_t[]>(nChars);
-		stream->read(stream, device.get(), nBytes);
-		this->_device = std::wstring(device.get(), nChars);
 		// We only save a device once the user has pressed Capture, so behave as if they
 		// pressed it.
 		this->_capturing = true;
-		// Restart the plugin. We will set up the send in activate().
-		this->_host.host()->request_restart(this->_host.host());
+		this->applySource();
 		return true;
 	}
 
@@ -198,8 +346,81 @@ class In2Clap : public BasePlugin {
 			return TRUE;
 		}
 		auto* plugin = (In2Clap*)GetWindowLongPtr(dialogHwnd, GWLP_USERDATA);
+		if (msg == WM_DEVICES_CHANGED) {
+			plugin->buildDeviceList();
+			return TRUE;
+		}
+		if (msg == WM_TIMER && wParam == STATUS_TIMER) {
+			showCaptureStatus(dialogHwnd, plugin->_capturing, plugin->_opener,
+				plugin->_switcher, plugin->_offline, plugin->recoveryCount());
+			showLevels(dialogHwnd, plugin->_meter, plugin->_capturing);
+			return TRUE;
+		}
 		if (msg == WM_COMMAND) {
 			const WORD cid = LOWORD(wParam);
+			if (cid == ID_DEVICE && HIWORD(wParam) == CBN_SELCHANGE) {
+				const int choice = ComboBox_GetCurSel(plugin->_deviceCombo);
+				if (plugin->_capturing && choice != CB_ERR) {
+					const std::wstring& device = (*plugin->_devices)[choice].id;
+					if (device != plugin->_device) {
+						plugin->_device = device;
+						plugin->applySource();
+					}
+				}
+				return TRUE;
+			}
+			if (cid == ID_RESET_COUNTERS) {
+				plugin->_switcher.post(CaptureCommand::ResetCounters);
+				return TRUE;
+			}
+			if (cid == ID_RECORD) {
+				toggleRecording(dialogHwnd, plugin->_switcher);
+				return TRUE;
+			}
+			if (cid == ID_OFFLINE_WAIT) {
+				plugin->_offline.setWait(IsDlgButtonChecked(dialogHwnd,
+					ID_OFFLINE_WAIT));
+				return TRUE;
+			}
+			if (cid == ID_LATENCY_RECORDER) {
+				plugin->_switcher.setMeasuresLatency(IsDlgButtonChecked(dialogHwnd,
+					ID_LATENCY_RECORDER));
+				return TRUE;
+			}
+			if (cid == ID_TRANSPORT_STOP) {
+				plugin->_transport.setEnabled(IsDlgButtonChecked(dialogHwnd,
+					ID_TRANSPORT_STOP));
+				return TRUE;
+			}
+			if (cid == ID_LOW_LATENCY) {
+				plugin->_lowLatency = IsDlgButtonChecked(dialogHwnd, ID_LOW_LATENCY);
+				// This only applies to streams we open from now on.
+				if (plugin->_capturing) {
+					plugin->_host.host()->request_restart(plugin->_host.host());
+				}
+				return TRUE;
+			}
+			if (cid == ID_SPILL && HIWORD(wParam) == CBN_SELCHANGE) {
+				plugin->_spillMode = readSpillMode(dialogHwnd);
+				// This only applies to streams we open from now on.
+				if (plugin->_capturing) {
+					plugin->_host.host()->request_restart(plugin->_host.host());
+				}
+				return TRUE;
+			}
+			if (cid == ID_SAVE_HISTORY) {
+				saveHistory(dialogHwnd, plugin->_switcher.history(),
+					plugin->_sampleRate);
+				return TRUE;
+			}
+			if (readHistorySettings(dialogHwnd, cid, HIWORD(wParam),
+					plugin->_history)) {
+				// The history is allocated in activate().
+				if (plugin->_capturing) {
+					plugin->_host.host()->request_restart(plugin->_host.host());
+				}
+				return TRUE;
+			}
 			if (cid == ID_CAPTURE) {
 				plugin->_capturing = IsDlgButtonChecked(dialogHwnd, ID_CAPTURE);
 				if (plugin->_capturing) {
@@ -210,9 +431,8 @@ class In2Clap : public BasePlugin {
 						CheckDlgButton(dialogHwnd, ID_CAPTURE, BST_UNCHECKED);
 						return TRUE;
 					}
-					plugin->_device = plugin->_devices[choice];
+					plugin->_device = (*plugin->_devices)[choice].id;
 				}
-				plugin->updateControls();
 				// Restart the plugin. We will start or stop the capture in activate().
 				plugin->_host.host()->request_restart(plugin->_host.host());
 				return TRUE;
@@ -221,33 +441,51 @@ class In2Clap : public BasePlugin {
 		return FALSE;
 	}
 
-	// Update which controls are enabled. The device can only be chosen when we
-	// aren't capturing.
-	void updateControls() {
-		if (!this->_dialog) {
+	// Start capturing with the current settings. If we're already capturing, we
+	// switch to the new device without interrupting the audio. Otherwise, we
+	// restart the plug-in and the capture is started in activate().
+	void applySource() {
+		if (this->_capturing && this->_opener.isReady()) {
+			this->_switcher.switchTo(this->_host.host(),
+				[this, device = this->_device] (CaptureStream& stream) {
+					return this->startCapture(stream, device);
+				}
+			);
 			return;
 		}
-		EnableWindow(this->_deviceCombo, !this->_capturing);
+		this->_host.host()->request_restart(this->_host.host());
 	}
 
-	bool startCapture(double sampleRate, uint32_t maxFrameCount) {
-		if (this->_device.empty()) {
+	// Called in a background thread by StreamOpener to start capturing device on
+	// stream. The device is passed in rather than read from _device because the
+	// user can change that while we're opening.
+	bool startCapture(CaptureStream& stream, const std::wstring& deviceId) {
+		if (deviceId.empty()) {
 			return false;
 		}
+		const double sampleRate = this->_sampleRate;
+		const uint32_t maxFrameCount = this->_maxFrameCount;
+		const SpillMode spill = this->_spillMode;
+		const bool lowLatency = this->_lowLatency;
 		CComPtr<IMMDeviceEnumerator> enumerator;
 		HRESULT hr = enumerator.CoCreateInstance(__uuidof(MMDeviceEnumerator));
 		if (FAILED(hr)) {
 			return false;
 		}
 		CComPtr<IMMDevice> device;
-		hr = enumerator->GetDevice(this->_device.c_str(), &device);
-		if (FAILED(hr)) {
-			return false;
-		}
-		hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, (void**)&this->_client);
+		hr = enumerator->GetDevice(deviceId.c_str(), &device);
 		if (FAILED(hr)) {
 			return false;
 		}
+		auto activate = [&device] () -> CComPtr<IAudioClient> {
+			CComPtr<IAudioClient> client;
+			HRESULT hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL,
+				nullptr, (void**)&client);
+			if (FAILED(hr)) {
+				return nullptr;
+			}
+			return client;
+		};
 		WAVEFORMATEX format = {
 			.wFormatTag = WAVE_FORMAT_IEEE_FLOAT,
 			.nChannels = NUM_CHANNELS,
@@ -259,39 +497,78 @@ class In2Clap : public BasePlugin {
 		// IAudioClient::Initialize respects the buffer size during initialisation.
 		// However, when capturing, it can return a much smaller buffer, so there's
 		// no point in requesting a particular buffer size.
-		hr = this->_client->Initialize(
-			AUDCLNT_SHAREMODE_SHARED,
-			AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
-			0, 0, &format, nullptr
-		);
-		if (FAILED(hr)) {
-			return false;
+		constexpr DWORD flags = AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+			AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+		if (lowLatency) {
+			// A small period means a small device buffer, so we always capture in a
+			// background thread, which wakes once per period.
+			uint32_t periodFrames = 0;
+			CComPtr<IAudioClient> client = initializeSharedClient(activate, format,
+				flags | AUDCLNT_STREAMFLAGS_EVENTCALLBACK, 0, true, 0, periodFrames);
+			if (!client) {
+				return false;
+			}
+			UINT32 bufferFrames;
+			hr = client->GetBufferSize(&bufferFrames);
+			if (FAILED(hr)) {
+				return false;
+			}
+			dbg(
+				"activate: maxFrameCount " << maxFrameCount <<
+				" sampleRate " << sampleRate <<
+				" periodFrames " << periodFrames <<
+				" bufferSize " << bufferFrames
+			);
+			// Hold enough for whichever is larger of the host's blocks and the
+			// device's buffer.
+			return stream.start(client, sampleRate,
+				std::max<size_t>(std::max(periodFrames, bufferFrames),
+					maxFrameCount) * 2, true, spill);
 		}
-		UINT32 bufferSize = 0;
-		this->_client->GetBufferSize(&bufferSize);
-		if (FAILED(hr)) {
+		CComPtr<IAudioClient> client = activate();
+		if (!client) {
 			return false;
 		}
-		AutoHandle event;
-		if (bufferSize < maxFrameCount) {
-			// The host max frame count is larger than the device buffer. Capture audio
-			// in a background thread to avoid continual buffer underruns. Note that the
-			// thread is less optimal when the host max frame count is lower.
-			hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, (void**)&this->_client);
+		EndpointCaps caps;
+		EndpointCache::Probe probe;
+		const bool cached = EndpointCache::get().find(deviceId,
+			format.nSamplesPerSec, caps, probe);
+		if (!cached) {
+			// We need to know the buffer size to decide how to initialise the stream,
+			// but we can only get it by initialising a client. This only happens the
+			// first time we capture from this device at this sample rate.
+			client->GetDevicePeriod(&caps.defaultPeriod, &caps.minimumPeriod);
+			hr = client->Initialize(AUDCLNT_SHAREMODE_SHARED, flags, 0, 0, &format,
+				nullptr);
 			if (FAILED(hr)) {
 				return false;
 			}
-			hr = this->_client->Initialize(
-				AUDCLNT_SHAREMODE_SHARED,
-				AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
-				AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
-				0, 0, &format, nullptr
-			);
+			hr = client->GetBufferSize(&caps.bufferFrames);
 			if (FAILED(hr)) {
 				return false;
 			}
-			event = CreateEvent(nullptr, false, false, nullptr);
-			hr = this->_client->SetEventHandle(event);
+			EndpointCache::get().add(deviceId, format.nSamplesPerSec, caps);
+		}
+		// If the host max frame count is larger than the device buffer, capture
+		// audio in a background thread to avoid continual buffer underruns. Note
+		// that the thread is less optimal when the host max frame count is lower.
+		// Spilling also needs the thread, since it must keep capturing while the
+		// host isn't calling us.
+		const bool threaded = caps.bufferFrames < maxFrameCount ||
+			spill != SpillMode::Off;
+		if (cached || threaded) {
+			if (!cached) {
+				// The client we used to probe was initialised without events.
+				client = activate();
+				if (!client) {
+					return false;
+				}
+			}
+			hr = client->Initialize(
+				AUDCLNT_SHAREMODE_SHARED,
+				flags | (threaded ? AUDCLNT_STREAMFLAGS_EVENTCALLBACK : 0),
+				0, 0, &format, nullptr
+			);
 			if (FAILED(hr)) {
 				return false;
 			}
@@ -299,127 +576,56 @@ class In2Clap : public BasePlugin {
 		dbg(
 			"activate: maxFrameCount " << maxFrameCount <<
 			" sampleRate " << sampleRate <<
-			" received bufferSize " << bufferSize <<
-			" threaded " << (bool)event
+			" bufferSize " << caps.bufferFrames <<
+			" cached " << cached <<
+			" threaded " << threaded
 		);
-		hr = this->_client->GetService(__uuidof(IAudioCaptureClient), (void**)&this->_capture);
-		if (FAILED(hr)) {
-			return false;
-		}
-		this->_buffer = Buffer(std::max(bufferSize, maxFrameCount) * 2);
-		if (event) {
-			this->_captureEvent =std::move(event);
-			this->_captureThread = std::thread([this] {
-				this->_captureThreadFunc();
-			});
-		}
-		this->_client->Start();
-		return true;
+		return stream.start(client, sampleRate,
+			std::max(caps.bufferFrames, maxFrameCount) * 2, threaded, spill);
 	}
 
 	void buildDeviceList() {
-		this->_devices.clear();
-		ComboBox_ResetContent(this->_deviceCombo);
-		CComPtr<IMMDeviceEnumerator> enumerator;
-		HRESULT hr = enumerator.CoCreateInstance(__uuidof(MMDeviceEnumerator));
-		if (FAILED(hr)) {
-			return;
+		// Keep whatever the user has selected, even if they haven't pressed Capture
+		// yet.
+		std::wstring chosenDevice = this->_device;
+		const int choice = ComboBox_GetCurSel(this->_deviceCombo);
+		if (choice != CB_ERR) {
+			chosenDevice = (*this->_devices)[choice].id;
 		}
-		CComPtr<IMMDeviceCollection> devices;
-		hr = enumerator->EnumAudioEndpoints(eCapture, DEVICE_STATE_ACTIVE, &devices);
-		if (FAILED(hr)) {
-			return;
-		}
-		UINT count = 0;
-		devices->GetCount(&count);
-		for (UINT d = 0; d < count; ++d) {
-			CComPtr<IMMDevice> device;
-			hr = devices->Item(d, &device);
-			if (FAILED(hr)) {
-				continue;
-			}
-			wchar_t* id;
-			hr = device->GetId(&id);
-			if (FAILED(hr)) {
-				continue;
-			}
-			this->_devices.push_back(id);
-			const bool selected = this->_device == id;
-			CoTaskMemFree(id);
-			CComPtr<IPropertyStore> props;
-			hr = device->OpenPropertyStore(STGM_READ, &props);
-			if (FAILED(hr)) {
-				return;
-			}
-			PROPVARIANT val;
-			hr = props->GetValue(PKEY_Device_FriendlyName, &val);
-			if (FAILED(hr)) {
-				return;
-			}
-			ComboBox_AddString(this->_deviceCombo, val.pwszVal);
-			if (selected) {
+		ComboBox_ResetContent(this->_deviceCombo);
+		this->_devices = DeviceRegistry::get().snapshot(eCapture);
+		for (const AudioDevice& device : *this->_devices) {
+			ComboBox_AddString(this->_deviceCombo, device.name.c_str());
+			if (device.id == chosenDevice) {
 				// Select the previously chosen device.
-				ComboBox_SetCurSel(this->_deviceCombo, this->_devices.size() - 1);
-			}
-		}
-	}
-
-	bool _doCapture() {
-		UINT32 numFrames; // The number of captured frames.
-		// GetNextPacketSize and GetBuffer should return the same number of frames.
-		// The documentation doesn't say that GetNextPacketSize is required.
-		// However, if you don't call it first and there is no packet to retrieve,
-		// GetBuffer succeeds even though it returns a packet with bogus data.
-		HRESULT hr = this->_capture->GetNextPacketSize(&numFrames);
-		if (FAILED(hr)) {
-			return false;
-		}
-		if (numFrames == 0) {
-			return false;
-		}
-		DWORD flags;
-		BYTE* data;
-		hr = this->_capture->GetBuffer(&data, &numFrames, &flags, nullptr, nullptr);
-		if (FAILED(hr) || numFrames == 0) {
-			return false;
-		}
-		dbg("_doCapture: captured " << numFrames << " frames");
-		for (UINT32 f = 0; f < numFrames; ++f) {
-			std::pair<float, float> frame;
-			memcpy(&frame, data, BYTES_PER_FRAME);
-			this->_buffer.push_back(frame);
-			data += BYTES_PER_FRAME;
-		}
-		this->_capture->ReleaseBuffer(numFrames);
-		return true;
-	}
-
-	void _captureThreadFunc() {
-		for (; ;) {
-			WaitForSingleObject(this->_captureEvent, INFINITE);
-			if (!this->_client) {
-				return;
+				ComboBox_SetCurSel(this->_deviceCombo,
+					ComboBox_GetCount(this->_deviceCombo) - 1);
 			}
-			this->_doCapture();
-			dbg("thread: size after capture " << this->_buffer.size());
 		}
 	}
 
-	CComPtr<IAudioClient> _client;
-	CComPtr<IAudioCaptureClient> _capture;
-	// A buffer to store audio we've captured but not yet sent to the host.
-	using Buffer = CircularBuffer<std::pair<float, float>>;
-	Buffer _buffer{0};
+	StreamOpener _opener;
+	CaptureSwitcher _switcher;
+	double _sampleRate = 0;
+	uint32_t _maxFrameCount = 0;
+	uint64_t _recoveries = 0;
+	HistorySettings _history;
+	// This is read by the threads which open streams.
+	std::atomic<SpillMode> _spillMode = SpillMode::Off;
+	// Whether to use the smallest engine period the device supports. This is
+	// read by the threads which open streams.
+	std::atomic<bool> _lowLatency = false;
+	OfflineRender _offline;
+	LevelMeter _meter;
+	TransportIdle _transport;
 	HWND _dialog = nullptr;
 	HWND _deviceCombo = nullptr;
 	// The devices we have found.
-	std::vector<std::wstring> _devices;
+	std::shared_ptr<const DeviceList> _devices;
 	// The chosen device.
 	std::wstring _device;
 	// Whether the user has pressed Capture; i.e. whether we should be capturing.
 	bool _capturing = false;
-	std::thread _captureThread;
-	AutoHandle _captureEvent;
 };
 
 extern const clap_plugin_descriptor in2ClapDescriptor = {
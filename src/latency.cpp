@@ -0,0 +1,162 @@
+/*
+ * App2Clap
+ * Round trip latency measurement
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "correlation.h"
+#include "rtMemory.h"
+
+// The order of the maximum length sequence we play. 2^14 - 1 samples is about a
+// third of a second at 48 kHz.
+constexpr unsigned int MLS_ORDER = 14;
+constexpr float MLS_LEVEL = 0.5f;
+// The longest round trip latency we can measure.
+constexpr double MAX_LATENCY_SECS = 2;
+
+LatencyMeasurement& LatencyMeasurement::get() {
+	static LatencyMeasurement measurement;
+	return measurement;
+}
+
+bool LatencyMeasurement::start(const void* player, double sampleRate) {
+	if (this->_state == State::Playing || this->_state == State::Recorded) {
+		return false;
+	}
+	// We're not playing, so audio threads won't enter the scope. Wait for any
+	// which were already in it to leave.
+	while (this->_audioThreads > 0) {
+		std::this_thread::yield();
+	}
+	this->_signal = generateMls(MLS_ORDER);
+	for (float& sample : this->_signal) {
+		sample *= MLS_LEVEL;
+	}
+	this->_recording.assign(
+		this->_signal.size() + (size_t)(sampleRate * MAX_LATENCY_SECS), 0.0f);
+	// Audio threads play and record these.
+	prepareRtMemory(this->_signal);
+	prepareRtMemory(this->_recording);
+	this->_player = player;
+	this->_recorder = nullptr;
+	this->_played = 0;
+	this->_recorded = 0;
+	this->_playStarted = false;
+	this->_sampleRate = sampleRate;
+	this->_startTime = std::chrono::steady_clock::now();
+	// Allow plenty of time beyond the recording itself for the host to start
+	// processing.
+	this->_timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(this->_recording.size() / sampleRate + 5));
+	this->_state = State::Playing;
+	return true;
+}
+
+LatencyMeasurement::State LatencyMeasurement::poll() {
+	const State state = this->_state;
+	if (state == State::Playing) {
+		if (std::chrono::steady_clock::now() - this->_startTime > this->_timeout) {
+			// Nothing captured the test signal.
+			this->_state = State::Failed;
+			return State::Failed;
+		}
+		return state;
+	}
+	if (state != State::Recorded) {
+		return state;
+	}
+	CrossCorrelator correlator(this->_signal.size(), this->_recording.size());
+	const CorrelationResult correlation = correlator.find(this->_signal.data(),
+		this->_recording.data());
+	if (correlation.peakRatio < MIN_PEAK_RATIO) {
+		this->_state = State::Failed;
+		return State::Failed;
+	}
+	this->_result = correlation.delay;
+	// The recorder might have started some host blocks after the player. The
+	// host processes each plug-in once per block, but when each runs within the
+	// block varies, so round the difference to whole blocks.
+	if (this->_recordBlockFrames > 0) {
+		const double startSecs = std::chrono::duration<double>(
+			this->_recordStart - this->_playStart).count();
+		this->_result += std::llround(startSecs * this->_sampleRate /
+			this->_recordBlockFrames) * this->_recordBlockFrames;
+	}
+	this->_state = State::Done;
+	return State::Done;
+}
+
+LatencyMeasurement::AudioThreadScope::AudioThreadScope(
+	LatencyMeasurement& measurement
+): _measurement(measurement) {
+	++measurement._audioThreads;
+	this->_playing = measurement._state == State::Playing;
+}
+
+LatencyMeasurement::AudioThreadScope::~AudioThreadScope() {
+	--this->_measurement._audioThreads;
+}
+
+bool LatencyMeasurement::play(const void* player, float* data,
+	uint32_t channels, uint32_t frames
+) {
+	AudioThreadScope scope(*this);
+	if (!scope.isPlaying() || player != this->_player) {
+		return false;
+	}
+	if (!this->_playStarted) {
+		this->_playStart = std::chrono::steady_clock::now();
+		this->_playStarted = true;
+	}
+	for (uint32_t f = 0; f < frames; ++f) {
+		// Play silence once the signal is done so we don't pick up anything else
+		// while we're recording.
+		const float sample = this->_played < this->_signal.size() ?
+			this->_signal[this->_played++] : 0.0f;
+		std::fill_n(data, channels, sample);
+		data += channels;
+	}
+	return true;
+}
+
+void LatencyMeasurement::record(const void* recorder, const float* left,
+	const float* right, uint32_t frames
+) {
+	AudioThreadScope scope(*this);
+	if (!scope.isPlaying() || !this->_playStarted) {
+		return;
+	}
+	const void* chosen = this->_chosenRecorder.load(std::memory_order_relaxed);
+	if (chosen && chosen != recorder) {
+		return;
+	}
+	const void* expected = nullptr;
+	if (this->_recorder.compare_exchange_strong(expected, recorder)) {
+		this->_recordStart = std::chrono::steady_clock::now();
+		this->_recordBlockFrames = frames;
+	} else if (expected != recorder) {
+		// Another instance is already recording.
+		return;
+	}
+	const size_t count = std::min<size_t>(frames,
+		this->_recording.size() - this->_recorded);
+	if (!left) {
+		std::fill_n(this->_recording.begin() + this->_recorded, count, 0.0f);
+		this->_recorded += count;
+	} else {
+		for (size_t f = 0; f < count; ++f) {
+			this->_recording[this->_recorded++] = (left[f] + right[f]) * 0.5f;
+		}
+	}
+	if (this->_recorded == this->_recording.size()) {
+		this->_state = State::Recorded;
+	}
+}
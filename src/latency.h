@@ -0,0 +1,124 @@
+/*
+ * App2Clap
+ * Header for round trip latency measurement
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Measures round trip latency by having a sending plug-in (the player) play a
+// test signal while a capturing plug-in (the recorder) records the return path.
+// The delay is then found using cross-correlation. There is only one
+// measurement per process, shared by all plug-in instances.
+class LatencyMeasurement {
+	public:
+	enum class State {
+		Idle,
+		Playing,
+		Recorded,
+		Done,
+		Failed,
+	};
+
+	static LatencyMeasurement& get();
+
+	// Start a measurement. player identifies the instance which will play the
+	// test signal. Returns false if a measurement is already in progress. This
+	// must be called from the main thread.
+	bool start(const void* player, double sampleRate);
+
+	// Check on the measurement, analysing the recording if it is complete. This
+	// must be called from the main thread.
+	State poll();
+
+	// Whether a measurement is in progress. Plug-ins must keep their streams
+	// running while it is, even if the host's transport is stopped.
+	bool isActive() const {
+		const State state = this->_state.load(std::memory_order_relaxed);
+		return state == State::Playing || state == State::Recorded;
+	}
+
+	// The measured round trip latency in samples. Only valid once poll() returns
+	// State::Done.
+	int64_t result() const {
+		return this->_result;
+	}
+
+	// Called by the player from its audio thread to write the test signal to an
+	// interleaved buffer. Returns false if the player isn't measuring, in which
+	// case it should output its normal audio.
+	bool play(const void* player, float* data, uint32_t channels,
+		uint32_t frames);
+
+	// Called by capturing plug-ins from their audio threads with the audio they
+	// are about to deliver to the host. If left and right are null, the plug-in
+	// had no audio to deliver, so silence is recorded to keep the recording in
+	// time. If a recorder was chosen with chooseRecorder(), only it records.
+	// Otherwise, the first to call this once the test signal has started becomes
+	// the recorder.
+	void record(const void* recorder, const float* left, const float* right,
+		uint32_t frames);
+
+	// Record the return path from recorder in future measurements, rather than
+	// from whichever capturing plug-in gets the test signal first. Passing null
+	// goes back to that. This must be called from the main thread.
+	void chooseRecorder(const void* recorder) {
+		this->_chosenRecorder.store(recorder, std::memory_order_relaxed);
+	}
+
+	const void* chosenRecorder() const {
+		return this->_chosenRecorder.load(std::memory_order_relaxed);
+	}
+
+	// Stop recording from recorder in future measurements if it was chosen;
+	// e.g. because it is being destroyed. This must be called from the main
+	// thread.
+	void forgetRecorder(const void* recorder) {
+		const void* expected = recorder;
+		this->_chosenRecorder.compare_exchange_strong(expected, nullptr);
+	}
+
+	private:
+	// Used to ensure that audio threads aren't using our buffers when start()
+	// replaces them.
+	class AudioThreadScope {
+		public:
+		AudioThreadScope(LatencyMeasurement& measurement);
+		~AudioThreadScope();
+		bool isPlaying() const {
+			return this->_playing;
+		}
+
+		private:
+		LatencyMeasurement& _measurement;
+		bool _playing;
+	};
+
+	std::atomic<State> _state = State::Idle;
+	std::atomic<int> _audioThreads = 0;
+	const void* _player = nullptr;
+	std::atomic<const void*> _recorder = nullptr;
+	std::atomic<const void*> _chosenRecorder = nullptr;
+	std::vector<float> _signal;
+	std::vector<float> _recording;
+	size_t _played = 0;
+	size_t _recorded = 0;
+	// When the player and recorder processed the blocks in which the signal
+	// started playing and recording. The host's steady time can't be used for
+	// this, since each plug-in instance counts it separately.
+	std::atomic<bool> _playStarted = false;
+	std::chrono::steady_clock::time_point _playStart;
+	std::chrono::steady_clock::time_point _recordStart;
+	uint32_t _recordBlockFrames = 0;
+	double _sampleRate = 0;
+	std::chrono::steady_clock::time_point _startTime;
+	std::chrono::steady_clock::duration _timeout;
+	int64_t _result = 0;
+};
@@ -0,0 +1,118 @@
+/*
+ * App2Clap
+ * Level metering
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "levelMeter.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define LEVEL_METER_SSE2
+#include <emmintrin.h>
+#endif
+
+// How fast peaks fall back, in dB per second.
+constexpr double PEAK_FALL_DB_PER_SEC = 20;
+// The time constant of the RMS average, in seconds.
+constexpr double RMS_SECS = 0.3;
+// How often levels are published, in seconds.
+constexpr double PUBLISH_SECS = 0.05;
+
+float levelToDb(float level) {
+	if (level <= 0.0f) {
+		return MIN_LEVEL_DB;
+	}
+	return std::clamp(20.0f * std::log10(level), MIN_LEVEL_DB, MAX_LEVEL_DB);
+}
+
+void measureSamples(const float* samples, size_t count, float& peak,
+	float& sumSquares
+) {
+	size_t s = 0;
+	float blockPeak = 0.0f;
+	float blockSum = 0.0f;
+#ifdef LEVEL_METER_SSE2
+	// Clearing the sign bit gives the absolute value.
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peaks = _mm_setzero_ps();
+	__m128 sums = _mm_setzero_ps();
+	for (; s + 4 <= count; s += 4) {
+		const __m128 values = _mm_loadu_ps(samples + s);
+		peaks = _mm_max_ps(peaks, _mm_and_ps(values, absMask));
+		sums = _mm_add_ps(sums, _mm_mul_ps(values, values));
+	}
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, peaks);
+	blockPeak = std::max({lanes[0], lanes[1], lanes[2], lanes[3]});
+	_mm_store_ps(lanes, sums);
+	blockSum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+	for (; s < count; ++s) {
+		blockPeak = std::max(blockPeak, std::abs(samples[s]));
+		blockSum += samples[s] * samples[s];
+	}
+	peak = blockPeak;
+	sumSquares = blockSum;
+}
+
+void LevelMeter::configure(double sampleRate) {
+	this->_peakFallPerFrame = -PEAK_FALL_DB_PER_SEC / 20.0 * std::log(10.0) /
+		sampleRate;
+	this->_rmsDecayPerFrame = -1.0 / (RMS_SECS * sampleRate);
+	this->_publishFrames = std::max<size_t>((size_t)(PUBLISH_SECS * sampleRate),
+		1);
+	this->_sincePublish = 0;
+	for (int c = 0; c < 2; ++c) {
+		this->_peak[c] = 0.0f;
+		this->_meanSquare[c] = 0.0;
+	}
+	this->_current = {};
+	this->_published.publish(this->_current);
+}
+
+bool LevelMeter::process(const float* left, const float* right,
+	size_t frames
+) {
+	LevelSums sums;
+	const float* channels[] = {left, right};
+	for (int c = 0; c < 2; ++c) {
+		if (channels[c]) {
+			measureSamples(channels[c], frames, sums.peak[c], sums.sumSquares[c]);
+		}
+	}
+	return this->add(sums, frames);
+}
+
+bool LevelMeter::add(const LevelSums& sums, size_t frames) {
+	if (frames == 0 || this->_publishFrames == 0) {
+		return false;
+	}
+	const float peakFall = (float)std::exp(this->_peakFallPerFrame * frames);
+	const double rmsDecay = std::exp(this->_rmsDecayPerFrame * frames);
+	for (int c = 0; c < 2; ++c) {
+		this->_peak[c] = std::max(sums.peak[c], this->_peak[c] * peakFall);
+		const double meanSquare = sums.sumSquares[c] / frames;
+		this->_meanSquare[c] = meanSquare +
+			(this->_meanSquare[c] - meanSquare) * rmsDecay;
+	}
+	this->_sincePublish += frames;
+	if (this->_sincePublish < this->_publishFrames) {
+		return false;
+	}
+	this->_sincePublish = 0;
+	this->_publish();
+	return true;
+}
+
+void LevelMeter::_publish() {
+	for (int c = 0; c < 2; ++c) {
+		this->_current.peak[c] = this->_peak[c];
+		this->_current.rms[c] = (float)std::sqrt(this->_meanSquare[c]);
+	}
+	this->_published.publish(this->_current);
+}
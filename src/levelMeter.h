@@ -0,0 +1,97 @@
+/*
+ * App2Clap
+ * Header for level metering
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "lockfree.h"
+
+// The lowest level we report in dB. Anything quieter is reported as this.
+constexpr float MIN_LEVEL_DB = -60.0f;
+// The highest level we report in dB. Floating point audio can exceed 0 dBFS.
+constexpr float MAX_LEVEL_DB = 6.0f;
+
+// Peak and RMS levels of stereo audio as linear amplitudes, indexed by
+// channel.
+struct Levels {
+	float peak[2] = {};
+	float rms[2] = {};
+};
+
+// The largest absolute sample and the sum of the squares of the samples in
+// each channel of a block of audio, gathered while the block is produced.
+struct LevelSums {
+	float peak[2] = {};
+	float sumSquares[2] = {};
+
+	// Add the measurements of more frames of the same block.
+	void merge(const LevelSums& other) {
+		for (int c = 0; c < 2; ++c) {
+			this->peak[c] = std::max(this->peak[c], other.peak[c]);
+			this->sumSquares[c] += other.sumSquares[c];
+		}
+	}
+};
+
+// Convert a linear amplitude to dB, clamped to MIN_LEVEL_DB and MAX_LEVEL_DB.
+float levelToDb(float level);
+
+// Find the largest absolute sample and the sum of the squares of count
+// samples. This uses SIMD instructions where they are available.
+void measureSamples(const float* samples, size_t count, float& peak,
+	float& sumSquares);
+
+// Measures the level of the audio a plug-in delivers or sends. The audio
+// thread measures each block right after it is produced, while it is still in
+// the cache, and periodically publishes the levels for the GUI. Peaks fall
+// back slowly so that the GUI doesn't miss them between refreshes and the RMS
+// is averaged over a few hundred milliseconds.
+class LevelMeter {
+	public:
+	// Prepare to measure audio at sampleRate. This must not be called while the
+	// audio thread is measuring.
+	void configure(double sampleRate);
+
+	// Measure frames of planar audio. Null buffers are treated as silence.
+	// Returns true if new levels were published. This must only be called from
+	// one thread at a time; i.e. the audio thread.
+	bool process(const float* left, const float* right, size_t frames);
+
+	// Add a block of frames which has already been measured. This lets a caller
+	// measure while it makes another pass over the audio. Otherwise, this is the
+	// same as process().
+	bool add(const LevelSums& sums, size_t frames);
+
+	// The levels most recently published, for use by the audio thread.
+	const Levels& current() const {
+		return this->_current;
+	}
+
+	// The levels most recently published, for use by the main thread.
+	const Levels& read() {
+		return this->_published.read();
+	}
+
+	private:
+	void _publish();
+
+	// The peaks we're holding as they fall back.
+	float _peak[2] = {};
+	double _meanSquare[2] = {};
+	// The amount the peaks fall back and the RMS smoothing coefficient, per
+	// frame, as natural logarithms.
+	double _peakFallPerFrame = 0;
+	double _rmsDecayPerFrame = 0;
+	size_t _publishFrames = 0;
+	size_t _sincePublish = 0;
+	Levels _current;
+	Snapshot<Levels> _published;
+};
@@ -0,0 +1,96 @@
+/*
+ * App2Clap
+ * Lock-free primitives for communicating with the audio thread
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Keep indices written by different threads on different cache lines so they
+// don't bounce between cores.
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// A bounded queue with a single producer thread and a single consumer thread.
+// Neither side ever blocks or allocates, so either may be the audio thread.
+// Capacity must be a power of 2.
+template<typename T, size_t Capacity>
+class SpscQueue {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+		"Capacity must be a power of 2");
+
+	public:
+	// Called by the producer. Returns false if the queue is full, in which case
+	// the item is dropped.
+	bool push(const T& item) {
+		const size_t tail = this->_tail.load(std::memory_order_relaxed);
+		if (tail - this->_head.load(std::memory_order_acquire) == Capacity) {
+			return false;
+		}
+		this->_items[tail & (Capacity - 1)] = item;
+		this->_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Called by the consumer. Returns false if the queue is empty.
+	bool pop(T& item) {
+		const size_t head = this->_head.load(std::memory_order_relaxed);
+		if (head == this->_tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = this->_items[head & (Capacity - 1)];
+		this->_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	private:
+	// These only ever increase. They are masked to index _items, so they wrap
+	// around correctly when they overflow.
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> _head = 0;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> _tail = 0;
+	std::array<T, Capacity> _items;
+};
+
+// Publishes the latest value of T from a single writer thread to a single
+// reader thread. The writer never waits for the reader and vice versa; the
+// reader simply gets the most recently published value. This is a triple
+// buffer: the writer and reader each own a slot and the third holds the latest
+// published value, which they exchange their slot with.
+template<typename T>
+class Snapshot {
+	public:
+	// Called by the writer.
+	void publish(const T& value) {
+		this->_slots[this->_writeSlot] = value;
+		const uint8_t previous = this->_latest.exchange(
+			this->_writeSlot | FRESH, std::memory_order_acq_rel);
+		this->_writeSlot = previous & SLOT_MASK;
+	}
+
+	// Called by the reader. Returns the most recently published value, or a
+	// default constructed T if nothing has been published yet.
+	const T& read() {
+		if (this->_latest.load(std::memory_order_relaxed) & FRESH) {
+			const uint8_t latest = this->_latest.exchange(this->_readSlot,
+				std::memory_order_acq_rel);
+			this->_readSlot = latest & SLOT_MASK;
+		}
+		return this->_slots[this->_readSlot];
+	}
+
+	private:
+	static constexpr uint8_t SLOT_MASK = 0x3;
+	// Set when the latest slot holds a value the reader hasn't taken yet.
+	static constexpr uint8_t FRESH = 0x4;
+
+	std::array<T, 3> _slots{};
+	uint8_t _writeSlot = 0;
+	std::atomic<uint8_t> _latest = 1;
+	uint8_t _readSlot = 2;
+};
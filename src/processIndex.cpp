@@ -0,0 +1,105 @@
+/*
+ * App2Clap
+ * Process index used by the App2Clap process picker
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "processIndex.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <unordered_set>
+
+std::wstring foldCase(std::wstring s) {
+	for (wchar_t& c : s) {
+		c = (wchar_t)std::towlower(c);
+	}
+	return s;
+}
+
+void ProcessIndex::update(const std::vector<ProcessEntry>& entries,
+	const CreationTimeFunc& getCreationTime
+) {
+	bool changed = false;
+	std::unordered_set<uint32_t> seen;
+	seen.reserve(entries.size());
+	for (const ProcessEntry& entry : entries) {
+		seen.insert(entry.pid);
+		auto it = this->_byPid.find(entry.pid);
+		uint64_t creationTime;
+		if (it != this->_byPid.end()) {
+			Known& known = it->second;
+			const bool sameSnapshot = known.info->parentPid == entry.parentPid &&
+				known.info->exe == entry.exe;
+			if (sameSnapshot && known.threadCount == entry.threadCount) {
+				// We already know about this process.
+				continue;
+			}
+			// Something changed, which might mean the pid was reused. The creation
+			// time tells us for sure. If we can't get it, all we have is the
+			// snapshot.
+			creationTime = getCreationTime(entry.pid);
+			if (creationTime != 0 ? creationTime == known.info->creationTime :
+					sameSnapshot) {
+				known.threadCount = entry.threadCount;
+				continue;
+			}
+		} else {
+			creationTime = getCreationTime(entry.pid);
+		}
+		// This is a new process, or its pid was reused.
+		auto info = std::make_shared<ProcessInfo>();
+		info->pid = entry.pid;
+		info->parentPid = entry.parentPid;
+		info->creationTime = creationTime;
+		info->exe = entry.exe;
+		info->desc = entry.exe + L" " + std::to_wstring(entry.pid);
+		info->key = foldCase(info->desc);
+		this->_byPid[entry.pid] = {std::move(info), entry.threadCount};
+		changed = true;
+	}
+	changed |= std::erase_if(this->_byPid, [&seen](const auto& item) {
+		return !seen.contains(item.first);
+	}) > 0;
+	if (!changed) {
+		return;
+	}
+	this->_sorted.clear();
+	this->_sorted.reserve(this->_byPid.size());
+	for (const auto& [pid, known] : this->_byPid) {
+		this->_sorted.push_back(known.info);
+	}
+	std::sort(this->_sorted.begin(), this->_sorted.end(),
+		[](const auto& a, const auto& b) {
+			if (a->creationTime != b->creationTime) {
+				return a->creationTime < b->creationTime;
+			}
+			return a->pid < b->pid;
+		}
+	);
+}
+
+std::shared_ptr<const ProcessInfo> ProcessIndex::find(uint32_t pid) const {
+	auto it = this->_byPid.find(pid);
+	if (it == this->_byPid.end()) {
+		return nullptr;
+	}
+	return it->second.info;
+}
+
+std::vector<std::shared_ptr<const ProcessInfo>> ProcessIndex::query(
+	const std::wstring& filter
+) const {
+	if (filter.empty()) {
+		return this->_sorted;
+	}
+	std::vector<std::shared_ptr<const ProcessInfo>> matches;
+	for (const auto& info : this->_sorted) {
+		if (info->key.find(filter) != std::wstring::npos) {
+			matches.push_back(info);
+		}
+	}
+	return matches;
+}
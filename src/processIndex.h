@@ -0,0 +1,90 @@
+/*
+ * App2Clap
+ * Header for the process index used by the App2Clap process picker
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+// The caller supplies the process list and a way to query creation times, so
+// the index itself doesn't use Windows.
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A process as listed by a system snapshot. This is cheap to obtain for every
+// process.
+struct ProcessEntry {
+	uint32_t pid;
+	uint32_t parentPid;
+	uint32_t threadCount;
+	std::wstring exe;
+};
+
+// A process we've indexed.
+struct ProcessInfo {
+	uint32_t pid;
+	uint32_t parentPid;
+	// The creation time in arbitrary units which increase with time, or 0 if it
+	// couldn't be retrieved. Together with pid, this identifies a process even if
+	// its pid is reused.
+	uint64_t creationTime;
+	std::wstring exe;
+	// The text shown to the user.
+	std::wstring desc;
+	// desc in lower case, used for filtering.
+	std::wstring key;
+};
+
+// Remembers processes across refreshes so that a refresh only has to do
+// expensive work (such as opening a process to get its creation time) for
+// processes which weren't there last time, and filtering doesn't have to
+// refresh at all.
+class ProcessIndex {
+	public:
+	using CreationTimeFunc = std::function<uint64_t(uint32_t pid)>;
+
+	// Update the index with a new snapshot of all processes. A process is
+	// identified by its pid and creation time. Getting the creation time is
+	// expensive, so getCreationTime is only called for pids we don't know about
+	// and for those whose parent, executable or thread count changed, since
+	// that might mean the pid was reused.
+	void update(const std::vector<ProcessEntry>& entries,
+		const CreationTimeFunc& getCreationTime);
+
+	// Get the processes whose description contains filter, which must be in lower
+	// case. An empty filter matches all processes. Processes are ordered by
+	// creation time so parent processes appear before their children.
+	std::vector<std::shared_ptr<const ProcessInfo>> query(
+		const std::wstring& filter) const;
+
+	// Get the process we know with pid, or null if there isn't one. The process
+	// might have exited since the last update and its pid might have been
+	// reused.
+	std::shared_ptr<const ProcessInfo> find(uint32_t pid) const;
+
+	size_t size() const {
+		return this->_sorted.size();
+	}
+
+	private:
+	struct Known {
+		std::shared_ptr<const ProcessInfo> info;
+		// The thread count from the snapshot which last confirmed this process.
+		uint32_t threadCount;
+	};
+
+	std::unordered_map<uint32_t, Known> _byPid;
+	// All processes ordered by creation time. This is only rebuilt when
+	// processes are added or removed.
+	std::vector<std::shared_ptr<const ProcessInfo>> _sorted;
+};
+
+// Convert s to lower case for case insensitive matching.
+std::wstring foldCase(std::wstring s);
@@ -16,9 +16,30 @@
 #define ID_EVERYTHING 106
 #define ID_FILTER 107
 #define ID_FIRST 108
+// This is also used by Clap2App and In2Clap.
+#define ID_STATUS 109
+#define ID_RESET_COUNTERS 110
+#define ID_SESSIONS_ONLY 111
+#define ID_HISTORY_MINUTES 112
+#define ID_HISTORY_16BIT 113
+#define ID_SAVE_HISTORY 114
+#define ID_RECORD 115
+#define ID_SPILL 116
+// This is also used by Clap2App and In2Clap.
+#define ID_OFFLINE_WAIT 117
+// This is also used by Clap2App and In2Clap.
+#define ID_TRANSPORT_STOP 118
+// This is also used by Clap2App and In2Clap.
+#define ID_LEVELS 119
+// This is also used by In2Clap.
+#define ID_LATENCY_RECORDER 120
 
 #define ID_CLAP2APP_DLG 200
 #define ID_DEVICE 201
 #define ID_SEND 202
+#define ID_MEASURE 203
+#define ID_LATENCY 204
+// This is also used by In2Clap.
+#define ID_LOW_LATENCY 205
 
 #define ID_IN2CLAP_DLG 300
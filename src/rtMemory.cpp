@@ -0,0 +1,120 @@
+/*
+ * App2Clap
+ * Real-time memory helpers
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "rtMemory.h"
+
+#ifdef _WIN32
+// Avoid min macro conflict with std::min.
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static size_t getPageSize() {
+	static const size_t size = [] {
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return (size_t)info.dwPageSize;
+#else
+		return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	}();
+	return size;
+}
+
+#ifdef LOCK_RT_MEMORY
+static void lockMemory(void* data, size_t bytes) {
+#ifdef _WIN32
+	if (VirtualLock(data, bytes) || GetLastError() != ERROR_WORKING_SET_QUOTA) {
+		return;
+	}
+	// A process can only lock as much as its minimum working set, which is small
+	// by default. Grow it by enough for this memory, allowing for the pages at
+	// either end only being partly used.
+	HANDLE process = GetCurrentProcess();
+	SIZE_T minimum, maximum;
+	if (!GetProcessWorkingSetSize(process, &minimum, &maximum)) {
+		return;
+	}
+	minimum += bytes + getPageSize() * 2;
+	maximum = std::max(maximum, minimum);
+	if (SetProcessWorkingSetSize(process, minimum, maximum)) {
+		VirtualLock(data, bytes);
+	}
+#else
+	mlock(data, bytes);
+#endif
+}
+#endif
+
+void prepareRtMemory(void* data, size_t bytes) {
+	if (!data || bytes == 0) {
+		return;
+	}
+	// Write rather than just reading, since reading an untouched page might only
+	// map a shared page of zeroes which faults again on the first write.
+	volatile char* bytePtr = (volatile char*)data;
+	const size_t pageSize = getPageSize();
+	for (size_t offset = 0; offset < bytes; offset += pageSize) {
+		bytePtr[offset] = bytePtr[offset];
+	}
+	bytePtr[bytes - 1] = bytePtr[bytes - 1];
+#ifdef LOCK_RT_MEMORY
+	lockMemory(data, bytes);
+#endif
+}
+
+#ifdef CHECK_RT_ALLOCATIONS
+
+static thread_local int rtScopeDepth = 0;
+
+RtScope::RtScope() {
+	++rtScopeDepth;
+}
+
+RtScope::~RtScope() {
+	--rtScopeDepth;
+}
+
+[[noreturn]] static void reportRtViolation(const char* what) {
+	std::fprintf(stderr, "App2Clap: %s called on a real-time thread\n", what);
+	std::abort();
+}
+
+// The array forms call these by default, so they needn't be replaced.
+
+void* operator new(size_t size) {
+	if (rtScopeDepth > 0) {
+		reportRtViolation("operator new");
+	}
+	if (void* memory = std::malloc(size ? size : 1)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+	if (memory && rtScopeDepth > 0) {
+		reportRtViolation("operator delete");
+	}
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+	operator delete(memory);
+}
+
+#endif
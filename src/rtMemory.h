@@ -0,0 +1,43 @@
+/*
+ * App2Clap
+ * Header for real-time memory helpers
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Touch every page of memory used by the audio or capture threads so that they
+// don't take a page fault the first time they use it. If the build defines
+// LOCK_RT_MEMORY, the pages are also locked into physical memory so that the OS
+// can't page them out later. Locking is best effort; if it fails, the pages are
+// still touched. This must be called before the memory is used by those
+// threads; e.g. when activating.
+void prepareRtMemory(void* data, size_t bytes);
+
+template<typename T>
+void prepareRtMemory(std::vector<T>& vector) {
+	prepareRtMemory(vector.data(), vector.size() * sizeof(T));
+}
+
+// Marks a scope in which the current thread must not allocate or free memory;
+// e.g. process() or a capture thread. If the build defines
+// CHECK_RT_ALLOCATIONS, using operator new or delete in such a scope prints a
+// message and aborts, so that tests catch regressions. Otherwise, this does
+// nothing. Memory allocated by Windows or the C runtime directly isn't checked.
+class RtScope {
+	public:
+#ifdef CHECK_RT_ALLOCATIONS
+	RtScope();
+	~RtScope();
+#else
+	RtScope() {}
+#endif
+
+	RtScope(const RtScope&) = delete;
+	RtScope& operator=(const RtScope&) = delete;
+};
@@ -0,0 +1,191 @@
+/*
+ * App2Clap
+ * Audio session registry
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "sessionRegistry.h"
+
+#include <algorithm>
+
+bool SessionList::contains(DWORD pid) const {
+	return std::any_of(this->begin(), this->end(),
+		[pid](const AudioSession& session) {
+			return session.pid == pid;
+		}
+	);
+}
+
+float SessionList::peak(DWORD pid) const {
+	float peak = 0.0f;
+	for (const AudioSession& session : *this) {
+		float value;
+		if (session.pid == pid && session.meter &&
+				SUCCEEDED(session.meter->GetPeakValue(&value))) {
+			peak = std::max(peak, value);
+		}
+	}
+	return peak;
+}
+
+SessionRegistry& SessionRegistry::get() {
+	static SessionRegistry registry;
+	return registry;
+}
+
+std::shared_ptr<const SessionList> SessionRegistry::snapshot(bool refresh) {
+	std::lock_guard lock(this->_mutex);
+	// The registry gives us the same list until devices change.
+	auto devices = DeviceRegistry::get().snapshot(eRender);
+	if (devices != this->_devices) {
+		this->_unregister();
+		this->_devices = devices;
+		this->_register();
+		refresh = true;
+	}
+	// Read the generation before enumerating so that if a session is created
+	// while we're enumerating, we'll enumerate again next time.
+	const unsigned int generation = this->_generation;
+	if (refresh || !this->_list || this->_listGeneration != generation) {
+		this->_list = this->_enumerate();
+		this->_listGeneration = generation;
+	}
+	return this->_list;
+}
+
+std::shared_ptr<const SessionList> SessionRegistry::_enumerate() {
+	auto list = std::make_shared<SessionList>();
+	for (auto& manager : this->_managers) {
+		// Windows only sends session notifications once the session enumerator has
+		// been retrieved, so this is also necessary to receive them.
+		CComPtr<IAudioSessionEnumerator> sessions;
+		HRESULT hr = manager->GetSessionEnumerator(&sessions);
+		if (FAILED(hr)) {
+			continue;
+		}
+		int count = 0;
+		sessions->GetCount(&count);
+		for (int s = 0; s < count; ++s) {
+			CComPtr<IAudioSessionControl> control;
+			hr = sessions->GetSession(s, &control);
+			if (FAILED(hr)) {
+				continue;
+			}
+			AudioSessionState state;
+			if (FAILED(control->GetState(&state)) ||
+					state == AudioSessionStateExpired) {
+				continue;
+			}
+			CComQIPtr<IAudioSessionControl2> control2(control);
+			DWORD pid = 0;
+			// This returns a success code other than S_OK if the session spans
+			// multiple processes, but the pid is still useful.
+			if (!control2 || FAILED(control2->GetProcessId(&pid)) || pid == 0) {
+				continue;
+			}
+			list->push_back({pid, CComQIPtr<IAudioMeterInformation>(control)});
+		}
+	}
+	return list;
+}
+
+void SessionRegistry::addListener(HWND window) {
+	std::lock_guard lock(this->_listenersMutex);
+	this->_listeners.push_back(window);
+}
+
+void SessionRegistry::removeListener(HWND window) {
+	std::lock_guard lock(this->_listenersMutex);
+	std::erase(this->_listeners, window);
+}
+
+void SessionRegistry::_register() {
+	CComPtr<IMMDeviceEnumerator> enumerator;
+	HRESULT hr = enumerator.CoCreateInstance(__uuidof(MMDeviceEnumerator));
+	if (FAILED(hr)) {
+		return;
+	}
+	for (const AudioDevice& entry : *this->_devices) {
+		CComPtr<IMMDevice> device;
+		hr = enumerator->GetDevice(entry.id.c_str(), &device);
+		if (FAILED(hr)) {
+			continue;
+		}
+		CComPtr<IAudioSessionManager2> manager;
+		hr = device->Activate(__uuidof(IAudioSessionManager2), CLSCTX_ALL,
+			nullptr, (void**)&manager);
+		if (FAILED(hr)) {
+			continue;
+		}
+		manager->RegisterSessionNotification(this);
+		this->_managers.push_back(manager);
+	}
+}
+
+void SessionRegistry::addCallback(const void* owner,
+	std::function<void(DWORD)> callback
+) {
+	{
+		std::lock_guard lock(this->_listenersMutex);
+		this->_callbacks.push_back({owner, std::move(callback)});
+	}
+	// Make sure we're registered for notifications, which also requires that the
+	// sessions have been enumerated.
+	this->snapshot();
+}
+
+void SessionRegistry::removeCallback(const void* owner) {
+	std::lock_guard lock(this->_listenersMutex);
+	std::erase_if(this->_callbacks, [owner](const auto& item) {
+		return item.first == owner;
+	});
+}
+
+void SessionRegistry::_unregister() {
+	for (auto& manager : this->_managers) {
+		manager->UnregisterSessionNotification(this);
+	}
+	this->_managers.clear();
+}
+
+void SessionRegistry::shutdown() {
+	std::lock_guard lock(this->_mutex);
+	this->_unregister();
+	this->_devices = nullptr;
+	this->_list = nullptr;
+}
+
+HRESULT STDMETHODCALLTYPE SessionRegistry::QueryInterface(REFIID riid,
+	void** ppInterface
+) {
+	if (riid == __uuidof(IUnknown) ||
+			riid == __uuidof(IAudioSessionNotification)) {
+		*ppInterface = static_cast<IAudioSessionNotification*>(this);
+		return S_OK;
+	}
+	*ppInterface = nullptr;
+	return E_NOINTERFACE;
+}
+
+HRESULT STDMETHODCALLTYPE SessionRegistry::OnSessionCreated(
+	IAudioSessionControl* session
+) {
+	++this->_generation;
+	DWORD pid = 0;
+	CComQIPtr<IAudioSessionControl2> control(session);
+	if (!control || FAILED(control->GetProcessId(&pid))) {
+		pid = 0;
+	}
+	// This lock is only ever held briefly and never while calling Windows, so
+	// it's safe to take it here.
+	std::lock_guard lock(this->_listenersMutex);
+	for (HWND window : this->_listeners) {
+		PostMessage(window, WM_SESSIONS_CHANGED, 0, 0);
+	}
+	for (const auto& [owner, callback] : this->_callbacks) {
+		callback(pid);
+	}
+	return S_OK;
+}
@@ -0,0 +1,99 @@
+/*
+ * App2Clap
+ * Header for the audio session registry
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include "common.h"
+
+#include <atlcomcli.h>
+#include <audiopolicy.h>
+#include <endpointvolume.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "deviceRegistry.h"
+
+// Posted to listening windows when an audio session is created.
+constexpr UINT WM_SESSIONS_CHANGED = WM_APP + 2;
+
+struct AudioSession {
+	DWORD pid;
+	CComPtr<IAudioMeterInformation> meter;
+};
+
+class SessionList : public std::vector<AudioSession> {
+	public:
+	bool contains(DWORD pid) const;
+	// The highest current peak level of the sessions for pid, from 0 to 1.
+	float peak(DWORD pid) const;
+};
+
+// Keeps track of the processes which have audio sessions on any output device
+// for all instances in the process. Sessions are enumerated lazily the first
+// time they're needed and again only after Windows notifies us that a session
+// was created, devices changed or the caller asks for a refresh.
+class SessionRegistry : public IAudioSessionNotification {
+	public:
+	static SessionRegistry& get();
+
+	// Get the active and inactive (but not expired) sessions. Windows doesn't
+	// notify us when sessions expire, so pass refresh as true to enumerate again
+	// regardless. The returned list never changes. This must be called from the
+	// main thread.
+	std::shared_ptr<const SessionList> snapshot(bool refresh = false);
+
+	// Ask for WM_SESSIONS_CHANGED to be posted to window whenever a session is
+	// created.
+	void addListener(HWND window);
+	void removeListener(HWND window);
+
+	// Call callback from a Windows thread whenever a session is created, with
+	// the pid of the process which created it, or 0 if that isn't known. owner
+	// identifies the callback so it can be removed later. This must be called
+	// from the main thread.
+	void addCallback(const void* owner, std::function<void(DWORD)> callback);
+	void removeCallback(const void* owner);
+
+	// Stop receiving notifications from Windows. This must be called before the
+	// plug-in is unloaded.
+	void shutdown();
+
+	// IUnknown
+	// We're a static singleton, so reference counting is not needed.
+	ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+	ULONG STDMETHODCALLTYPE Release() override { return 1; }
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid,
+		void** ppInterface) override;
+
+	// IAudioSessionNotification
+	HRESULT STDMETHODCALLTYPE OnSessionCreated(
+		IAudioSessionControl* session) override;
+
+	private:
+	void _register();
+	void _unregister();
+	std::shared_ptr<const SessionList> _enumerate();
+
+	std::mutex _mutex;
+	// The devices for which we have session managers.
+	std::shared_ptr<const DeviceList> _devices;
+	std::vector<CComPtr<IAudioSessionManager2>> _managers;
+	std::shared_ptr<const SessionList> _list;
+	// Incremented whenever a session is created. Windows says we mustn't wait on
+	// locks in notification callbacks, so we use this instead of touching _list
+	// there.
+	std::atomic<unsigned int> _generation = 0;
+	unsigned int _listGeneration = 0;
+	std::mutex _listenersMutex;
+	std::vector<HWND> _listeners;
+	std::vector<std::pair<const void*, std::function<void(DWORD)>>> _callbacks;
+};
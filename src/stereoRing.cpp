@@ -0,0 +1,87 @@
+/*
+ * App2Clap
+ * Stereo ring used to pass captured audio between threads
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "stereoRing.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "rtMemory.h"
+
+void StereoRing::allocate(size_t frames, bool prefault) {
+	this->clear();
+	if (frames != this->_capacity) {
+		this->_data = frames ?
+			std::make_unique_for_overwrite<float[]>(frames * 2) : nullptr;
+		this->_capacity = frames;
+	}
+	if (prefault && frames > 0) {
+		prepareRtMemory(this->_data.get(), frames * 2 * sizeof(float));
+	}
+}
+
+size_t StereoRing::push(const float* data, size_t frames) {
+	const uint64_t tail = this->_tail.load(std::memory_order_relaxed);
+	const size_t space = this->_capacity -
+		(size_t)(tail - this->_head.load(std::memory_order_acquire));
+	frames = std::min(frames, space);
+	size_t done = 0;
+	while (done < frames) {
+		// Copy up to the end of the ring in one go, then wrap around.
+		const size_t pos = (size_t)((tail + done) % this->_capacity);
+		const size_t count = std::min(frames - done, this->_capacity - pos);
+		float* out = this->_data.get() + pos * 2;
+		if (data) {
+			std::memcpy(out, data + done * 2, count * 2 * sizeof(float));
+		} else {
+			std::fill_n(out, count * 2, 0.0f);
+		}
+		done += count;
+	}
+	this->_tail.store(tail + frames, std::memory_order_release);
+	return frames;
+}
+
+size_t StereoRing::pop(float* left, float* right, size_t frames) {
+	size_t done = 0;
+	while (done < frames) {
+		size_t count = frames - done;
+		const float* data = this->peek(count);
+		if (count == 0) {
+			break;
+		}
+		for (size_t f = 0; f < count; ++f) {
+			left[done + f] = data[f * 2];
+			right[done + f] = data[f * 2 + 1];
+		}
+		this->discard(count);
+		done += count;
+	}
+	return done;
+}
+
+const float* StereoRing::peek(size_t& frames) const {
+	const uint64_t head = this->_head.load(std::memory_order_relaxed);
+	if (this->_capacity == 0) {
+		frames = 0;
+		return nullptr;
+	}
+	const size_t pos = (size_t)(head % this->_capacity);
+	frames = std::min({frames,
+		(size_t)(this->_tail.load(std::memory_order_acquire) - head),
+		this->_capacity - pos});
+	return this->_data.get() + pos * 2;
+}
+
+size_t StereoRing::discard(size_t frames) {
+	const uint64_t head = this->_head.load(std::memory_order_relaxed);
+	frames = std::min<size_t>(frames,
+		(size_t)(this->_tail.load(std::memory_order_acquire) - head));
+	this->_head.store(head + frames, std::memory_order_release);
+	return frames;
+}
@@ -0,0 +1,82 @@
+/*
+ * App2Clap
+ * Header for the stereo ring used to pass captured audio between threads
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "lockfree.h"
+
+// Holds interleaved stereo audio passed from a single producer thread to a
+// single consumer thread, neither of which ever blocks or allocates. Capture
+// streams use one to pass audio from the capture thread to the audio thread
+// and another for audio which doesn't fit in the first because the host
+// stopped asking for it for a while; e.g. while saving a project.
+// Only the consumer removes audio, so a full ring can't drop its oldest audio;
+// the producer has to drop what it is pushing instead.
+class StereoRing {
+	public:
+	// Allocate space for frames stereo frames, discarding anything in the ring. 0
+	// frees the ring. If prefault is false, the ring is allocated without being
+	// initialised, so the OS only backs pages with memory once audio is pushed
+	// into them and can move them to the page file when they aren't being used.
+	// That suits a large ring which is rarely used. Otherwise, every page is
+	// touched now so that the threads never take a page fault. This must not be
+	// called while either thread is running.
+	void allocate(size_t frames, bool prefault = false);
+
+	size_t capacity() const {
+		return this->_capacity;
+	}
+
+	// The number of frames in the ring. This can be called from either thread.
+	// The other thread might change it straight afterwards, but the producer
+	// only ever sees it too high and the consumer only ever sees it too low.
+	size_t size() const {
+		return (size_t)(this->_tail.load(std::memory_order_acquire) -
+			this->_head.load(std::memory_order_acquire));
+	}
+
+	// Called by the producer to append frames of interleaved stereo audio. If
+	// data is null, silence is appended. Returns the number of frames appended,
+	// which is less than frames if the ring is full.
+	size_t push(const float* data, size_t frames);
+
+	// Called by the consumer to remove up to frames of audio into left and right.
+	// Returns the number of frames removed.
+	size_t pop(float* left, float* right, size_t frames);
+
+	// Called by the consumer to read audio without copying it out first. Returns
+	// the interleaved frames at the front of the ring and sets frames to how many
+	// of them can be read there, which is less than requested if the ring holds
+	// fewer or they wrap around the end. They stay in the ring until they are
+	// removed with discard().
+	const float* peek(size_t& frames) const;
+
+	// Called by the consumer to remove up to frames of audio without reading it.
+	// Returns the number of frames removed.
+	size_t discard(size_t frames);
+
+	// Discard everything in the ring. This must not be called while either thread
+	// is running.
+	void clear() {
+		this->_head = 0;
+		this->_tail = 0;
+	}
+
+	private:
+	// Interleaved stereo audio.
+	std::unique_ptr<float[]> _data;
+	size_t _capacity = 0;
+	// These only ever increase.
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _head = 0;
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _tail = 0;
+};
@@ -0,0 +1,94 @@
+/*
+ * App2Clap
+ * Real-time thread scheduling
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "threadPolicy.h"
+
+#ifdef _WIN32
+// Avoid min macro conflict with std::min.
+#define NOMINMAX
+#include <windows.h>
+#include <avrt.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+const wchar_t* describeThreadPriority(ThreadPriority priority) {
+	switch (priority) {
+		case ThreadPriority::Realtime:
+#ifdef _WIN32
+			return L"Pro Audio";
+#else
+			return L"real-time";
+#endif
+		case ThreadPriority::Raised:
+			return L"raised";
+		default:
+			return L"normal";
+	}
+}
+
+#ifdef _WIN32
+
+RealtimeThreadScope::RealtimeThreadScope(int core) {
+	if (core >= 0) {
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core);
+	}
+	DWORD taskIndex = 0;
+	this->_task = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+	if (this->_task) {
+		this->_priority = ThreadPriority::Realtime;
+		return;
+	}
+	// MMCSS might be disabled. Do the best we can without it.
+	if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+		this->_priority = ThreadPriority::Raised;
+	}
+}
+
+RealtimeThreadScope::~RealtimeThreadScope() {
+	if (this->_task) {
+		AvRevertMmThreadCharacteristics(this->_task);
+	} else if (this->_priority == ThreadPriority::Raised) {
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+	}
+}
+
+#else
+
+// Leave room above us for threads which are more important, such as the audio
+// server.
+constexpr int FIFO_PRIORITY_BELOW_MAX = 10;
+
+RealtimeThreadScope::RealtimeThreadScope(int core) {
+#ifdef __linux__
+	if (core >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(core, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+#endif
+	sched_param param = {};
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) -
+		FIFO_PRIORITY_BELOW_MAX;
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+		this->_priority = ThreadPriority::Realtime;
+	}
+	// Without the privilege to use SCHED_FIFO, there's nothing else which
+	// reliably helps, so we just stay at normal priority.
+}
+
+RealtimeThreadScope::~RealtimeThreadScope() {
+	if (this->_priority == ThreadPriority::Realtime) {
+		sched_param param = {};
+		pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+	}
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * App2Clap
+ * Header for real-time thread scheduling
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+// On Windows, this uses MMCSS. Elsewhere, it uses SCHED_FIFO.
+
+#include <atomic>
+#include <cstdint>
+
+// The scheduling a thread actually got, from best to worst.
+enum class ThreadPriority : uint8_t {
+	// The thread wasn't elevated.
+	Normal,
+	// The OS wouldn't give us real-time scheduling, but the thread's priority
+	// was raised within its normal class.
+	Raised,
+	// Real-time scheduling; i.e. MMCSS Pro Audio on Windows or SCHED_FIFO
+	// elsewhere.
+	Realtime,
+};
+
+const wchar_t* describeThreadPriority(ThreadPriority priority);
+
+// Gives the calling thread real-time scheduling for as long as this exists.
+// This should be created at the top of any thread which produces or consumes
+// audio. If core is not negative, the thread is also pinned to that CPU core.
+class RealtimeThreadScope {
+	public:
+	explicit RealtimeThreadScope(int core = -1);
+	~RealtimeThreadScope();
+
+	RealtimeThreadScope(const RealtimeThreadScope&) = delete;
+	RealtimeThreadScope& operator=(const RealtimeThreadScope&) = delete;
+
+	ThreadPriority priority() const {
+		return this->_priority;
+	}
+
+	private:
+	ThreadPriority _priority = ThreadPriority::Normal;
+	// The MMCSS task handle on Windows.
+	void* _task = nullptr;
+};
+
+// Statistics about how long a thread took to wake after the event it waits for.
+// These are written by that thread and can be read from any thread.
+class WakeLatency {
+	public:
+	// Called by the waking thread with the latency of one wake in 100 ns units.
+	void record(int64_t latency) {
+		if (this->_resetRequested.exchange(false, std::memory_order_acquire)) {
+			this->_count = 0;
+			this->_total = 0;
+			this->_max = 0;
+		}
+		if (latency < 0) {
+			// The clocks disagree slightly, which means there was no measurable
+			// latency.
+			latency = 0;
+		}
+		this->_count.store(this->_count.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+		this->_total.store(this->_total.load(std::memory_order_relaxed) + latency,
+			std::memory_order_relaxed);
+		if (latency > this->_max.load(std::memory_order_relaxed)) {
+			this->_max.store(latency, std::memory_order_relaxed);
+		}
+	}
+
+	// Ask the waking thread to start again. This can be called from any thread.
+	void reset() {
+		this->_resetRequested.store(true, std::memory_order_release);
+	}
+
+	uint64_t count() const {
+		return this->_count.load(std::memory_order_relaxed);
+	}
+
+	// The mean and maximum latency in 100 ns units.
+	int64_t mean() const {
+		const uint64_t count = this->count();
+		return count ? this->_total.load(std::memory_order_relaxed) / (int64_t)count :
+			0;
+	}
+
+	int64_t max() const {
+		return this->_max.load(std::memory_order_relaxed);
+	}
+
+	private:
+	std::atomic<uint64_t> _count = 0;
+	std::atomic<int64_t> _total = 0;
+	std::atomic<int64_t> _max = 0;
+	std::atomic<bool> _resetRequested = false;
+};
@@ -0,0 +1,191 @@
+/*
+ * App2Clap
+ * WAV file writer
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "wavFile.h"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr uint16_t WAVE_FORMAT_PCM_TAG = 1;
+constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT_TAG = 3;
+// The number of samples we convert at a time.
+constexpr size_t CHUNK_SAMPLES = 4096;
+// The size of the ds64 chunk without a table, which is also the size of the
+// JUNK chunk that reserves space for it.
+constexpr uint32_t DS64_SIZE = 28;
+
+// Append value to out in little endian byte order, as WAV requires.
+template<typename T>
+static void putLittleEndian(std::vector<char>& out, T value) {
+	for (size_t b = 0; b < sizeof(T); ++b) {
+		out.push_back((char)((uint64_t)value >> (b * 8)));
+	}
+}
+
+static void putTag(std::vector<char>& out, const char* tag) {
+	out.insert(out.end(), tag, tag + 4);
+}
+
+static size_t bytesPerSample(WavSampleFormat format) {
+	return format == WavSampleFormat::Int16 ? 2 : 4;
+}
+
+bool WavWriter::open(const std::filesystem::path& path, uint32_t sampleRate,
+	uint16_t channels, WavSampleFormat format, bool allowRf64,
+	uint64_t allocationChunk
+) {
+	this->close();
+	this->_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!this->_file) {
+		return false;
+	}
+	this->_path = path;
+	this->_sampleRate = sampleRate;
+	this->_channels = channels;
+	this->_format = format;
+	this->_allowRf64 = allowRf64;
+	this->_allocationChunk = allocationChunk;
+	this->_allocated = 0;
+	this->_frames = 0;
+	return this->_writeHeader();
+}
+
+uint64_t WavWriter::_dataEnd() const {
+	return this->_dataOffset +
+		this->_frames * this->_channels * bytesPerSample(this->_format);
+}
+
+bool WavWriter::_allocate(uint64_t bytes) {
+	const uint64_t needed = this->_dataEnd() + bytes;
+	if (this->_allocationChunk == 0 || needed <= this->_allocated) {
+		return true;
+	}
+	const uint64_t size = (needed + this->_allocationChunk - 1) /
+		this->_allocationChunk * this->_allocationChunk;
+	// Extending the file doesn't move our write position, so anything we've
+	// buffered but not yet written still lands in the right place.
+	std::error_code error;
+	std::filesystem::resize_file(this->_path, size, error);
+	if (error) {
+		return false;
+	}
+	this->_allocated = size;
+	return true;
+}
+
+bool WavWriter::_writeHeader() {
+	const bool isFloat = this->_format == WavSampleFormat::Float32;
+	const uint16_t blockAlign =
+		(uint16_t)(this->_channels * bytesPerSample(this->_format));
+	const uint64_t dataBytes = this->_frames * blockAlign;
+	// The header is always the same size, so we can work this out up front.
+	const uint64_t headerBytes = 12 + (this->_allowRf64 ? 8 + DS64_SIZE : 0) +
+		8 + (isFloat ? 18 : 16) + (isFloat ? 12 : 0) + 8;
+	const uint64_t riffSize = headerBytes - 8 + dataBytes;
+	// Without allowRf64, sizes beyond 4 GB are clamped and the file is truncated
+	// as far as readers are concerned.
+	const bool isRf64 = this->_allowRf64 && riffSize > UINT32_MAX;
+	std::vector<char> header;
+	putTag(header, isRf64 ? "RF64" : "RIFF");
+	// RF64 files store the real sizes in the ds64 chunk.
+	putLittleEndian<uint32_t>(header, isRf64 ? UINT32_MAX :
+		(uint32_t)std::min<uint64_t>(riffSize, UINT32_MAX));
+	putTag(header, "WAVE");
+	if (isRf64) {
+		putTag(header, "ds64");
+		putLittleEndian<uint32_t>(header, DS64_SIZE);
+		putLittleEndian<uint64_t>(header, riffSize);
+		putLittleEndian<uint64_t>(header, dataBytes);
+		putLittleEndian<uint64_t>(header, this->_frames);
+		// There are no other chunks which need 64 bit sizes.
+		putLittleEndian<uint32_t>(header, 0);
+	} else if (this->_allowRf64) {
+		// Reserve space for the ds64 chunk in case the file gets that big.
+		putTag(header, "JUNK");
+		putLittleEndian<uint32_t>(header, DS64_SIZE);
+		header.insert(header.end(), DS64_SIZE, 0);
+	}
+	putTag(header, "fmt ");
+	// Non-PCM formats need the cbSize field.
+	putLittleEndian<uint32_t>(header, isFloat ? 18 : 16);
+	putLittleEndian<uint16_t>(header,
+		isFloat ? WAVE_FORMAT_IEEE_FLOAT_TAG : WAVE_FORMAT_PCM_TAG);
+	putLittleEndian<uint16_t>(header, this->_channels);
+	putLittleEndian<uint32_t>(header, this->_sampleRate);
+	putLittleEndian<uint32_t>(header, this->_sampleRate * blockAlign);
+	putLittleEndian<uint16_t>(header, blockAlign);
+	putLittleEndian<uint16_t>(header,
+		(uint16_t)(bytesPerSample(this->_format) * 8));
+	if (isFloat) {
+		putLittleEndian<uint16_t>(header, 0);
+		// Non-PCM formats need a fact chunk with the number of frames.
+		putTag(header, "fact");
+		putLittleEndian<uint32_t>(header, 4);
+		putLittleEndian<uint32_t>(header, (uint32_t)std::min<uint64_t>(
+			this->_frames, UINT32_MAX));
+	}
+	putTag(header, "data");
+	putLittleEndian<uint32_t>(header, isRf64 ? UINT32_MAX :
+		(uint32_t)std::min<uint64_t>(dataBytes, UINT32_MAX));
+	this->_dataOffset = (uint32_t)header.size();
+	this->_file.seekp(0);
+	this->_file.write(header.data(), header.size());
+	return (bool)this->_file;
+}
+
+bool WavWriter::write(const float* data, size_t frames) {
+	if (!this->isOpen()) {
+		return false;
+	}
+	const size_t samples = frames * this->_channels;
+	if (!this->_allocate(samples * bytesPerSample(this->_format))) {
+		return false;
+	}
+	if (this->_format == WavSampleFormat::Float32) {
+		this->_file.write((const char*)data, samples * sizeof(float));
+	} else {
+		for (size_t start = 0; start < samples; start += CHUNK_SAMPLES) {
+			const size_t count = std::min(CHUNK_SAMPLES, samples - start);
+			this->_scratch.resize(count * sizeof(int16_t));
+			int16_t* out = (int16_t*)this->_scratch.data();
+			for (size_t s = 0; s < count; ++s) {
+				out[s] = (int16_t)std::lrint(
+					std::clamp(data[start + s], -1.0f, 1.0f) * 32767.0f);
+			}
+			this->_file.write(this->_scratch.data(), this->_scratch.size());
+		}
+	}
+	this->_frames += frames;
+	return (bool)this->_file;
+}
+
+bool WavWriter::finalize() {
+	if (!this->isOpen()) {
+		return false;
+	}
+	if (!this->_writeHeader()) {
+		return false;
+	}
+	// If we've allocated ahead, the end of the file is beyond the audio.
+	this->_file.seekp((std::streamoff)this->_dataEnd());
+	this->_file.flush();
+	return (bool)this->_file;
+}
+
+void WavWriter::close() {
+	if (!this->isOpen()) {
+		return;
+	}
+	this->finalize();
+	this->_file.close();
+	if (this->_allocated > this->_dataEnd()) {
+		// Drop the space we allocated but didn't use.
+		std::error_code error;
+		std::filesystem::resize_file(this->_path, this->_dataEnd(), error);
+	}
+}
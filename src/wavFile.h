@@ -0,0 +1,82 @@
+/*
+ * App2Clap
+ * Header for the WAV file writer
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+enum class WavSampleFormat {
+	Float32,
+	Int16,
+};
+
+// Writes interleaved audio to a WAV file. The header is written when the file
+// is opened and updated by finalize() and close(), so a file which is never
+// finalized still has a valid header, just with the wrong length.
+// WAV files can't hold more than 4 GB. If allowRf64 is passed to open(), space
+// is reserved in the header so that the file can be turned into an RF64 file
+// (EBU Tech 3306) once it grows beyond that.
+// If allocationChunk is passed to open(), the file is extended by that many
+// bytes at a time ahead of the audio, so the file system allocates space in a
+// few large pieces rather than on every write, which keeps the file contiguous
+// and makes running out of space show up early. The file is trimmed to the
+// audio by close().
+class WavWriter {
+	public:
+	~WavWriter() {
+		this->close();
+	}
+
+	bool open(const std::filesystem::path& path, uint32_t sampleRate,
+		uint16_t channels, WavSampleFormat format, bool allowRf64 = false,
+		uint64_t allocationChunk = 0);
+
+	bool isOpen() const {
+		return this->_file.is_open();
+	}
+
+	// Append frames of interleaved float audio, converting it to the file's
+	// format.
+	bool write(const float* data, size_t frames);
+
+	// Update the header with the length written so far so that the file is
+	// complete up to this point.
+	bool finalize();
+
+	void close();
+
+	uint64_t framesWritten() const {
+		return this->_frames;
+	}
+
+	private:
+	bool _writeHeader();
+	// The offset of the end of the audio in the file.
+	uint64_t _dataEnd() const;
+	// Make sure the file has room for bytes more audio.
+	bool _allocate(uint64_t bytes);
+
+	std::ofstream _file;
+	std::filesystem::path _path;
+	uint64_t _allocationChunk = 0;
+	// The size the file has been extended to.
+	uint64_t _allocated = 0;
+	uint32_t _sampleRate = 0;
+	uint16_t _channels = 0;
+	WavSampleFormat _format = WavSampleFormat::Float32;
+	bool _allowRf64 = false;
+	uint64_t _frames = 0;
+	// The offset of the audio data in the file.
+	uint32_t _dataOffset = 0;
+	// Used to convert samples before writing them.
+	std::vector<char> _scratch;
+};
@@ -0,0 +1,111 @@
+/*
+ * App2Clap
+ * Shared worker pool
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "workerPool.h"
+
+#include <algorithm>
+
+// The most threads the pool uses. Opening a stream mostly waits for the audio
+// service, so a few threads give most of the benefit and more just contend.
+constexpr unsigned int MAX_WORKERS = 8;
+
+void WorkerPool::Job::cancelOrWait() {
+	std::unique_lock lock(this->_mutex);
+	if (this->_state == State::Queued) {
+		this->_state = State::Cancelled;
+		return;
+	}
+	this->_finished.wait(lock, [this] {
+		return this->_state != State::Running;
+	});
+}
+
+bool WorkerPool::Job::_begin() {
+	std::lock_guard lock(this->_mutex);
+	if (this->_state != State::Queued) {
+		return false;
+	}
+	this->_state = State::Running;
+	return true;
+}
+
+void WorkerPool::Job::_finish() {
+	{
+		std::lock_guard lock(this->_mutex);
+		this->_state = State::Finished;
+	}
+	this->_finished.notify_all();
+}
+
+WorkerPool& WorkerPool::get() {
+	static WorkerPool pool;
+	return pool;
+}
+
+std::shared_ptr<WorkerPool::Job> WorkerPool::submit(
+	std::function<void()> func
+) {
+	auto job = std::make_shared<Job>();
+	job->_func = std::move(func);
+	{
+		std::lock_guard lock(this->_mutex);
+		if (this->_threads.empty()) {
+			const unsigned int count = std::clamp(
+				std::thread::hardware_concurrency(), 2u, MAX_WORKERS);
+			for (unsigned int t = 0; t < count; ++t) {
+				this->_threads.emplace_back([this] { this->_run(); });
+			}
+		}
+		this->_queue.push_back(job);
+	}
+	this->_wake.notify_one();
+	return job;
+}
+
+void WorkerPool::shutdown() {
+	std::vector<std::thread> threads;
+	{
+		std::lock_guard lock(this->_mutex);
+		this->_stopping = true;
+		for (auto& job : this->_queue) {
+			job->cancelOrWait();
+		}
+		this->_queue.clear();
+		threads.swap(this->_threads);
+	}
+	this->_wake.notify_all();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	std::lock_guard lock(this->_mutex);
+	this->_stopping = false;
+}
+
+void WorkerPool::_run() {
+	for (;;) {
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock lock(this->_mutex);
+			this->_wake.wait(lock, [this] {
+				return this->_stopping || !this->_queue.empty();
+			});
+			if (this->_stopping) {
+				return;
+			}
+			job = std::move(this->_queue.front());
+			this->_queue.pop_front();
+		}
+		if (!job->_begin()) {
+			continue;
+		}
+		job->_func();
+		// Don't keep whatever the job captured alive.
+		job->_func = nullptr;
+		job->_finish();
+	}
+}
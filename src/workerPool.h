@@ -0,0 +1,71 @@
+/*
+ * App2Clap
+ * Header for the shared worker pool
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small pool of threads shared by all instances in the process for slow work
+// that mustn't block the host, such as opening streams. When a host restores a
+// project with many instances, they all submit their work at once. The pool
+// runs several jobs in parallel without starting a thread per instance.
+class WorkerPool {
+	public:
+	// Work submitted to the pool.
+	class Job {
+		public:
+		// Stop the job from running if it hasn't started yet. Otherwise, wait for
+		// it to finish. Either way, it isn't running once this returns. This must
+		// not be called from the job itself.
+		void cancelOrWait();
+
+		private:
+		friend class WorkerPool;
+		enum class State {
+			Queued,
+			Running,
+			Finished,
+			Cancelled,
+		};
+
+		// Returns false if the job was cancelled, in which case it mustn't run.
+		bool _begin();
+		void _finish();
+
+		std::function<void()> _func;
+		std::mutex _mutex;
+		std::condition_variable _finished;
+		State _state = State::Queued;
+	};
+
+	static WorkerPool& get();
+
+	// Run func on one of the pool's threads. Threads are started the first time
+	// they're needed.
+	std::shared_ptr<Job> submit(std::function<void()> func);
+
+	// Cancel queued jobs, wait for running jobs and stop the threads. This must
+	// be called before the plug-in is unloaded. The pool starts again if
+	// anything is submitted afterwards.
+	void shutdown();
+
+	private:
+	void _run();
+
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::deque<std::shared_ptr<Job>> _queue;
+	std::vector<std::thread> _threads;
+	bool _stopping = false;
+};
@@ -0,0 +1,33 @@
+/*
+ * App2Clap
+ * Minimal checks for the tests
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#pragma once
+
+#include <cstdio>
+
+// The tests have no dependencies beyond the standard library. A failed CHECK
+// prints where it failed and the test carries on, so that one run reports
+// every failure. main() should return checkResult().
+inline int checkFailures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+				#condition); \
+			++checkFailures; \
+		} \
+	} while (false)
+
+inline int checkResult() {
+	if (checkFailures > 0) {
+		fprintf(stderr, "%d checks failed\n", checkFailures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * App2Clap
+ * Tests for cross-correlation and test signal generation
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "correlation.h"
+
+// The same order and level as the latency measurement, but a shorter recording
+// so the tests run quickly.
+constexpr unsigned int MLS_ORDER = 14;
+constexpr float MLS_LEVEL = 0.5f;
+constexpr size_t RECORDING_LENGTH = 48000;
+
+static void testMls() {
+	CHECK(generateMls(1).empty());
+	CHECK(generateMls(25).empty());
+	for (unsigned int order : {2u, 10u, MLS_ORDER}) {
+		const std::vector<float> mls = generateMls(order);
+		CHECK(mls.size() == ((size_t)1 << order) - 1);
+		// A maximum length sequence has one more 1 than -1, and its circular
+		// autocorrelation is -1 at every non-zero lag.
+		double sum = 0;
+		double lag1 = 0;
+		for (size_t i = 0; i < mls.size(); ++i) {
+			sum += mls[i];
+			lag1 += mls[i] * mls[(i + 1) % mls.size()];
+		}
+		CHECK(sum == 1);
+		CHECK(lag1 == -1);
+	}
+}
+
+// Simulate a return path which delays the test signal by delay samples and
+// scales it by gain, with noise of the given level added.
+static std::vector<float> makeReturn(const std::vector<float>& reference,
+	size_t delay, float gain, float noise, std::mt19937& random
+) {
+	std::vector<float> signal(RECORDING_LENGTH);
+	std::normal_distribution<float> distribution(0.0f, noise);
+	for (size_t i = 0; i < signal.size(); ++i) {
+		if (noise > 0) {
+			signal[i] = distribution(random);
+		}
+		if (i >= delay && i - delay < reference.size()) {
+			signal[i] += reference[i - delay] * gain;
+		}
+	}
+	return signal;
+}
+
+static void testDelays() {
+	std::vector<float> reference = generateMls(MLS_ORDER);
+	for (float& sample : reference) {
+		sample *= MLS_LEVEL;
+	}
+	CrossCorrelator correlator(reference.size(), RECORDING_LENGTH);
+	std::mt19937 random(1);
+	const size_t maxDelay = RECORDING_LENGTH - reference.size();
+	for (size_t delay : {(size_t)0, (size_t)1, (size_t)4801, maxDelay - 1,
+			maxDelay}) {
+		const std::vector<float> signal = makeReturn(reference, delay, 0.7f, 0.0f,
+			random);
+		const CorrelationResult result = correlator.find(reference.data(),
+			signal.data());
+		CHECK(result.delay == delay);
+		CHECK(result.peakRatio > MIN_PEAK_RATIO);
+	}
+	// The return path inverts polarity.
+	std::vector<float> signal = makeReturn(reference, 1234, -0.5f, 0.0f, random);
+	CorrelationResult result = correlator.find(reference.data(), signal.data());
+	CHECK(result.delay == 1234);
+	CHECK(result.peakRatio > MIN_PEAK_RATIO);
+	// A quiet return buried in noise louder than it, as from a microphone in a
+	// noisy room.
+	signal = makeReturn(reference, 9999, 0.1f, 0.2f, random);
+	result = correlator.find(reference.data(), signal.data());
+	CHECK(result.delay == 9999);
+	CHECK(result.peakRatio > MIN_PEAK_RATIO);
+	// The test signal never arrived.
+	signal = makeReturn(reference, 0, 0.0f, 0.3f, random);
+	result = correlator.find(reference.data(), signal.data());
+	CHECK(result.peakRatio < MIN_PEAK_RATIO);
+	// Silence.
+	signal.assign(RECORDING_LENGTH, 0.0f);
+	result = correlator.find(reference.data(), signal.data());
+	CHECK(result.peakRatio < MIN_PEAK_RATIO);
+}
+
+int main() {
+	testMls();
+	testDelays();
+	return checkResult();
+}
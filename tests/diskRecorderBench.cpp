@@ -0,0 +1,116 @@
+/*
+ * App2Clap
+ * Benchmark for many direct-to-disk recordings at once
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "diskRecorder.h"
+
+// As many instances as a large project might record at once.
+constexpr int STREAMS = 32;
+constexpr uint32_t SAMPLE_RATE = 48000;
+constexpr uint32_t BLOCK_FRAMES = 512;
+
+using Clock = std::chrono::steady_clock;
+
+// Usage: diskRecorderBench [directory] [seconds of audio] [speed]
+// Each stream feeds its recorder from its own thread, as each plug-in's audio
+// thread would, but speed times faster than real time, so the disk has to
+// sustain speed times the normal load.
+int main(int argc, char** argv) {
+	const std::filesystem::path dir = argc > 1 ? std::filesystem::path(argv[1]) :
+		std::filesystem::temp_directory_path() / "diskRecorderBench";
+	const double seconds = argc > 2 ? atof(argv[2]) : 20;
+	const double speed = argc > 3 ? atof(argv[3]) : 4;
+	std::filesystem::create_directories(dir);
+	const uint64_t blocks = (uint64_t)(seconds * SAMPLE_RATE / BLOCK_FRAMES);
+	const auto blockInterval = std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(BLOCK_FRAMES / (SAMPLE_RATE * speed)));
+
+	std::vector<std::unique_ptr<DiskRecorder>> recorders;
+	for (int s = 0; s < STREAMS; ++s) {
+		recorders.push_back(std::make_unique<DiskRecorder>());
+		const auto path = dir / ("stream" + std::to_string(s) + ".wav");
+		if (!recorders.back()->start(path, SAMPLE_RATE,
+				WavSampleFormat::Float32)) {
+			fprintf(stderr, "couldn't create %s\n", path.string().c_str());
+			return 1;
+		}
+	}
+
+	const Clock::time_point start = Clock::now();
+	std::vector<std::thread> producers;
+	for (int s = 0; s < STREAMS; ++s) {
+		producers.emplace_back([&, s] {
+			std::vector<float> left(BLOCK_FRAMES);
+			std::vector<float> right(BLOCK_FRAMES);
+			Clock::time_point due = start;
+			for (uint64_t b = 0; b < blocks; ++b) {
+				for (uint32_t f = 0; f < BLOCK_FRAMES; ++f) {
+					left[f] = std::sin((float)(b * BLOCK_FRAMES + f) * 0.01f * (s + 1));
+					right[f] = -left[f];
+				}
+				recorders[s]->write(left.data(), right.data(), BLOCK_FRAMES);
+				due += blockInterval;
+				std::this_thread::sleep_until(due);
+			}
+		});
+	}
+	for (std::thread& producer : producers) {
+		producer.join();
+	}
+	const double produceSecs = std::chrono::duration<double>(
+		Clock::now() - start).count();
+	// Let all the writers finish in parallel.
+	for (auto& recorder : recorders) {
+		recorder->finish();
+	}
+	for (auto& recorder : recorders) {
+		recorder->stop();
+	}
+	const double totalSecs = std::chrono::duration<double>(
+		Clock::now() - start).count();
+
+	uint64_t written = 0;
+	uint64_t dropped = 0;
+	int failed = 0;
+	for (auto& recorder : recorders) {
+		written += recorder->framesWritten();
+		dropped += recorder->droppedFrames();
+		failed += recorder->failed();
+	}
+	// Allocating ahead mustn't leave anything after the audio.
+	for (int s = 0; s < STREAMS; ++s) {
+		const auto path = dir / ("stream" + std::to_string(s) + ".wav");
+		const uint64_t expected = recorders[s]->framesWritten() * 2 *
+			sizeof(float);
+		if (std::filesystem::file_size(path) < expected ||
+				std::filesystem::file_size(path) > expected + 1024) {
+			printf("stream %d: unexpected file size\n", s);
+			++failed;
+		}
+	}
+	const double megabytes = written * 2 * sizeof(float) / 1e6;
+	printf("%d streams, %.0f s of audio each at %.1fx real time\n", STREAMS,
+		seconds, speed);
+	printf("produced in %.2f s, on disk after %.2f s\n", produceSecs, totalSecs);
+	printf("throughput: %.1f MB/s, %.1f streams of real time audio\n",
+		megabytes / totalSecs,
+		(double)written / SAMPLE_RATE / totalSecs);
+	printf("dropped frames: %llu, failed streams: %d\n",
+		(unsigned long long)dropped, failed);
+	std::filesystem::remove_all(dir);
+	return dropped == 0 && failed == 0 ? 0 : 1;
+}
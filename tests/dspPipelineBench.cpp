@@ -0,0 +1,142 @@
+/*
+ * App2Clap
+ * Benchmark for the fused processing stages, a stage at a time and as chains
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "dspPipeline.h"
+
+constexpr uint32_t BLOCK_FRAMES = 512;
+constexpr int BLOCKS = 200000;
+
+using Clock = std::chrono::steady_clock;
+
+// A ramp which never finishes, so the gain stage can't be skipped.
+class Ramp {
+	public:
+	float next() {
+		this->_gain += 1e-9f;
+		return this->_gain;
+	}
+
+	private:
+	float _gain = 0.5f;
+};
+
+// Stops the compiler from optimising away work whose result isn't used.
+static volatile float sink;
+
+// Run body once per block and print the time per frame.
+template<typename Body>
+static void measure(const char* name, Body body) {
+	const Clock::time_point start = Clock::now();
+	for (int b = 0; b < BLOCKS; ++b) {
+		body();
+	}
+	const double ns = std::chrono::duration<double, std::nano>(
+		Clock::now() - start).count();
+	printf("%-40s %6.3f ns per frame\n", name,
+		ns / ((double)BLOCKS * BLOCK_FRAMES));
+}
+
+int main() {
+	std::vector<float> inLeft(BLOCK_FRAMES);
+	std::vector<float> inRight(BLOCK_FRAMES);
+	for (uint32_t f = 0; f < BLOCK_FRAMES; ++f) {
+		inLeft[f] = std::sin(f * 0.05f);
+		inRight[f] = std::cos(f * 0.05f);
+	}
+	std::vector<float> outLeft(BLOCK_FRAMES);
+	std::vector<float> outRight(BLOCK_FRAMES);
+	std::vector<float> interleaved(BLOCK_FRAMES * 2);
+	Ramp ramp;
+	LevelSums sums;
+
+	FusedStages<PlanarSource, PlanarSink> copy;
+	measure("copy", [&] {
+		copy.stage<0>().bind(inLeft.data(), inRight.data());
+		copy.stage<1>().bind(outLeft.data(), outRight.data());
+		copy.process(BLOCK_FRAMES);
+	});
+
+	FusedStages<PlanarSource, GainRampStage<Ramp>, PlanarSink> gain;
+	gain.stage<1>().bind(ramp);
+	measure("copy + gain ramp", [&] {
+		gain.stage<0>().bind(inLeft.data(), inRight.data());
+		gain.stage<2>().bind(outLeft.data(), outRight.data());
+		gain.process(BLOCK_FRAMES);
+	});
+
+	FusedStages<PlanarSource, MeterStage, PlanarSink> meter;
+	meter.stage<1>().bind(&sums);
+	measure("copy + meter", [&] {
+		sums = {};
+		meter.stage<0>().bind(inLeft.data(), inRight.data());
+		meter.stage<2>().bind(outLeft.data(), outRight.data());
+		meter.process(BLOCK_FRAMES);
+		sink = sums.peak[0];
+	});
+
+	FusedStages<PlanarSource, InterleavedSink> interleave;
+	measure("interleave", [&] {
+		interleave.stage<0>().bind(inLeft.data(), inRight.data());
+		interleave.stage<1>().bind(interleaved.data());
+		interleave.process(BLOCK_FRAMES);
+	});
+
+	// What Clap2App does with every block it sends.
+	FusedStages<PlanarSource, MeterStage, GainRampStage<Ramp>, InterleavedSink>
+		send;
+	send.stage<1>().bind(&sums);
+	send.stage<2>().bind(ramp);
+	measure("fused meter + gain ramp + interleave", [&] {
+		sums = {};
+		send.stage<0>().bind(inLeft.data(), inRight.data());
+		send.stage<3>().bind(interleaved.data());
+		send.process(BLOCK_FRAMES);
+		sink = sums.peak[0];
+	});
+
+	// The same work as separate passes, as it was done before the stages were
+	// fused.
+	measure("separate passes for the same", [&] {
+		for (uint32_t f = 0; f < BLOCK_FRAMES; ++f) {
+			const float g = ramp.next();
+			interleaved[f * 2] = inLeft[f] * g;
+			interleaved[f * 2 + 1] = inRight[f] * g;
+		}
+		measureSamples(inLeft.data(), BLOCK_FRAMES, sums.peak[0],
+			sums.sumSquares[0]);
+		measureSamples(inRight.data(), BLOCK_FRAMES, sums.peak[1],
+			sums.sumSquares[1]);
+		sink = sums.peak[0];
+	});
+
+	// What the capture plug-ins do with audio in their buffer.
+	std::vector<float> captured(BLOCK_FRAMES * 2);
+	for (uint32_t f = 0; f < BLOCK_FRAMES; ++f) {
+		captured[f * 2] = inLeft[f];
+		captured[f * 2 + 1] = inRight[f];
+	}
+	FusedStages<InterleavedSource, GainRampStage<Ramp>, MeterStage, PlanarSink>
+		deliver;
+	deliver.stage<1>().bind(ramp);
+	deliver.stage<2>().bind(&sums);
+	measure("fused capture delivery", [&] {
+		sums = {};
+		deliver.stage<0>().bind(captured.data());
+		deliver.stage<3>().bind(outLeft.data(), outRight.data());
+		deliver.process(BLOCK_FRAMES);
+		sink = sums.peak[0];
+	});
+
+	sink = outLeft[0] + outRight[0] + interleaved[0];
+	return 0;
+}
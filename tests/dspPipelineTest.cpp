@@ -0,0 +1,166 @@
+/*
+ * App2Clap
+ * Tests for the fused processing stages
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "check.h"
+#include "dspPipeline.h"
+
+// The same ramp as FadeIn, which can't be used here because it lives with the
+// Windows code.
+class Ramp {
+	public:
+	void start(uint32_t frames) {
+		this->_total = this->_remaining = frames;
+	}
+
+	float next() {
+		if (this->_remaining == 0) {
+			return 1.0f;
+		}
+		return 1.0f - (float)this->_remaining-- / this->_total;
+	}
+
+	private:
+	uint32_t _total = 0;
+	uint32_t _remaining = 0;
+};
+
+static bool near(float a, float b) {
+	return std::abs(a - b) <= 1e-4f * std::max(1.0f, std::abs(b));
+}
+
+static void testArena() {
+	DspArena arena;
+	arena.reserve(DspArena::footprint(100) + DspArena::footprint(7));
+	float* first = arena.allocate(100);
+	float* second = arena.allocate(7);
+	CHECK(first != nullptr);
+	CHECK(second != nullptr);
+	CHECK((uintptr_t)first % CACHE_LINE_SIZE == 0);
+	CHECK((uintptr_t)second % CACHE_LINE_SIZE == 0);
+	CHECK(second >= first + 100);
+	// We only reserved enough for those two.
+	CHECK(arena.allocate(1) == nullptr);
+	// Reserving again discards the earlier allocations.
+	arena.reserve(DspArena::footprint(100));
+	CHECK(arena.allocate(100) == first);
+}
+
+// Run each stage over the whole block separately, then check that the fused
+// chain gives the same result.
+static void testFusedMatchesStages() {
+	constexpr uint32_t FRAMES = 1000;
+	std::vector<float> inLeft(FRAMES);
+	std::vector<float> inRight(FRAMES);
+	for (uint32_t f = 0; f < FRAMES; ++f) {
+		inLeft[f] = std::sin(f * 0.05f) * 0.8f;
+		inRight[f] = std::cos(f * 0.03f) * -1.2f;
+	}
+
+	std::vector<float> expectLeft = inLeft;
+	std::vector<float> expectRight = inRight;
+	Ramp ramp;
+	ramp.start(300);
+	for (uint32_t f = 0; f < FRAMES; ++f) {
+		const float gain = ramp.next();
+		expectLeft[f] *= gain;
+		expectRight[f] *= gain;
+	}
+	LevelSums expectSums;
+	measureSamples(expectLeft.data(), FRAMES, expectSums.peak[0],
+		expectSums.sumSquares[0]);
+	measureSamples(expectRight.data(), FRAMES, expectSums.peak[1],
+		expectSums.sumSquares[1]);
+
+	std::vector<float> outLeft(FRAMES);
+	std::vector<float> outRight(FRAMES);
+	FusedStages<PlanarSource, GainRampStage<Ramp>, MeterStage, PlanarSink> chain;
+	ramp.start(300);
+	LevelSums sums;
+	chain.stage<1>().bind(ramp);
+	chain.stage<2>().bind(&sums);
+	// Process in two uneven blocks to check that the sums accumulate.
+	const uint32_t split = 333;
+	chain.stage<0>().bind(inLeft.data(), inRight.data());
+	chain.stage<3>().bind(outLeft.data(), outRight.data());
+	chain.process(split);
+	chain.stage<0>().bind(inLeft.data() + split, inRight.data() + split);
+	chain.stage<3>().bind(outLeft.data() + split, outRight.data() + split);
+	chain.process(FRAMES - split);
+
+	bool same = true;
+	for (uint32_t f = 0; f < FRAMES; ++f) {
+		same &= outLeft[f] == expectLeft[f] && outRight[f] == expectRight[f];
+	}
+	CHECK(same);
+	for (int c = 0; c < 2; ++c) {
+		CHECK(sums.peak[c] == expectSums.peak[c]);
+		CHECK(near(sums.sumSquares[c], expectSums.sumSquares[c]));
+	}
+}
+
+static void testInterleavedRoundTrip() {
+	std::vector<float> in;
+	for (int f = 0; f < 10; ++f) {
+		in.push_back((float)f);
+		in.push_back((float)-f);
+	}
+	std::vector<float> left(10);
+	std::vector<float> right(10);
+	FusedStages<InterleavedSource, PlanarSink> split;
+	split.stage<0>().bind(in.data());
+	split.stage<1>().bind(left.data(), right.data());
+	split.process(10);
+	for (int f = 0; f < 10; ++f) {
+		CHECK(left[f] == (float)f);
+		CHECK(right[f] == (float)-f);
+	}
+	std::vector<float> out(22, 99.0f);
+	FusedStages<PlanarSource, InterleavedSink> join;
+	join.stage<0>().bind(left.data(), right.data());
+	join.stage<1>().bind(out.data());
+	join.process(10);
+	CHECK(std::equal(in.begin(), in.end(), out.begin()));
+	// Nothing is written past the end of the block.
+	CHECK(out[20] == 99.0f);
+}
+
+static void testMonoSourceAndUnboundMeter() {
+	const float mono[] = {0.5f, -0.25f, 1.0f};
+	float left[3];
+	float right[3];
+	FusedStages<PlanarSource, MeterStage, PlanarSink> chain;
+	// With no right channel, left is used for both.
+	chain.stage<0>().bind(mono, nullptr);
+	chain.stage<2>().bind(left, right);
+	chain.process(3);
+	for (int f = 0; f < 3; ++f) {
+		CHECK(left[f] == mono[f]);
+		CHECK(right[f] == mono[f]);
+	}
+	LevelSums sums;
+	chain.stage<1>().bind(&sums);
+	chain.stage<0>().bind(mono, nullptr);
+	chain.stage<2>().bind(left, right);
+	chain.process(3);
+	CHECK(sums.peak[0] == 1.0f);
+	CHECK(sums.peak[1] == 1.0f);
+	CHECK(near(sums.sumSquares[0], 0.25f + 0.0625f + 1.0f));
+}
+
+int main() {
+	testArena();
+	testFusedMatchesStages();
+	testInterleavedRoundTrip();
+	testMonoSourceAndUnboundMeter();
+	return checkResult();
+}
@@ -0,0 +1,147 @@
+/*
+ * App2Clap
+ * Tests for low latency engine period negotiation
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include "check.h"
+#include "enginePeriod.h"
+
+// What a typical 48 kHz endpoint reports: 10 ms by default, down to 2.67 ms in
+// steps of 128 frames.
+constexpr EnginePeriodCaps TYPICAL = {
+	.defaultFrames = 480,
+	.fundamentalFrames = 128,
+	.minFrames = 128,
+	.maxFrames = 480,
+};
+
+static void testChoose() {
+	CHECK(chooseEnginePeriod(TYPICAL, 0) == 128);
+	CHECK(chooseEnginePeriod(TYPICAL, 480) == 128);
+	// Another stream already lowered the period, so we can only join it.
+	CHECK(chooseEnginePeriod(TYPICAL, 256) == 256);
+	// The engine is running at a period we can't use.
+	CHECK(chooseEnginePeriod(TYPICAL, 200) == 0);
+	// A minimum which isn't a multiple of the fundamental is rounded up.
+	EnginePeriodCaps caps = TYPICAL;
+	caps.minFrames = 100;
+	CHECK(chooseEnginePeriod(caps, 0) == 128);
+	// The endpoint can't go below its default.
+	caps = TYPICAL;
+	caps.minFrames = caps.maxFrames = caps.defaultFrames;
+	CHECK(chooseEnginePeriod(caps, 0) == 0);
+	// Nonsense from the endpoint.
+	caps = TYPICAL;
+	caps.fundamentalFrames = 0;
+	CHECK(chooseEnginePeriod(caps, 0) == 0);
+	caps = TYPICAL;
+	caps.minFrames = 960;
+	CHECK(chooseEnginePeriod(caps, 0) == 0);
+}
+
+// An endpoint which behaves as configured and records what was asked of it.
+class FakeEndpoint : public PeriodEndpoint {
+	public:
+	bool canQuery = true;
+	EnginePeriodCaps caps = TYPICAL;
+	uint32_t currentFrames = 0;
+	bool periodWorks = true;
+	// The buffer Windows gives us for a low latency period.
+	uint32_t bufferFrames = 256;
+	bool defaultWorks = true;
+
+	uint32_t requestedPeriod = 0;
+	bool initializedDefault = false;
+
+	bool queryPeriods(EnginePeriodCaps& caps,
+		uint32_t& currentFrames
+	) override {
+		if (!this->canQuery) {
+			return false;
+		}
+		caps = this->caps;
+		currentFrames = this->currentFrames;
+		return true;
+	}
+
+	bool initializeWithPeriod(uint32_t periodFrames,
+		uint32_t& bufferFrames
+	) override {
+		this->requestedPeriod = periodFrames;
+		bufferFrames = this->bufferFrames;
+		return this->periodWorks;
+	}
+
+	bool initializeDefault() override {
+		this->initializedDefault = true;
+		return this->defaultWorks;
+	}
+};
+
+static void testNegotiate() {
+	uint32_t period = 99;
+	{
+		FakeEndpoint endpoint;
+		CHECK(negotiateEnginePeriod(endpoint, true, 128, period));
+		CHECK(period == 128);
+		CHECK(endpoint.requestedPeriod == 128);
+		CHECK(!endpoint.initializedDefault);
+	}
+	{
+		// Low latency wasn't asked for, so the endpoint isn't even queried.
+		FakeEndpoint endpoint;
+		endpoint.canQuery = false;
+		CHECK(negotiateEnginePeriod(endpoint, false, 128, period));
+		CHECK(period == 0);
+		CHECK(endpoint.requestedPeriod == 0);
+		CHECK(endpoint.initializedDefault);
+	}
+	{
+		// The endpoint doesn't support IAudioClient3.
+		FakeEndpoint endpoint;
+		endpoint.canQuery = false;
+		CHECK(negotiateEnginePeriod(endpoint, true, 128, period));
+		CHECK(period == 0);
+		CHECK(endpoint.initializedDefault);
+	}
+	{
+		FakeEndpoint endpoint;
+		endpoint.periodWorks = false;
+		CHECK(negotiateEnginePeriod(endpoint, true, 128, period));
+		CHECK(period == 0);
+		CHECK(endpoint.requestedPeriod == 128);
+		CHECK(endpoint.initializedDefault);
+	}
+	{
+		// The buffer is too small for the plug-in's block size.
+		FakeEndpoint endpoint;
+		CHECK(negotiateEnginePeriod(endpoint, true, 512, period));
+		CHECK(period == 0);
+		CHECK(endpoint.initializedDefault);
+	}
+	{
+		// There's nothing to gain, so don't try.
+		FakeEndpoint endpoint;
+		endpoint.caps.minFrames = endpoint.caps.defaultFrames;
+		CHECK(negotiateEnginePeriod(endpoint, true, 128, period));
+		CHECK(period == 0);
+		CHECK(endpoint.requestedPeriod == 0);
+		CHECK(endpoint.initializedDefault);
+	}
+	{
+		FakeEndpoint endpoint;
+		endpoint.periodWorks = false;
+		endpoint.defaultWorks = false;
+		CHECK(!negotiateEnginePeriod(endpoint, true, 128, period));
+		CHECK(period == 0);
+	}
+}
+
+int main() {
+	testChoose();
+	testNegotiate();
+	return checkResult();
+}
@@ -0,0 +1,135 @@
+/*
+ * App2Clap
+ * Tests for the retroactive capture history
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include <cmath>
+#include <vector>
+
+#include "check.h"
+#include "historyRing.h"
+
+// Write frames whose left sample is its index / scale and right is the
+// negative, starting at first.
+static void writeRamp(HistoryRing& ring, size_t first, size_t frames,
+	float scale
+) {
+	std::vector<float> left(frames);
+	std::vector<float> right(frames);
+	for (size_t f = 0; f < frames; ++f) {
+		left[f] = (first + f) / scale;
+		right[f] = -left[f];
+	}
+	ring.write(left.data(), right.data(), frames);
+}
+
+// Check that out holds the frames from first onwards, as written by writeRamp.
+static bool isRamp(const std::vector<float>& out, size_t first, float scale,
+	float tolerance
+) {
+	for (size_t f = 0; f < out.size() / 2; ++f) {
+		const float expected = (first + f) / scale;
+		if (std::abs(out[f * 2] - expected) > tolerance ||
+				std::abs(out[f * 2 + 1] + expected) > tolerance) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void testUnconfigured() {
+	HistoryRing ring;
+	writeRamp(ring, 0, 10, 1);
+	std::vector<float> out;
+	CHECK(ring.read(out) == 0);
+	CHECK(out.empty());
+}
+
+static void testPartial() {
+	HistoryRing ring;
+	ring.configure(100, false);
+	writeRamp(ring, 0, 30, 1);
+	std::vector<float> out;
+	CHECK(ring.read(out) == 30);
+	CHECK(out.size() == 60);
+	CHECK(isRamp(out, 0, 1, 0));
+}
+
+static void testWrap() {
+	HistoryRing ring;
+	ring.configure(100, false);
+	// Write in uneven blocks so the writes straddle the end of the buffer.
+	size_t written = 0;
+	for (size_t block : {70, 45, 33, 90}) {
+		writeRamp(ring, written, block, 1);
+		written += block;
+	}
+	std::vector<float> out;
+	CHECK(ring.read(out) == 100);
+	CHECK(isRamp(out, written - 100, 1, 0));
+	// A single write larger than the history only keeps its end.
+	writeRamp(ring, written, 250, 1);
+	written += 250;
+	CHECK(ring.read(out) == 100);
+	CHECK(isRamp(out, written - 100, 1, 0));
+}
+
+static void testSilence() {
+	HistoryRing ring;
+	ring.configure(10, false);
+	writeRamp(ring, 1, 5, 1);
+	ring.writeSilence(3);
+	std::vector<float> out;
+	CHECK(ring.read(out) == 8);
+	CHECK(isRamp(std::vector<float>(out.begin(), out.begin() + 10), 1, 1, 0));
+	for (size_t s = 10; s < 16; ++s) {
+		CHECK(out[s] == 0.0f);
+	}
+}
+
+static void testPacked() {
+	HistoryRing ring;
+	ring.configure(1000, true);
+	CHECK(ring.isPacked());
+	// Values spanning the full range, so each is within one 16 bit step.
+	writeRamp(ring, 0, 1000, 1000);
+	std::vector<float> out;
+	CHECK(ring.read(out) == 1000);
+	CHECK(isRamp(out, 0, 1000, 1.0f / 32767));
+	// Samples beyond full scale are clipped rather than wrapping around.
+	const float loud[] = {1.5f, -3.0f};
+	ring.write(loud, loud + 1, 1);
+	ring.read(out);
+	CHECK(out[out.size() - 2] == 1.0f);
+	CHECK(out[out.size() - 1] == -1.0f);
+}
+
+static void testReconfigure() {
+	HistoryRing ring;
+	ring.configure(10, false);
+	writeRamp(ring, 0, 5, 1);
+	std::vector<float> out;
+	// The same configuration keeps the history.
+	ring.configure(10, false);
+	CHECK(ring.read(out) == 5);
+	// Switching to packing discards it.
+	ring.configure(10, true);
+	CHECK(ring.read(out) == 0);
+	CHECK(ring.isPacked());
+	ring.configure(20, false);
+	CHECK(!ring.isPacked());
+	CHECK(ring.capacity() == 20);
+}
+
+int main() {
+	testUnconfigured();
+	testPartial();
+	testWrap();
+	testSilence();
+	testPacked();
+	testReconfigure();
+	return checkResult();
+}
@@ -0,0 +1,130 @@
+/*
+ * App2Clap
+ * Tests for the lock-free primitives
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "check.h"
+#include "lockfree.h"
+
+static void testQueueFullAndEmpty() {
+	SpscQueue<int, 4> queue;
+	int item = -1;
+	CHECK(!queue.pop(item));
+	for (int i = 0; i < 4; ++i) {
+		CHECK(queue.push(i));
+	}
+	CHECK(!queue.push(4));
+	for (int i = 0; i < 4; ++i) {
+		CHECK(queue.pop(item));
+		CHECK(item == i);
+	}
+	CHECK(!queue.pop(item));
+	// Keep going well past the capacity so the indices wrap around the slots.
+	for (int i = 0; i < 100; ++i) {
+		CHECK(queue.push(i));
+		CHECK(queue.pop(item));
+		CHECK(item == i);
+	}
+}
+
+// Items must arrive in order with none lost or duplicated, even when both
+// threads are racing and the queue is often full.
+static void testQueueThreaded() {
+	constexpr uint32_t COUNT = 200000;
+	SpscQueue<uint32_t, 64> queue;
+	std::thread producer([&queue] {
+		for (uint32_t i = 0; i < COUNT;) {
+			if (queue.push(i)) {
+				++i;
+			} else {
+				// Let the consumer run, even on a single core.
+				std::this_thread::yield();
+			}
+		}
+	});
+	uint32_t expected = 0;
+	uint32_t outOfOrder = 0;
+	while (expected < COUNT) {
+		uint32_t item;
+		if (queue.pop(item)) {
+			outOfOrder += item != expected;
+			expected = item + 1;
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	CHECK(outOfOrder == 0);
+	uint32_t item;
+	CHECK(!queue.pop(item));
+}
+
+static void testSnapshotLatest() {
+	Snapshot<int> snapshot;
+	CHECK(snapshot.read() == 0);
+	snapshot.publish(1);
+	CHECK(snapshot.read() == 1);
+	// Reading again without a new value gives the same value.
+	CHECK(snapshot.read() == 1);
+	snapshot.publish(2);
+	snapshot.publish(3);
+	CHECK(snapshot.read() == 3);
+	snapshot.publish(4);
+	CHECK(snapshot.read() == 4);
+}
+
+// A value which is torn if the reader sees a slot while the writer is
+// writing it.
+struct Pair {
+	uint64_t a = 0;
+	uint64_t b = 0;
+};
+
+// The reader must never see a torn value or go back to an older one.
+static void testSnapshotThreaded() {
+	constexpr uint64_t COUNT = 200000;
+	Snapshot<Pair> snapshot;
+	std::atomic<bool> done = false;
+	std::thread writer([&] {
+		for (uint64_t i = 1; i <= COUNT; ++i) {
+			snapshot.publish({i, ~i});
+		}
+		done = true;
+	});
+	uint64_t last = 0;
+	uint32_t torn = 0;
+	uint32_t backwards = 0;
+	for (;;) {
+		const bool finished = done;
+		const Pair value = snapshot.read();
+		if (value.a != 0 || value.b != 0) {
+			torn += value.b != ~value.a;
+		}
+		backwards += value.a < last;
+		last = value.a;
+		if (finished) {
+			break;
+		}
+		std::this_thread::yield();
+	}
+	writer.join();
+	CHECK(torn == 0);
+	CHECK(backwards == 0);
+	// Once the writer is done, the reader must see its last value.
+	CHECK(snapshot.read().a == COUNT);
+}
+
+int main() {
+	testQueueFullAndEmpty();
+	testQueueThreaded();
+	testSnapshotLatest();
+	testSnapshotThreaded();
+	return checkResult();
+}
@@ -0,0 +1,135 @@
+/*
+ * App2Clap
+ * Benchmark for the process index with a synthetic process list
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "processIndex.h"
+
+// Roughly what a busy desktop with a few browsers and IDEs runs.
+constexpr uint32_t PROCESS_COUNT = 5000;
+constexpr int REFRESHES = 200;
+// Per refresh, the fraction of processes which exit and are replaced by new
+// ones, some of which reuse the pid.
+constexpr double CHURN = 0.01;
+// Per refresh, the fraction of processes whose thread count changes.
+constexpr double THREAD_CHANGES = 0.1;
+
+using Clock = std::chrono::steady_clock;
+
+static double msSince(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start)
+		.count();
+}
+
+int main() {
+	std::mt19937 random(1);
+	std::vector<ProcessEntry> entries;
+	std::vector<uint64_t> creationTimes;
+	uint64_t now = 1;
+	for (uint32_t p = 0; p < PROCESS_COUNT; ++p) {
+		entries.push_back({
+			.pid = (p + 2) * 4,
+			.parentPid = p == 0 ? 0 : (uint32_t)(random() % p + 2) * 4,
+			.threadCount = (uint32_t)(random() % 50 + 1),
+			.exe = L"process" + std::to_wstring(p % 300) + L".exe",
+		});
+		creationTimes.push_back(now++);
+	}
+	// Getting the creation time means opening the process, which is the
+	// expensive part of a refresh on Windows. Count how often we'd do that.
+	uint64_t queries = 0;
+	const uint32_t maxPid = (PROCESS_COUNT + 2) * 4;
+	std::vector<uint64_t> creationByPid(maxPid + 1);
+	auto getCreationTime = [&](uint32_t pid) {
+		++queries;
+		return creationByPid[pid];
+	};
+	auto publish = [&] {
+		std::fill(creationByPid.begin(), creationByPid.end(), 0);
+		for (size_t e = 0; e < entries.size(); ++e) {
+			creationByPid[entries[e].pid] = creationTimes[e];
+		}
+	};
+	publish();
+
+	ProcessIndex index;
+	Clock::time_point start = Clock::now();
+	index.update(entries, getCreationTime);
+	printf("initial update: %u processes, %.3f ms, %llu creation time queries\n",
+		PROCESS_COUNT, msSince(start), (unsigned long long)queries);
+
+	queries = 0;
+	start = Clock::now();
+	for (int r = 0; r < REFRESHES; ++r) {
+		index.update(entries, getCreationTime);
+	}
+	printf("unchanged refresh: %.3f ms average, %llu creation time queries\n",
+		msSince(start) / REFRESHES, (unsigned long long)queries);
+
+	queries = 0;
+	double updateMs = 0;
+	uint64_t sameExe = 0;
+	for (int r = 0; r < REFRESHES; ++r) {
+		for (size_t e = 0; e < entries.size(); ++e) {
+			const double roll = std::uniform_real_distribution<double>()(random);
+			if (roll < CHURN) {
+				// The process exited and another started with the same pid. Windows
+				// often reuses a pid straight away, sometimes for the same executable
+				// and parent, such as when a launcher restarts a helper.
+				if (random() % 2 == 0) {
+					++sameExe;
+				} else {
+					entries[e].exe = L"process" + std::to_wstring(random() % 300) +
+						L".exe";
+				}
+				entries[e].threadCount = (uint32_t)(random() % 50 + 1);
+				creationTimes[e] = now++;
+			} else if (roll < CHURN + THREAD_CHANGES) {
+				entries[e].threadCount = (uint32_t)(random() % 50 + 1);
+			}
+		}
+		publish();
+		start = Clock::now();
+		index.update(entries, getCreationTime);
+		updateMs += msSince(start);
+	}
+	printf(
+		"refresh with %.0f%% churn and %.0f%% thread changes: %.3f ms average, "
+		"%.1f creation time queries per refresh, %llu pids reused by the same "
+		"executable\n",
+		CHURN * 100, THREAD_CHANGES * 100, updateMs / REFRESHES,
+		(double)queries / REFRESHES, (unsigned long long)sameExe);
+
+	// Every process should have the creation time of the process which now has
+	// its pid. A pid reused by the same executable and parent with the same
+	// thread count can't be noticed without querying every process, so a few
+	// entries might be stale.
+	size_t stale = 0;
+	for (const auto& info : index.query(L"")) {
+		if (info->creationTime != creationByPid[info->pid]) {
+			++stale;
+		}
+	}
+	printf("stale entries: %zu\n", stale);
+
+	const std::wstring filters[] = {L"", L"process1", L"process12.exe", L"none"};
+	for (const std::wstring& filter : filters) {
+		start = Clock::now();
+		size_t matches = 0;
+		for (int r = 0; r < REFRESHES; ++r) {
+			matches = index.query(filter).size();
+		}
+		printf("query \"%ls\": %zu matches, %.3f ms average\n", filter.c_str(),
+			matches, msSince(start) / REFRESHES);
+	}
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * App2Clap
+ * Tests for the stereo ring used to pass captured audio between threads
+ * Author: James Teh <jamie@jantrid.net>
+ * Copyright 2026 James Teh
+ * License: GNU General Public License version 2.0
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "stereoRing.h"
+
+// Interleaved frames whose left sample is first + the frame index and right is
+// the negative.
+static std::vector<float> makeFrames(size_t first, size_t frames) {
+	std::vector<float> data(frames * 2);
+	for (size_t f = 0; f < frames; ++f) {
+		data[f * 2] = (float)(first + f);
+		data[f * 2 + 1] = -(float)(first + f);
+	}
+	return data;
+}
+
+static void testFullAndWrap() {
+	StereoRing ring;
+	ring.allocate(10, true);
+	CHECK(ring.capacity() == 10);
+	CHECK(ring.size() == 0);
+	// A full ring drops what doesn't fit rather than overwriting.
+	CHECK(ring.push(makeFrames(0, 7).data(), 7) == 7);
+	CHECK(ring.push(makeFrames(7, 7).data(), 7) == 3);
+	CHECK(ring.size() == 10);
+	float left[10];
+	float right[10];
+	CHECK(ring.pop(left, right, 6) == 6);
+	for (int f = 0; f < 6; ++f) {
+		CHECK(left[f] == (float)f);
+		CHECK(right[f] == -(float)f);
+	}
+	// This wraps around the end.
+	CHECK(ring.push(makeFrames(10, 5).data(), 5) == 5);
+	CHECK(ring.push(nullptr, 5) == 1);
+	CHECK(ring.pop(left, right, 10) == 10);
+	for (int f = 0; f < 9; ++f) {
+		CHECK(left[f] == (float)(f + 6));
+		CHECK(right[f] == -(float)(f + 6));
+	}
+	CHECK(left[9] == 0.0f);
+	CHECK(ring.pop(left, right, 1) == 0);
+}
+
+static void testPeekAndDiscard() {
+	StereoRing ring;
+	ring.allocate(8);
+	ring.push(makeFrames(0, 6).data(), 6);
+	CHECK(ring.discard(4) == 4);
+	ring.push(makeFrames(6, 5).data(), 5);
+	// Frames 4 to 10 are in the ring, but only 4 to 7 are before the end.
+	size_t frames = 7;
+	const float* data = ring.peek(frames);
+	CHECK(frames == 4);
+	CHECK(data[0] == 4.0f);
+	CHECK(data[7] == -7.0f);
+	// Peeking doesn't remove anything.
+	CHECK(ring.size() == 7);
+	ring.discard(frames);
+	frames = 7;
+	data = ring.peek(frames);
+	CHECK(frames == 3);
+	CHECK(data[0] == 8.0f);
+	CHECK(ring.discard(100) == 3);
+	frames = 1;
+	ring.peek(frames);
+	CHECK(frames == 0);
+	// Unallocated rings are always empty.
+	StereoRing empty;
+	frames = 1;
+	empty.peek(frames);
+	CHECK(frames == 0);
+	CHECK(empty.push(makeFrames(0, 1).data(), 1) == 0);
+}
+
+constexpr size_t THREADED_FRAMES = 200000;
+// Not a divisor of the capacity, so reads and writes wrap at different points.
+constexpr size_t BLOCK = 37;
+
+// Frames must arrive in order with none lost, duplicated or torn, even when
+// the consumer reads while the producer is writing the next frames.
+static void testThreaded() {
+	StereoRing ring;
+	ring.allocate(256, true);
+	std::thread producer([&ring] {
+		for (size_t pushed = 0; pushed < THREADED_FRAMES;) {
+			const std::vector<float> frames = makeFrames(pushed,
+				std::min(BLOCK, THREADED_FRAMES - pushed));
+			pushed += ring.push(frames.data(), frames.size() / 2);
+			std::this_thread::yield();
+		}
+	});
+	size_t expected = 0;
+	size_t wrong = 0;
+	float left[BLOCK];
+	float right[BLOCK];
+	bool usePeek = false;
+	while (expected < THREADED_FRAMES) {
+		// Alternate between the two ways the capture stream reads.
+		usePeek = !usePeek;
+		if (usePeek) {
+			size_t frames = BLOCK;
+			const float* data = ring.peek(frames);
+			for (size_t f = 0; f < frames; ++f) {
+				wrong += data[f * 2] != (float)(expected + f) ||
+					data[f * 2 + 1] != -(float)(expected + f);
+			}
+			expected += ring.discard(frames);
+		} else {
+			const size_t frames = ring.pop(left, right, BLOCK);
+			for (size_t f = 0; f < frames; ++f) {
+				wrong += left[f] != (float)(expected + f) ||
+					right[f] != -(float)(expected + f);
+			}
+			expected += frames;
+		}
+		std::this_thread::yield();
+	}
+	producer.join();
+	CHECK(wrong == 0);
+	CHECK(ring.size() == 0);
+}
+
+int main() {
+	testFullAndWrap();
+	testPeekAndDiscard();
+	testThreaded();
+	return checkResult();
+}